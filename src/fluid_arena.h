@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace FluidSims
+{
+
+	constexpr std::size_t cacheLineSize = 64;
+	constexpr std::size_t pageSize = 4096;
+	constexpr std::size_t hugePageSize = 2 * 1024 * 1024;
+
+	inline std::size_t alignUp(const std::size_t value, const std::size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Non-owning view of one field plane inside a FieldArena.
+	// Copying a plane copies the view, not the data.
+	template<typename T>
+	class FieldPlane
+	{
+	public:
+		FieldPlane() = default;
+
+		FieldPlane(T* data, const std::size_t count)
+			: m_data(data), m_count(count)
+		{
+		}
+
+		T& operator[](const std::size_t i) { return m_data[i]; }
+		const T& operator[](const std::size_t i) const { return m_data[i]; }
+
+		T* data() { return m_data; }
+		const T* data() const { return m_data; }
+		std::size_t size() const { return m_count; }
+
+		T* begin() { return m_data; }
+		T* end() { return m_data + m_count; }
+		const T* begin() const { return m_data; }
+		const T* end() const { return m_data + m_count; }
+
+		void fill(const T& value) { std::fill(begin(), end(), value); }
+
+	private:
+		T* m_data = nullptr;
+		std::size_t m_count = 0;
+	};
+
+	// Computes byte offsets of planes packed into one arena block. Every plane starts on a
+	// cache line and is followed by one line of padding, so planes whose size is a multiple
+	// of the page size do not all map onto the same cache sets.
+	class FieldLayout
+	{
+	public:
+		template<typename T>
+		std::size_t add(const std::size_t count)
+		{
+			const std::size_t offset = m_bytes;
+			m_bytes += alignUp(count * sizeof(T), cacheLineSize) + cacheLineSize;
+			return offset;
+		}
+
+		std::size_t bytes() const { return m_bytes; }
+
+	private:
+		std::size_t m_bytes = 0;
+	};
+
+	// One cache-line aligned block that holds every plane of a Fluid.
+	// The block only grows, so a Fluid can be re-created or resized on the same arena without
+	// going back to the allocator. An arena backs one live Fluid at a time.
+	//
+	// A file-backed arena maps a scratch file shared instead of anonymous memory, so the
+	// kernel can write cold pages back to disk instead of running out of memory; grids larger
+	// than RAM then cost I/O rather than the process. The file is removed on release.
+	// Elsewhere than on Linux a file-backed arena falls back to memory.
+	class FieldArena
+	{
+	public:
+		enum flags_t : unsigned
+		{
+			DEFAULT = 0,
+			HUGE_PAGES = 1 << 0,	// ask for transparent huge pages (Linux)
+			POPULATE = 1 << 1,	// fault all pages in up front
+		};
+
+		explicit FieldArena(const unsigned flags = DEFAULT)
+			: m_flags(flags)
+		{
+		}
+
+		explicit FieldArena(std::string backingFile, const unsigned flags = DEFAULT)
+			: m_flags(flags), m_backingFile(std::move(backingFile))
+		{
+		}
+
+		FieldArena(const FieldArena&) = delete;
+		FieldArena& operator=(const FieldArena&) = delete;
+
+		~FieldArena()
+		{
+			release();
+		}
+
+		// Returns a block of at least `bytes` bytes. The contents are not preserved when the
+		// block has to grow.
+		std::byte* reserve(const std::size_t bytes)
+		{
+			if (bytes <= m_capacity)
+				return m_data;
+
+			release();
+			allocate(bytes);
+			return m_data;
+		}
+
+		// Replaces the block with a private, copy-on-write mapping of bytes [offset, offset + bytes)
+		// of a file, so saved planes can be used in place. `offset` must be page aligned.
+		// Returns false where mapping is unavailable or fails; the arena is left empty then.
+		bool mapFile(const char* path, const std::size_t offset, const std::size_t bytes)
+		{
+			release();
+
+#if defined(__linux__)
+			const int fd = open(path, O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			const int mapFlags = MAP_PRIVATE | ((m_flags & POPULATE) ? MAP_POPULATE : 0);
+			void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, mapFlags, fd, static_cast<off_t>(offset));
+			close(fd);
+
+			if (data == MAP_FAILED)
+				return false;
+
+			m_data = static_cast<std::byte*>(data);
+			m_capacity = bytes;
+			return true;
+#else
+			(void)path;
+			(void)offset;
+			(void)bytes;
+			return false;
+#endif
+		}
+
+		template<typename T>
+		FieldPlane<T> plane(const std::size_t offset, const std::size_t count)
+		{
+			return FieldPlane<T>(reinterpret_cast<T*>(m_data + offset), count);
+		}
+
+		std::byte* data() { return m_data; }
+		std::size_t capacity() const { return m_capacity; }
+		unsigned flags() const { return m_flags; }
+		bool fileBacked() const { return m_fd >= 0; }
+
+		// Hints that [begin, begin + bytes) of the block is needed soon, so reading it back
+		// from the file overlaps with work on other ranges. A no-op for memory-backed arenas.
+		void prefetch(const void* begin, const std::size_t bytes)
+		{
+#if defined(__linux__)
+			if (!fileBacked() || bytes == 0)
+				return;
+
+			const std::size_t first = offsetOf(begin) / pageSize * pageSize;
+			const std::size_t last = std::min(alignUp(offsetOf(begin) + bytes, pageSize), m_capacity);
+			madvise(m_data + first, last - first, MADV_WILLNEED);
+#else
+			(void)begin;
+			(void)bytes;
+#endif
+		}
+
+		// Starts writing [begin, begin + bytes) back to the file and drops it from this
+		// mapping, so the pages can be reclaimed once clean. The data stays valid and is read
+		// back on the next access. Only whole pages inside the range are affected; a no-op
+		// for memory-backed arenas.
+		void evict(const void* begin, const std::size_t bytes)
+		{
+#if defined(__linux__)
+			if (!fileBacked())
+				return;
+
+			const std::size_t first = alignUp(offsetOf(begin), pageSize);
+			const std::size_t last = (offsetOf(begin) + bytes) / pageSize * pageSize;
+			if (last <= first)
+				return;
+
+			sync_file_range(m_fd, static_cast<off_t>(first), static_cast<off_t>(last - first), SYNC_FILE_RANGE_WRITE);
+			madvise(m_data + first, last - first, MADV_DONTNEED);
+#else
+			(void)begin;
+			(void)bytes;
+#endif
+		}
+
+	private:
+		std::size_t offsetOf(const void* p) const
+		{
+			return static_cast<std::size_t>(static_cast<const std::byte*>(p) - m_data);
+		}
+
+		void allocate(std::size_t bytes)
+		{
+#if defined(__linux__)
+			if (!m_backingFile.empty()) {
+				allocateFile(bytes);
+				return;
+			}
+
+			bytes = alignUp(bytes, (m_flags & HUGE_PAGES) ? hugePageSize : pageSize);
+
+			// MAP_POPULATE would fault the range in with small pages before madvise runs,
+			// so with huge pages the range is touched by hand afterwards instead.
+			int mapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+			if ((m_flags & POPULATE) && !(m_flags & HUGE_PAGES))
+				mapFlags |= MAP_POPULATE;
+
+			void* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, mapFlags, -1, 0);
+			if (data == MAP_FAILED)
+				throw std::bad_alloc();
+
+			m_data = static_cast<std::byte*>(data);
+
+			if (m_flags & HUGE_PAGES) {
+				madvise(data, bytes, MADV_HUGEPAGE);
+
+				if (m_flags & POPULATE) {
+					for (std::size_t offset = 0; offset < bytes; offset += pageSize)
+						m_data[offset] = std::byte{ 0 };
+				}
+			}
+#else
+			bytes = alignUp(bytes, cacheLineSize);
+			m_data = static_cast<std::byte*>(::operator new(bytes, std::align_val_t{ cacheLineSize }));
+
+			if (m_flags & POPULATE)
+				std::fill(m_data, m_data + bytes, std::byte{ 0 });
+#endif
+			m_capacity = bytes;
+		}
+
+#if defined(__linux__)
+		void allocateFile(std::size_t bytes)
+		{
+			bytes = alignUp(bytes, pageSize);
+
+			m_fd = open(m_backingFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+			if (m_fd < 0)
+				throw std::bad_alloc();
+
+			void* data = MAP_FAILED;
+			if (ftruncate(m_fd, static_cast<off_t>(bytes)) == 0) {
+				const int mapFlags = MAP_SHARED | ((m_flags & POPULATE) ? MAP_POPULATE : 0);
+				data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, mapFlags, m_fd, 0);
+			}
+
+			if (data == MAP_FAILED) {
+				close(m_fd);
+				unlink(m_backingFile.c_str());
+				m_fd = -1;
+				throw std::bad_alloc();
+			}
+
+			m_data = static_cast<std::byte*>(data);
+			m_capacity = bytes;
+		}
+#endif
+
+		void release()
+		{
+			if (m_data == nullptr)
+				return;
+
+#if defined(__linux__)
+			munmap(m_data, m_capacity);
+
+			if (m_fd >= 0) {
+				close(m_fd);
+				unlink(m_backingFile.c_str());
+				m_fd = -1;
+			}
+#else
+			::operator delete(m_data, std::align_val_t{ cacheLineSize });
+#endif
+			m_data = nullptr;
+			m_capacity = 0;
+		}
+
+		std::byte* m_data = nullptr;
+		std::size_t m_capacity = 0;
+		unsigned m_flags = DEFAULT;
+		std::string m_backingFile;
+		int m_fd = -1;
+	};
+
+}
@@ -0,0 +1,1080 @@
+#pragma once
+
+#include "fluid_sims.h"
+#include "fluid_codec.h"
+#include "fluid_diagnostics.h"
+#include "fluid_domain.h"
+#include "fluid_flip.h"
+#include "fluid_lod.h"
+#include "fluid_obstacles.h"
+#include "fluid_patch.h"
+#include "fluid_streamlines.h"
+#include "fluid_tiled.h"
+#include "fluid_tracers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace FluidSims
+{
+
+	struct BenchOptions
+	{
+		std::string name = "all";
+		std::size_t numX = 2048;
+		std::size_t numY = 2048;
+		std::size_t steps = 10;
+		std::size_t iterations = 40;
+		std::size_t threads = 0;
+		bool pin = true;
+		std::string scratch = "fluid_tiles.bin";
+		std::size_t residentMiB = 256;
+
+		// --bench [name] [--size WxH] [--steps N] [--iters N] [--threads N] [--no-pin]
+		//         [--scratch PATH] [--resident MiB]
+		static BenchOptions parse(const int argc, const char** argv)
+		{
+			BenchOptions options;
+
+			for (int arg = 1; arg < argc; arg++) {
+				const std::string key = argv[arg];
+				const bool hasValue = arg + 1 < argc;
+
+				if (key == "--size" && hasValue) {
+					const std::string size = argv[++arg];
+					const std::size_t x = size.find('x');
+					options.numX = std::stoul(size.substr(0, x));
+					options.numY = x == std::string::npos ? options.numX : std::stoul(size.substr(x + 1));
+				}
+				else if (key == "--steps" && hasValue)
+					options.steps = std::stoul(argv[++arg]);
+				else if (key == "--iters" && hasValue)
+					options.iterations = std::stoul(argv[++arg]);
+				else if (key == "--threads" && hasValue)
+					options.threads = std::stoul(argv[++arg]);
+				else if (key == "--scratch" && hasValue)
+					options.scratch = argv[++arg];
+				else if (key == "--resident" && hasValue)
+					options.residentMiB = std::stoul(argv[++arg]);
+				else if (key == "--no-pin")
+					options.pin = false;
+				else if (key.rfind("--", 0) != 0)
+					options.name = key;
+			}
+
+			return options;
+		}
+	};
+
+	// Empty wind tunnel: solid walls top, bottom and left, inflow through the first column.
+	// `global` is the column's index in the full grid, which differs from `i` in a subdomain.
+	template<typename FluidT>
+	void setupBenchColumn(FluidT& fluid, const std::size_t i, const std::size_t global)
+	{
+		const std::size_t n = fluid.numY;
+
+		for (std::size_t j = 0; j < fluid.numY; j++) {
+			fluid.solid[i * n + j] = (global == 0 || j == 0 || j == fluid.numY - 1) ? 0.0f : 1.0f;
+			fluid.h_v[i * n + j] = global == 1 ? 2.0f : 0.0f;
+			fluid.smoke[i * n + j] = (global == 0 && j > n / 3 && j < 2 * n / 3) ? 0.0f : 1.0f;
+		}
+	}
+
+	template<typename FluidT>
+	void setupBenchTunnel(FluidT& fluid)
+	{
+		fluid.forColumns(0, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+			for (std::size_t i = begin; i < end; i++)
+				setupBenchColumn(fluid, i, i);
+		});
+	}
+
+	inline double elapsedSeconds(const std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// STREAM triad on buffers each worker allocates and first-touches itself, summed per NUMA node.
+	inline void benchBandwidth(ThreadPool& pool, std::ostream& out)
+	{
+		const std::size_t count = 4 * 1024 * 1024;
+		const std::size_t reps = 10;
+
+		std::vector<std::vector<float>> a(pool.size());
+		std::vector<std::vector<float>> b(pool.size());
+		std::vector<std::vector<float>> c(pool.size());
+		std::vector<double> seconds(pool.size());
+
+		pool.run([&](const std::size_t worker) {
+			a[worker].assign(count, 0.0f);
+			b[worker].assign(count, 1.0f);
+			c[worker].assign(count, 2.0f);
+		});
+
+		pool.run([&](const std::size_t worker) {
+			float* x = a[worker].data();
+			const float* y = b[worker].data();
+			const float* z = c[worker].data();
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t rep = 0; rep < reps; rep++)
+				for (std::size_t i = 0; i < count; i++)
+					x[i] = y[i] + 0.5f * z[i];
+			seconds[worker] = elapsedSeconds(start);
+		});
+
+		std::vector<double> nodeBandwidth(pool.numNodes(), 0.0);
+		std::vector<std::size_t> nodeWorkers(pool.numNodes(), 0);
+		for (std::size_t worker = 0; worker < pool.size(); worker++) {
+			nodeBandwidth[pool.nodeOf(worker)] += 3.0 * sizeof(float) * count * reps / seconds[worker] * 1e-9;
+			nodeWorkers[pool.nodeOf(worker)]++;
+		}
+
+		double total = 0.0;
+		out << "bandwidth (triad, " << pool.size() << " workers)\n";
+		for (std::size_t node = 0; node < nodeBandwidth.size(); node++) {
+			out << "  node " << node << ": " << nodeWorkers[node] << " workers, " << nodeBandwidth[node] << " GB/s\n";
+			total += nodeBandwidth[node];
+		}
+		out << "  total: " << total << " GB/s\n";
+	}
+
+	// Steps an empty tunnel with 1, 2, 4, ... workers and reports parallel efficiency.
+	inline void benchScaling(const BenchOptions& options, std::ostream& out)
+	{
+		const std::size_t maxThreads = options.threads ? options.threads : CpuTopology::detect().numCpus();
+
+		std::vector<std::size_t> counts;
+		for (std::size_t threads = 1; threads < maxThreads; threads *= 2)
+			counts.push_back(threads);
+		counts.push_back(maxThreads);
+
+		out << "scaling " << options.numX << "x" << options.numY << ", " << options.iterations << " iterations\n";
+
+		double serial = 0.0;
+		for (const std::size_t threads : counts) {
+			IntegratorEuler integrator;
+			Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY,
+				nullptr, std::make_shared<ThreadPool>(threads, options.pin));
+			setupBenchTunnel(fluid);
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			if (threads == 1)
+				serial = perStep;
+
+			char line[128];
+			std::snprintf(line, sizeof(line), "  %3zu threads: %9.3f ms/step  speedup %6.2f  efficiency %5.1f%%\n",
+				threads, perStep * 1e3, serial / perStep, 100.0 * serial / perStep / threads);
+			out << line;
+		}
+	}
+
+	// Steps an empty tunnel split over 1, 2, 4, ... ranks (local processes sharing memory),
+	// reporting parallel efficiency and the largest difference to a single-domain run.
+	inline void benchDomains(const BenchOptions& options, std::ostream& out)
+	{
+		const std::size_t maxRanks = options.threads ? options.threads : 16;
+		// The inflow speed bounds the backtrace distance: 2 * dt / h cells, plus the bilinear stencil.
+		const std::size_t ghost = static_cast<std::size_t>(std::ceil(2.0f / 60 * options.numY)) + 3;
+		const std::size_t numCells = (options.numX + 2) * (options.numY + 2);
+
+		IntegratorEuler integrator;
+		Fluid reference(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY);
+		setupBenchTunnel(reference);
+		for (std::size_t step = 0; step < options.steps; step++)
+			reference.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		out << "domains " << options.numX << "x" << options.numY << ", " << options.iterations << " iterations, ghost " << ghost << "\n";
+
+		double serial = 0.0;
+		for (std::size_t numRanks = 1; numRanks <= maxRanks; numRanks *= 2) {
+			const std::size_t slotFloats = DomainSolver::slotFloats(ghost, options.numY);
+			const std::size_t sharedFloats = 2 * numCells + 1;
+
+#if defined(__linux__)
+			ShmTransport transport("/fluidsims_bench_" + std::to_string(getpid()), numRanks, slotFloats, sharedFloats);
+			if (!transport.good()) {
+				out << "  shared memory unavailable\n";
+				return;
+			}
+#else
+			LocalTransport transport(numRanks, slotFloats, sharedFloats);
+#endif
+
+			launchLocalRanks(numRanks, [&](const std::size_t rank) {
+				IntegratorEuler rankIntegrator;
+				DomainSolver solver(&rankIntegrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY,
+					rank, numRanks, ghost, transport);
+				solver.forLocalColumns([&](const std::size_t i, const std::size_t global) {
+					setupBenchColumn(solver.fluid, i, global);
+				});
+
+				transport.barrier();
+				const auto start = std::chrono::steady_clock::now();
+				for (std::size_t step = 0; step < options.steps; step++)
+					solver.simulate(1.0f / 60, 0.0f, options.iterations);
+				transport.barrier();
+
+				float* shared = transport.shared();
+				solver.gather(solver.fluid.h_v, shared);
+				solver.gather(solver.fluid.smoke, shared + numCells);
+				if (rank == 0)
+					shared[2 * numCells] = static_cast<float>(elapsedSeconds(start));
+			});
+
+			const float* shared = transport.shared();
+			float difference = 0.0f;
+			for (std::size_t k = 0; k < numCells; k++) {
+				difference = std::max(difference, std::abs(shared[k] - reference.h_v[k]));
+				difference = std::max(difference, std::abs(shared[numCells + k] - reference.smoke[k]));
+			}
+
+			const double perStep = shared[2 * numCells] / options.steps;
+			if (numRanks == 1)
+				serial = perStep;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %3zu ranks: %9.3f ms/step  speedup %6.2f  efficiency %5.1f%%  max diff %g\n",
+				numRanks, perStep * 1e3, serial / perStep, 100.0 * serial / perStep / numRanks, difference);
+			out << line;
+		}
+	}
+
+	// Steps an empty tunnel out of core: the fields live in a scratch file and TiledStepper
+	// keeps about --resident MiB of them mapped. Compares against an in-memory Fluid::simulate
+	// run, which it should match exactly.
+	inline void benchTiled(const BenchOptions& options, std::ostream& out)
+	{
+		IntegratorEuler integrator;
+		std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+
+		Fluid tiled(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY,
+			std::make_shared<FieldArena>(options.scratch), pool);
+		TiledStepper stepper(tiled, options.residentMiB << 20);
+		setupBenchTunnel(tiled);
+
+		out << "tiled " << options.numX << "x" << options.numY << ", " << options.iterations << " iterations, "
+			<< stepper.numTiles() << " tiles of " << stepper.tileColumns << " columns"
+			<< (tiled.arena->fileBacked() ? "" : " (in memory)") << "\n";
+
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t step = 0; step < options.steps; step++)
+			stepper.simulate(1.0f / 60, 0.0f, options.iterations);
+		const double perStep = elapsedSeconds(start) / options.steps;
+
+		Fluid reference(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+		setupBenchTunnel(reference);
+		const auto referenceStart = std::chrono::steady_clock::now();
+		for (std::size_t step = 0; step < options.steps; step++)
+			reference.simulate(1.0f / 60, 0.0f, options.iterations);
+		const double referencePerStep = elapsedSeconds(referenceStart) / options.steps;
+
+		float difference = 0.0f;
+		for (std::size_t k = 0; k < reference.numCells; k++) {
+			difference = std::max(difference, std::abs(tiled.h_v[k] - reference.h_v[k]));
+			difference = std::max(difference, std::abs(tiled.smoke[k] - reference.smoke[k]));
+		}
+
+		char line[160];
+		std::snprintf(line, sizeof(line), "  tiled: %9.3f ms/step  in memory: %9.3f ms/step  max diff %g\n",
+			perStep * 1e3, referencePerStep * 1e3, difference);
+		out << line;
+	}
+
+	// Steps an empty tunnel with SmokeT / PressureT storage and reports ms/step and the error
+	// of smoke and pressure against the all-float `reference` after the same number of steps.
+	template<typename SmokeT, typename PressureT>
+	void benchPrecisionCase(const char* name, const BenchOptions& options, const Fluid& reference, const double referencePerStep, std::ostream& out)
+	{
+		IntegratorEuler integrator;
+		BasicFluid<float, SmokeT, PressureT> fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY,
+			nullptr, reference.pool);
+		setupBenchTunnel(fluid);
+
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t step = 0; step < options.steps; step++)
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+		const double perStep = elapsedSeconds(start) / options.steps;
+
+		double smokeSum = 0.0;
+		float smokeMax = 0.0f;
+		float pressureMax = 0.0f;
+		float pressureScale = 0.0f;
+		for (std::size_t k = 0; k < reference.numCells; k++) {
+			const float smoke = std::abs(static_cast<float>(fluid.smoke[k]) - reference.smoke[k]);
+			smokeSum += smoke;
+			smokeMax = std::max(smokeMax, smoke);
+			pressureMax = std::max(pressureMax, std::abs(static_cast<float>(fluid.pressure[k]) - reference.pressure[k]));
+			pressureScale = std::max(pressureScale, std::abs(reference.pressure[k]));
+		}
+
+		char line[200];
+		std::snprintf(line, sizeof(line), "  %-16s %9.3f ms/step (%5.2fx)  smoke max %.2e mean %.2e  pressure max rel %.2e\n",
+			name, perStep * 1e3, referencePerStep / perStep, smokeMax, smokeSum / reference.numCells,
+			pressureScale > 0.0f ? pressureMax / pressureScale : 0.0f);
+		out << line;
+	}
+
+	// Accuracy and speed of reduced-precision smoke and pressure storage.
+	inline void benchPrecision(const BenchOptions& options, std::ostream& out)
+	{
+		IntegratorEuler integrator;
+		Fluid reference(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY,
+			nullptr, std::make_shared<ThreadPool>(options.threads, options.pin));
+		setupBenchTunnel(reference);
+
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t step = 0; step < options.steps; step++)
+			reference.simulate(1.0f / 60, 0.0f, options.iterations);
+		const double perStep = elapsedSeconds(start) / options.steps;
+
+#if defined(__F16C__)
+		out << "precision " << options.numX << "x" << options.numY << ", " << options.steps << " steps (F16C)\n";
+#else
+		out << "precision " << options.numX << "x" << options.numY << ", " << options.steps << " steps\n";
+#endif
+		char line[80];
+		std::snprintf(line, sizeof(line), "  %-16s %9.3f ms/step\n", "float/float", perStep * 1e3);
+		out << line;
+
+		benchPrecisionCase<Half, Half>("half/half", options, reference, perStep, out);
+		benchPrecisionCase<BFloat16, BFloat16>("bf16/bf16", options, reference, perStep, out);
+		benchPrecisionCase<UNorm16, Half>("unorm16/half", options, reference, perStep, out);
+		benchPrecisionCase<UNorm16, float>("unorm16/float", options, reference, perStep, out);
+	}
+
+	template<typename FluidT>
+	double benchFixedCase(FluidT& fluid, const BenchOptions& options)
+	{
+		setupBenchTunnel(fluid);
+		fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t step = 0; step < options.steps; step++)
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+		return elapsedSeconds(start) / options.steps;
+	}
+
+	// Runtime-sized Fluid against FixedFluid<NX, NY>, which runs the same kernels and must
+	// match it exactly, and against the double-precision reference at one size.
+	template<std::size_t NX, std::size_t NY>
+	void benchFixedSize(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		const float h = 1.0f / NY;
+
+		IntegratorEuler integrator;
+		Fluid dynamic(&integrator, 1000.0f, NX, NY, h, nullptr, pool);
+		const double dynamicPerStep = benchFixedCase(dynamic, options);
+
+		FixedFluid<NX, NY> fixed(&integrator, 1000.0f, NX, NY, h, nullptr, pool);
+		const double fixedPerStep = benchFixedCase(fixed, options);
+
+		BasicIntegratorEuler<double> doubleIntegrator;
+		BasicFluid<double> reference(&doubleIntegrator, 1000.0, NX, NY, 1.0 / NY, nullptr, pool);
+		const double doublePerStep = benchFixedCase(reference, options);
+
+		float difference = 0.0f;
+		double referenceDifference = 0.0;
+		for (std::size_t k = 0; k < dynamic.numCells; k++) {
+			difference = std::max(difference, std::abs(fixed.h_v[k] - dynamic.h_v[k]));
+			referenceDifference = std::max(referenceDifference, std::abs(reference.h_v[k] - static_cast<double>(dynamic.h_v[k])));
+		}
+
+		char line[200];
+		std::snprintf(line, sizeof(line), "  %zux%zu: runtime %8.3f ms/step  fixed %8.3f ms/step (diff %g)  double %8.3f ms/step (diff %.2e)\n",
+			NX, NY, dynamicPerStep * 1e3, fixedPerStep * 1e3, difference,
+			doublePerStep * 1e3, referenceDifference);
+		out << line;
+	}
+
+	inline void benchFixed(const BenchOptions& options, std::ostream& out)
+	{
+		out << "fixed size, " << options.iterations << " iterations\n";
+		benchFixedSize<256, 128>(options, out);
+		benchFixedSize<512, 256>(options, out);
+	}
+
+	// Empty tunnel with red-black SOR against the spectral direct solver, with the largest
+	// divergence left after the last step's projection.
+	inline void benchSpectral(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "spectral " << options.numX << "x" << options.numY << "\n";
+
+		for (const bool spectral : { false, true }) {
+			Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+			setupBenchTunnel(fluid);
+			fluid.spectral = spectral;
+
+			FlowDiagnostics diagnostics(1);
+			fluid.observers.push_back(&diagnostics);
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %-8s %4zu iterations: %9.3f ms/step  max div %.3e 1/s\n",
+				spectral ? "spectral" : "SOR", fluid.solveStats.iterations, perStep * 1e3, diagnostics.stats[diagnostics.stats.size() - 1].maxDivergence);
+			out << line;
+		}
+	}
+
+	// Cost of advecting smoke plus 0, 1, 3 and 6 scalar channels in the batched pass, next
+	// to what as many separate smoke-only passes would take.
+	inline void benchChannels(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "channels " << options.numX << "x" << options.numY << "\n";
+
+		double single = 0.0;
+		for (const std::size_t channels : { 0, 1, 3, 6 }) {
+			Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+			fluid.setScalarChannels(channels);
+			setupBenchTunnel(fluid);
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.advectSmoke(1.0f / 60);
+			const double perStep = elapsedSeconds(start) / options.steps;
+			if (channels == 0)
+				single = perStep;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %zu channels: %8.3f ms/advection  (%zu separate passes: %8.3f ms)\n",
+				channels, perStep * 1e3, channels + 1, single * (channels + 1) * 1e3);
+			out << line;
+		}
+	}
+
+	// Step cost with smoke refined 1, 2 and 4 times over the velocity grid, next to a
+	// velocity grid refined as much, which gives the same smoke resolution.
+	inline void benchFineSmoke(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "fine smoke " << options.numX << "x" << options.numY << ", " << options.iterations << " iterations\n";
+
+		auto time = [&](Fluid& fluid) {
+			setupBenchTunnel(fluid);
+			fluid.refineSmoke();
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			return elapsedSeconds(start) / options.steps;
+		};
+
+		for (const std::size_t k : { 1, 2, 4 }) {
+			Fluid refined(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+			refined.setSmokeRefinement(k);
+			const double refinedPerStep = time(refined);
+
+			Fluid full(&integrator, 1000.0f, options.numX * k, options.numY * k, 1.0f / (options.numY * k), nullptr, pool);
+			const double fullPerStep = time(full);
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  smoke x%zu: %9.3f ms/step  (velocity grid x%zu: %9.3f ms/step)\n",
+				k, refinedPerStep * 1e3, k, fullPerStep * 1e3);
+			out << line;
+		}
+	}
+
+	// Closed box holding one Gaussian vortex of radius ~0.15 (box height 1).
+	inline void setupBenchVortex(Fluid& fluid)
+	{
+		const std::size_t n = fluid.numY;
+		const float cx = 0.5f * fluid.numX * fluid.h;
+		const float cy = 0.5f * n * fluid.h;
+
+		auto swirl = [&](const float x, const float y) {
+			return std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) * 40.0f);
+		};
+
+		for (std::size_t i = 0; i < fluid.numX; i++) {
+			for (std::size_t j = 0; j < n; j++) {
+				fluid.solid[i * n + j] = (i == 0 || j == 0 || i == fluid.numX - 1 || j == n - 1) ? 0.0f : 1.0f;
+				fluid.h_v[i * n + j] = -((j + 0.5f) * fluid.h - cy) * swirl(i * fluid.h, (j + 0.5f) * fluid.h);
+				fluid.v_v[i * n + j] = ((i + 0.5f) * fluid.h - cx) * swirl((i + 0.5f) * fluid.h, j * fluid.h);
+			}
+		}
+	}
+
+	// Kinetic energy a free vortex keeps with grid advection at the given size and at twice
+	// the resolution, and with FLIP particles at the given size.
+	inline void benchFlip(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "flip vortex " << options.numX << "x" << options.numY << ", " << options.steps << " steps, " << options.iterations << " iterations\n";
+
+		for (const std::size_t scale : { 1, 2, 0 }) {
+			const bool particles = scale == 0;
+			const std::size_t k = particles ? 1 : scale;
+
+			Fluid fluid(&integrator, 1000.0f, options.numX * k, options.numY * k, 1.0f / (options.numY * k), nullptr, pool);
+			setupBenchVortex(fluid);
+			fluid.project(200, 1.0f / 60);
+
+			const float initial = FlowDiagnostics::reduce(fluid).kineticEnergy;
+			FlowDiagnostics diagnostics(1);
+			fluid.observers.push_back(&diagnostics);
+
+			FlipSolver flip(fluid);
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++) {
+				if (particles)
+					flip.simulate(1.0f / 60, 0.0f, options.iterations);
+				else
+					fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			}
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %-5s %5zux%-5zu %9.3f ms/step  energy kept %5.1f%%\n", particles ? "FLIP" : "grid",
+				fluid.numX - 2, fluid.numY - 2, perStep * 1e3, 100.0 * diagnostics.stats[diagnostics.stats.size() - 1].kineticEnergy / initial);
+			out << line;
+		}
+	}
+
+	// Tracer advection throughput on a developed tunnel flow, batched against a per-tracer
+	// sampleField() loop doing the same midpoint step (without compaction).
+	inline void benchTracers(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+		setupBenchTunnel(fluid);
+		for (std::size_t step = 0; step < options.steps; step++)
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		out << "tracers " << options.numX << "x" << options.numY << "\n";
+
+		// A short step, so nearly every tracer survives and the count stays put.
+		const float dt = 0.1f * fluid.h;
+		const float width = (fluid.numX - 2) * fluid.h;
+		const float height = (fluid.numY - 2) * fluid.h;
+
+		for (const std::size_t count : { std::size_t{ 1 } << 20, std::size_t{ 1 } << 22 }) {
+			TracerSystem tracers(fluid);
+			tracers.tracers.resize(count);
+			for (std::size_t k = 0; k < count; k++) {
+				tracers.tracers.x[k] = fluid.h + width * unitFloat(hashBits(static_cast<std::uint32_t>(2 * k)));
+				tracers.tracers.y[k] = fluid.h + height * unitFloat(hashBits(static_cast<std::uint32_t>(2 * k + 1)));
+				tracers.tracers.age[k] = 0.0f;
+			}
+			std::vector<float> x = tracers.tracers.x;
+			std::vector<float> y = tracers.tracers.y;
+
+			const std::size_t reps = 5;
+			auto start = std::chrono::steady_clock::now();
+			for (std::size_t rep = 0; rep < reps; rep++)
+				tracers.advect(dt);
+			const double batched = elapsedSeconds(start) / reps;
+
+			start = std::chrono::steady_clock::now();
+			for (std::size_t rep = 0; rep < reps; rep++) {
+				fluid.forColumns(0, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+					const std::pair<std::size_t, std::size_t> range = { begin * count / fluid.numX, end * count / fluid.numX };
+					for (std::size_t k = range.first; k < range.second; k++) {
+						const float xMid = x[k] + 0.5f * dt * fluid.sampleField(x[k], y[k], H_FIELD);
+						const float yMid = y[k] + 0.5f * dt * fluid.sampleField(x[k], y[k], V_FIELD);
+						x[k] += dt * fluid.sampleField(xMid, yMid, H_FIELD);
+						y[k] += dt * fluid.sampleField(xMid, yMid, V_FIELD);
+					}
+				});
+			}
+			const double scalar = elapsedSeconds(start) / reps;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %8zu tracers: batched %8.3f ms/step (%5.1f ns/tracer)  per-tracer %8.3f ms/step (%5.2fx)\n",
+				count, batched * 1e3, batched * 1e9 / count, scalar * 1e3, scalar / batched);
+			out << line;
+		}
+	}
+
+	// Energy and enstrophy a free vortex keeps over `steps` steps with and without vorticity
+	// confinement, against plain advection at twice the resolution, and the cost per step.
+	inline void benchConfinement(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "confinement vortex " << options.numX << "x" << options.numY << ", " << options.steps << " steps, " << options.iterations << " iterations\n";
+
+		const std::pair<std::size_t, float> cases[] = { { 1, 0.0f }, { 1, 0.1f }, { 1, 0.25f }, { 2, 0.0f } };
+		for (const std::pair<std::size_t, float>& c : cases) {
+			const std::size_t k = c.first;
+			Fluid fluid(&integrator, 1000.0f, options.numX * k, options.numY * k, 1.0f / (options.numY * k), nullptr, pool);
+			setupBenchVortex(fluid);
+			fluid.project(200, 1.0f / 60);
+			fluid.vorticityConfinement = c.second;
+
+			const FlowStats initial = FlowDiagnostics::reduce(fluid);
+			FlowDiagnostics diagnostics(1);
+			fluid.observers.push_back(&diagnostics);
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			const FlowStats& last = diagnostics.stats[diagnostics.stats.size() - 1];
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %5zux%-5zu eps %4.2f %9.3f ms/step  energy kept %5.1f%%  enstrophy kept %5.1f%%\n",
+				fluid.numX - 2, fluid.numY - 2, c.second, perStep * 1e3,
+				100.0 * last.kineticEnergy / initial.kineticEnergy, 100.0 * last.enstrophy / initial.enstrophy);
+			out << line;
+		}
+	}
+
+	// Wake behind a square obstacle in a tunnel of the given size, with the open last column
+	// and with a convective outlet, against an open tunnel three times as long. Shedding is
+	// chaotic, so the wake is compared by its statistics at a probe 3/4 down the short tunnel
+	// over the second half of the run: mean streamwise and RMS cross-stream velocity.
+	inline void benchOutflow(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "outflow " << options.numX << "x" << options.numY << ", " << options.steps << " steps, " << options.iterations << " iterations\n";
+
+		const float h = 1.0f / options.numY;
+		const float probeX = 0.75f * options.numX * h;
+		const float probeY = 0.5f * options.numY * h;
+		const std::size_t size = std::max<std::size_t>(2, options.numY / 8);
+		const std::size_t left = options.numX / 4;
+		const std::size_t bottom = options.numY / 2 - size / 2 + 1;	// off centre, so the wake sheds
+
+		for (const std::size_t kind : { 0, 1, 2 }) {
+			const std::size_t numX = kind == 0 ? 3 * options.numX : options.numX;
+			const bool convective = kind == 2;
+
+			Fluid fluid(&integrator, 1000.0f, numX, options.numY, h, nullptr, pool);
+			setupBenchTunnel(fluid);
+			const std::size_t n = fluid.numY;
+			for (std::size_t i = left; i < left + size; i++) {
+				for (std::size_t j = bottom; j < bottom + size; j++)
+					fluid.solid[i * n + j] = 0.0f;
+			}
+			if (convective) {
+				for (std::size_t j = 0; j < n; j++)
+					fluid.solid[(fluid.numX - 1) * n + j] = 0.0f;
+			}
+			fluid.inflow.enabled = true;
+			fluid.inflow.speed = 2.0f;
+			fluid.convectiveOutflow = convective;
+
+			double meanU = 0.0, squareV = 0.0;
+			std::size_t samples = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++) {
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+				if (step >= options.steps / 2) {
+					const float v = fluid.sampleField(probeX, probeY, V_FIELD);
+					meanU += fluid.sampleField(probeX, probeY, H_FIELD);
+					squareV += v * v;
+					samples++;
+				}
+			}
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  %-10s %5zux%-5zu %9.3f ms/step  probe mean u %6.3f  rms v %6.3f\n",
+				kind == 0 ? "long" : convective ? "convective" : "open", fluid.numX - 2, fluid.numY - 2, perStep * 1e3,
+				samples ? meanU / samples : 0.0, samples ? std::sqrt(squareV / samples) : 0.0);
+			out << line;
+		}
+	}
+
+	// Flow past a cylinder on a uniform grid of the given size, on a grid of half the
+	// resolution, and on that coarse grid with a PatchSolver refining around the cylinder
+	// and its wake. Reports cells, time per step and, over the second half of the run, the
+	// mean drag and RMS lift on the cylinder and the RMS cross-stream velocity in the wake.
+	// All three use the warm-started solver: a fixed number of red-black sweeps leaves the
+	// finer grids further from convergence, and the drag would compare that instead.
+	inline void benchPatch(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "patch cylinder " << options.numX << "x" << options.numY << ", " << options.steps << " steps, " << options.iterations << " iterations\n";
+
+		const float length = static_cast<float>(options.numX) / options.numY;
+		const float cx = 0.25f * length;
+		const float cy = 0.5f + 0.01f;	// off centre, so the wake sheds
+		const float radius = 0.08f;
+		auto cylinder = [&](const float x, const float y) {
+			return (x - cx) * (x - cx) + (y - cy) * (y - cy) < radius * radius;
+		};
+
+		for (const std::size_t kind : { 0, 1, 2 }) {
+			const std::size_t k = kind == 0 ? 1 : PatchSolver::ratio;
+			Fluid fluid(&integrator, 1000.0f, options.numX / k, options.numY / k, 1.0f / (options.numY / k), nullptr, pool);
+			fluid.warmStart = true;
+			setupBenchTunnel(fluid);
+			const std::size_t n = fluid.numY;
+			for (std::size_t i = 1; i < fluid.numX - 1; i++) {
+				for (std::size_t j = 1; j < n - 1; j++) {
+					if (cylinder((i + 0.5f) * fluid.h, (j + 0.5f) * fluid.h))
+						fluid.solid[i * n + j] = 0.0f;
+				}
+			}
+
+			FlowDiagnostics diagnostics(1);
+			PatchSolver patches(fluid);
+			patches.solidAt = cylinder;
+			if (kind == 2)
+				patches.observers.push_back(&diagnostics);
+			else
+				fluid.observers.push_back(&diagnostics);
+
+			double drag = 0.0, lift = 0.0, wake = 0.0;
+			std::size_t samples = 0, cells = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++) {
+				if (kind == 2)
+					patches.simulate(1.0f / 60, 0.0f, options.iterations);
+				else
+					fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+				if (step >= options.steps / 2) {
+					const FlowStats& stats = diagnostics.stats[diagnostics.stats.size() - 1];
+					const float v = fluid.sampleField(cx + 8.0f * radius, cy, V_FIELD);
+					drag += stats.drag;
+					lift += stats.lift * stats.lift;
+					wake += v * v;
+					cells = std::max(cells, kind == 2 ? patches.numCells() : fluid.numCells);
+					samples++;
+				}
+			}
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			char line[200];
+			std::snprintf(line, sizeof(line), "  %-7s %5zux%-5zu %8zu cells %9.3f ms/step  drag %8.2f  rms lift %8.2f  wake rms v %6.3f\n",
+				kind == 0 ? "uniform" : kind == 1 ? "coarse" : "patch", fluid.numX - 2, fluid.numY - 2, cells, perStep * 1e3,
+				drag / samples, std::sqrt(lift / samples), std::sqrt(wake / samples));
+			out << line;
+		}
+	}
+
+	// Streamlines from every 5th cell of a developed tunnel flow: StreamlineTracer (RK4,
+	// batched, parallel, fixed buffer) against the per-seed forward Euler loop the scene
+	// used, which samples each component separately and appends every vertex.
+	inline void benchStreamlines(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+		setupBenchTunnel(fluid);
+		for (std::size_t step = 0; step < options.steps; step++)
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		StreamlineTracer tracer(fluid);
+		const StreamlineTracer::LineStyle style;
+		std::vector<float> lines;
+		tracer.trace(style, lines);
+
+		const std::size_t reps = 20;
+		auto start = std::chrono::steady_clock::now();
+		for (std::size_t rep = 0; rep < reps; rep++)
+			tracer.trace(style, lines);
+		const double batched = elapsedSeconds(start) / reps;
+
+		start = std::chrono::steady_clock::now();
+		for (std::size_t rep = 0; rep < reps; rep++) {
+			std::vector<float> appended;
+			auto add = [&](const float x, const float y) {
+				for (const float value : { x, y, 0.0f, 0.0f, 0.0f, 0.0f })
+					appended.push_back(value);
+			};
+
+			for (std::size_t i = 1; i < fluid.numX - 1; i += tracer.seedStride) {
+				for (std::size_t j = 1; j < fluid.numY - 1; j += tracer.seedStride) {
+					float x = i + 0.5f;
+					float y = j + 0.5f;
+					for (std::size_t segment = 0; segment < tracer.numSegments; segment++) {
+						add(x, y);
+						x += fluid.sampleField(x * fluid.h, y * fluid.h, H_FIELD) * tracer.segmentTime / fluid.h;
+						y += fluid.sampleField(x * fluid.h, y * fluid.h, V_FIELD) * tracer.segmentTime / fluid.h;
+						add(x, y);
+						if (x > fluid.numX)
+							break;
+					}
+				}
+			}
+		}
+		const double serial = elapsedSeconds(start) / reps;
+
+		char line[160];
+		std::snprintf(line, sizeof(line), "streamlines %zux%zu, %zu seeds x %zu segments: RK4 batched %8.3f ms  Euler per seed %8.3f ms (%5.2fx)\n",
+			options.numX, options.numY, tracer.numSeeds(), tracer.numSegments, batched * 1e3, serial * 1e3, serial / batched);
+		out << line;
+	}
+
+	// The red-black solve with and without the pressure store, from the same tunnel state;
+	// the velocities must come out bit-identical. Also times one lazily computed display
+	// field with its range, as a frame that draws it pays.
+	inline void benchPressure(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		out << "pressure " << options.numX << "x" << options.numY << ", " << options.steps << " steps, " << options.iterations << " iterations\n";
+
+		std::vector<float> velocities[2];
+		for (const bool track : { true, false }) {
+			Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+			setupBenchTunnel(fluid);
+			fluid.trackPressure = track;
+
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t step = 0; step < options.steps; step++)
+				fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+			const double perStep = elapsedSeconds(start) / options.steps;
+
+			std::vector<float>& velocity = velocities[track ? 0 : 1];
+			velocity.assign(fluid.h_v.begin(), fluid.h_v.end());
+			velocity.insert(velocity.end(), fluid.v_v.begin(), fluid.v_v.end());
+
+			char line[160];
+			std::snprintf(line, sizeof(line), "  trackPressure %-5s %9.3f ms/step\n", track ? "on" : "off", perStep * 1e3);
+			out << line;
+
+			if (track) {
+				DiagnosticFields fields(fluid);
+				const std::size_t reps = 20;
+				const auto fieldStart = std::chrono::steady_clock::now();
+				for (std::size_t rep = 0; rep < reps; rep++) {
+					fields.invalidate();
+					fields.range(DiagnosticFields::VORTICITY);
+				}
+				std::snprintf(line, sizeof(line), "  vorticity field + range %9.3f ms\n", elapsedSeconds(fieldStart) / reps * 1e3);
+				out << line;
+			}
+		}
+
+		out << "  velocities " << (velocities[0] == velocities[1] ? "identical" : "DIFFER") << "\n";
+	}
+
+	// A NACA 0012 section written as a 16-bit PGM, loaded and rasterized onto a footprint of
+	// numX x numY / 4 cells: serially, split among the workers, and again from the cache.
+	inline void benchObstacles(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		const char* path = "fluid_bench_obstacle.pgm";
+
+		const std::size_t width = 4096, height = 1024;
+		std::vector<unsigned char> image(2 * width * height);
+		for (std::size_t row = 0; row < height; row++) {
+			for (std::size_t x = 0; x < width; x++) {
+				const float t = (x + 0.5f) / width;
+				const float y = ((height - 1 - row) + 0.5f) / height - 0.5f;
+				const float half = 0.6f * (0.2969f * std::sqrt(t) - 0.126f * t - 0.3516f * t * t + 0.2843f * t * t * t - 0.1015f * t * t * t * t);
+				const unsigned value = std::abs(y) * 0.25f < half ? 0 : 65535;
+				image[2 * (row * width + x)] = static_cast<unsigned char>(value >> 8);
+				image[2 * (row * width + x) + 1] = static_cast<unsigned char>(value & 255);
+			}
+		}
+
+		std::FILE* file = std::fopen(path, "wb");
+		if (file == nullptr)
+			return;
+		std::fprintf(file, "P5\n%zu %zu\n65535\n", width, height);
+		std::fwrite(image.data(), 1, image.size(), file);
+		std::fclose(file);
+
+		const std::size_t cellsX = options.numX;
+		const std::size_t cellsY = std::max<std::size_t>(1, options.numY / 4);
+
+		ObstacleShape serial;
+		auto start = std::chrono::steady_clock::now();
+		serial.load(path);
+		const double load = elapsedSeconds(start);
+		start = std::chrono::steady_clock::now();
+		const ObstacleFootprint& reference = serial.footprint(cellsX, cellsY, nullptr);
+		const double serialSeconds = elapsedSeconds(start);
+
+		ObstacleShape parallel;
+		parallel.load(path);
+		start = std::chrono::steady_clock::now();
+		const ObstacleFootprint& footprint = parallel.footprint(cellsX, cellsY, pool.get());
+		const double parallelSeconds = elapsedSeconds(start);
+		start = std::chrono::steady_clock::now();
+		parallel.footprint(cellsX, cellsY, pool.get());
+		const double cachedSeconds = elapsedSeconds(start);
+		std::remove(path);
+
+		std::size_t inside = 0;
+		for (const std::uint8_t cell : footprint.inside)
+			inside += cell;
+
+		char line[200];
+		std::snprintf(line, sizeof(line), "obstacles %zux%zu PGM onto %zux%zu cells (%zu solid): load %8.3f ms  serial %8.3f ms  %zu workers %8.3f ms  cached %8.4f ms  %s\n",
+			width, height, cellsX, cellsY, inside, load * 1e3, serialSeconds * 1e3, pool->size(), parallelSeconds * 1e3, cachedSeconds * 1e3,
+			footprint.inside == reference.inside ? "match" : "DIFFER");
+		out << line;
+	}
+
+	// The smoke of a numX x numY tunnel averaged down for a 1920 pixel wide window: the time
+	// to build the level the scene would draw from, and the quads it saves.
+	inline void benchLod(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+		setupBenchTunnel(fluid);
+		fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		const float cellPixels = 1920.0f / fluid.numX;
+		std::size_t last = 0;
+		while (static_cast<float>(std::size_t{ 1 } << last) * cellPixels < 1.0f)
+			last++;
+
+		FieldPyramid pyramid;
+		pyramid.build(fluid.smoke.data(), fluid.numX, fluid.numY, last, pool.get());
+
+		const std::size_t reps = 20;
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t rep = 0; rep < reps; rep++)
+			pyramid.build(fluid.smoke.data(), fluid.numX, fluid.numY, last, pool.get());
+		const double seconds = elapsedSeconds(start) / reps;
+
+		const FieldPyramid::Level& level = pyramid.level(last);
+		char line[200];
+		std::snprintf(line, sizeof(line), "lod %zux%zu at %.2f px/cell: level %zu, %zux%zu quads instead of %zu (%.1fx fewer), build %8.3f ms\n",
+			options.numX, options.numY, cellPixels, last, level.width, level.height, fluid.numCells,
+			static_cast<double>(fluid.numCells) / (level.width * level.height), seconds * 1e3);
+		out << line;
+	}
+
+	// The smoke of a developed tunnel through shuffle + LZ and back, then the decoder fed
+	// malformed blocks: a forged match length near 2^64, every truncation of the block and
+	// single flipped bytes. The output buffer is exactly the field's size, so a decoder that
+	// writes past it shows up under a sanitizer; every truncation must be rejected.
+	inline void benchCodec(const BenchOptions& options, std::ostream& out)
+	{
+		const std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(options.threads, options.pin);
+		IntegratorEuler integrator;
+
+		Fluid fluid(&integrator, 1000.0f, options.numX, options.numY, 1.0f / options.numY, nullptr, pool);
+		setupBenchTunnel(fluid);
+		for (std::size_t step = 0; step < options.steps; step++)
+			fluid.simulate(1.0f / 60, 0.0f, options.iterations);
+
+		std::vector<std::uint8_t> packed;
+		auto start = std::chrono::steady_clock::now();
+		Codec::compressElements(fluid.smoke.data(), fluid.numCells, sizeof(float), packed);
+		const double compressSeconds = elapsedSeconds(start);
+
+		std::vector<float> smoke(fluid.numCells);
+		start = std::chrono::steady_clock::now();
+		const bool roundTrip = Codec::decompressElements(packed.data(), packed.size(), smoke.data(), smoke.size(), sizeof(float)) &&
+			std::memcmp(smoke.data(), fluid.smoke.data(), smoke.size() * sizeof(float)) == 0;
+		const double decompressSeconds = elapsedSeconds(start);
+
+		// One literal, then a match of 2^64 - 1 bytes at offset 1.
+		const std::uint8_t forged[] = { 0x01, 'a', 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01, 0x01 };
+		std::vector<std::uint8_t> block(fluid.numCells * sizeof(float));
+		const bool forgedRejected = !Codec::decompress(forged, sizeof(forged), block.data(), block.size());
+
+		// Truncations of a block of the first 16 KiB, as each one is decoded on its own.
+		std::vector<std::uint8_t> bytes(std::min<std::size_t>(block.size(), 1 << 14));
+		Codec::compress(reinterpret_cast<const std::uint8_t*>(fluid.smoke.data()), bytes.size(), packed);
+		std::size_t truncated = 0;
+		for (std::size_t size = 0; size < packed.size(); size++)
+			truncated += !Codec::decompress(packed.data(), size, bytes.data(), bytes.size());
+		const std::size_t truncations = packed.size();
+
+		Codec::compressElements(fluid.smoke.data(), fluid.numCells, sizeof(float), packed);
+		const std::size_t flips = std::min<std::size_t>(packed.size(), 1024);
+		std::size_t flipped = 0;
+		for (std::size_t k = 0; k < flips; k++) {
+			std::vector<std::uint8_t> corrupt = packed;
+			corrupt[k * packed.size() / flips] ^= 0x5a;
+			flipped += !Codec::decompress(corrupt.data(), corrupt.size(), block.data(), block.size());
+		}
+
+		char line[240];
+		std::snprintf(line, sizeof(line), "codec %zux%zu smoke: %zu -> %zu bytes (%.2fx), compress %8.3f ms  decompress %8.3f ms  %s\n",
+			options.numX, options.numY, fluid.numCells * sizeof(float), packed.size(), static_cast<double>(fluid.numCells * sizeof(float)) / packed.size(),
+			compressSeconds * 1e3, decompressSeconds * 1e3, roundTrip ? "match" : "DIFFER");
+		out << line;
+		std::snprintf(line, sizeof(line), "  forged length %s  truncations rejected %zu/%zu  flipped bytes rejected %zu/%zu\n",
+			forgedRejected ? "rejected" : "ACCEPTED", truncated, truncations, flipped, flips);
+		out << line;
+	}
+
+	inline int runBenchmarks(const int argc, const char** argv)
+	{
+		const BenchOptions options = BenchOptions::parse(argc, argv);
+
+		if (options.name == "all" || options.name == "bandwidth") {
+			ThreadPool pool(options.threads, options.pin);
+			benchBandwidth(pool, std::cout);
+		}
+		if (options.name == "all" || options.name == "scaling")
+			benchScaling(options, std::cout);
+		if (options.name == "all" || options.name == "domains")
+			benchDomains(options, std::cout);
+		if (options.name == "tiled")
+			benchTiled(options, std::cout);
+		if (options.name == "all" || options.name == "precision")
+			benchPrecision(options, std::cout);
+		if (options.name == "all" || options.name == "fixed")
+			benchFixed(options, std::cout);
+		if (options.name == "all" || options.name == "spectral")
+			benchSpectral(options, std::cout);
+		if (options.name == "all" || options.name == "channels")
+			benchChannels(options, std::cout);
+		if (options.name == "all" || options.name == "finesmoke")
+			benchFineSmoke(options, std::cout);
+		if (options.name == "all" || options.name == "flip")
+			benchFlip(options, std::cout);
+		if (options.name == "all" || options.name == "tracers")
+			benchTracers(options, std::cout);
+		if (options.name == "all" || options.name == "confinement")
+			benchConfinement(options, std::cout);
+		if (options.name == "all" || options.name == "outflow")
+			benchOutflow(options, std::cout);
+		if (options.name == "all" || options.name == "patch")
+			benchPatch(options, std::cout);
+		if (options.name == "all" || options.name == "streamlines")
+			benchStreamlines(options, std::cout);
+		if (options.name == "all" || options.name == "pressure")
+			benchPressure(options, std::cout);
+		if (options.name == "all" || options.name == "obstacles")
+			benchObstacles(options, std::cout);
+		if (options.name == "all" || options.name == "lod")
+			benchLod(options, std::cout);
+		if (options.name == "all" || options.name == "codec")
+			benchCodec(options, std::cout);
+
+		return 0;
+	}
+
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "fluid_codec.h"
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace FluidSims
+{
+
+	// Scene-level state stored next to the fields so a restart resumes the same run.
+	struct SceneState
+	{
+		std::uint32_t sceneType = 0;
+		std::uint32_t obstacleType = 0;
+		float obstaclePos[2] = {};
+		float obstacleSpeed[2] = {};
+		float obstacleRadius = 0.0f;
+		float obstacleSize[2] = {};
+		float dt = 0.0f;
+		float gravity[2] = {};
+		float overRelaxation = 0.0f;
+		std::uint64_t iterations = 0;
+		std::uint64_t frameCount = 0;
+	};
+
+	// Checkpoint file layout (native byte order):
+	//   CheckpointHeader, then one CheckpointPlane per scalar channel and one for the fine
+	//                 smoke grid if there is one, padded to checkpointDataAlignment
+	//   uncompressed: the arena image, byte for byte as Fluid::layoutFor(numX * numY,
+	//                 numScalars, smokeRefinement) describes it, so it can be mapped and used
+	//                 in place
+	//   compressed:   the live planes, each Codec-compressed, at CheckpointPlane::fileOffset
+	// Version 1 files have no channels; version 1 and 2 files have no fine smoke grid, which
+	// restarts from the restored smoke at the loading fluid's refinement.
+	constexpr char checkpointMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'C', 'K', 'P' };
+	constexpr std::uint32_t checkpointVersion = 3;
+	constexpr std::size_t checkpointDataAlignment = 64 * 1024;	// a multiple of every common page size
+
+	enum checkpoint_flags_t : std::uint32_t
+	{
+		CHECKPOINT_COMPRESSED = 1 << 0,
+	};
+
+	enum checkpoint_plane_t : std::uint32_t
+	{
+		CHECKPOINT_H_V,
+		CHECKPOINT_V_V,
+		CHECKPOINT_PRESSURE,
+		CHECKPOINT_SOLID,
+		CHECKPOINT_SMOKE,
+		CHECKPOINT_NUM_PLANES
+	};
+
+	struct CheckpointPlane
+	{
+		std::uint64_t arenaOffset = 0;	// offset inside the arena image
+		std::uint64_t bytes = 0;	// uncompressed size
+		std::uint64_t fileOffset = 0;	// compressed checkpoints only
+		std::uint64_t storedBytes = 0;
+		std::uint32_t elementSize = 0;
+		std::uint32_t reserved = 0;
+	};
+
+	struct CheckpointHeader
+	{
+		char magic[8] = {};
+		std::uint32_t version = 0;
+		std::uint32_t flags = 0;
+		std::uint64_t numX = 0;	// including the border cells
+		std::uint64_t numY = 0;
+		float h = 0.0f;
+		float density = 0.0f;
+		std::uint64_t imageBytes = 0;	// Fluid::layoutFor(numX * numY, numScalars, smokeRefinement).bytes
+		std::uint64_t dataOffset = 0;
+		CheckpointPlane planes[CHECKPOINT_NUM_PLANES];
+		SceneState scene;
+		std::uint64_t numScalars = 0;	// since version 2; the plane table follows the header
+		std::uint64_t smokeRefinement = 0;	// since version 3
+	};
+
+	static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "checkpoint header is written with fwrite");
+	static_assert(sizeof(CheckpointHeader) <= checkpointDataAlignment, "checkpoint header overflows its slot");
+
+	// Channels whose plane table, with the fine smoke entry, still fits in the header's slot.
+	constexpr std::size_t checkpointMaxScalars = (checkpointDataAlignment - sizeof(CheckpointHeader)) / sizeof(CheckpointPlane) - 1;
+
+	namespace detail
+	{
+		// Arena offsets of the stored planes: checkpoint_plane_t first, then the channels and
+		// the fine smoke grid.
+		inline std::vector<std::size_t> checkpointOffsets(const Fluid::Layout& layout, const std::size_t numScalars,
+			const std::size_t smokeRefinement)
+		{
+			std::vector<std::size_t> offsets(CHECKPOINT_NUM_PLANES + numScalars);
+			offsets[CHECKPOINT_H_V] = layout.h_v;
+			offsets[CHECKPOINT_V_V] = layout.v_v;
+			offsets[CHECKPOINT_PRESSURE] = layout.pressure;
+			offsets[CHECKPOINT_SOLID] = layout.solid;
+			offsets[CHECKPOINT_SMOKE] = layout.smoke;
+			for (std::size_t c = 0; c < numScalars; c++)
+				offsets[CHECKPOINT_NUM_PLANES + c] = layout.scalars + c * layout.scalarStride;
+			if (smokeRefinement > 1)
+				offsets.push_back(layout.fineSmoke);
+			return offsets;
+		}
+
+		inline std::vector<FieldPlane<float>*> checkpointPlanes(Fluid& fluid)
+		{
+			std::vector<FieldPlane<float>*> planes(CHECKPOINT_NUM_PLANES + fluid.numScalars);
+			planes[CHECKPOINT_H_V] = &fluid.h_v;
+			planes[CHECKPOINT_V_V] = &fluid.v_v;
+			planes[CHECKPOINT_PRESSURE] = &fluid.pressure;
+			planes[CHECKPOINT_SOLID] = &fluid.solid;
+			planes[CHECKPOINT_SMOKE] = &fluid.smoke;
+			for (std::size_t c = 0; c < fluid.numScalars; c++)
+				planes[CHECKPOINT_NUM_PLANES + c] = &fluid.scalars[c];
+			if (fluid.smokeRefinement > 1)
+				planes.push_back(&fluid.fineSmoke);
+			return planes;
+		}
+
+		// Moves `from` over `to`. rename() replaces an existing file atomically on POSIX, but
+		// fails on Windows, where nothing keeps a checkpoint mapped.
+		inline bool replaceFile(const char* from, const char* to)
+		{
+#if defined(_WIN32)
+			std::remove(to);
+#endif
+			return std::rename(from, to) == 0;
+		}
+	}
+
+	// Writes every Fluid field plus `scene` to `path`. Returns false on I/O failure or with
+	// more than checkpointMaxScalars channels.
+	// The file is written as `path`.tmp and renamed over `path` once complete: `path` may be
+	// mapped as a fluid's arena by loadCheckpoint(), and truncating it would pull the pages
+	// from under the live fields. A failed save leaves the previous checkpoint in place.
+	inline bool saveCheckpoint(const char* path, Fluid& fluid, const SceneState& scene, const bool compressed = false)
+	{
+		if (fluid.numScalars > checkpointMaxScalars)
+			return false;
+
+		const std::vector<FieldPlane<float>*> planes = detail::checkpointPlanes(fluid);
+		const std::vector<std::size_t> offsets = detail::checkpointOffsets(fluid.layout(), fluid.numScalars, fluid.smokeRefinement);
+
+		CheckpointHeader header;
+		std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+		header.version = checkpointVersion;
+		header.flags = compressed ? static_cast<std::uint32_t>(CHECKPOINT_COMPRESSED) : 0;
+		header.numX = fluid.numX;
+		header.numY = fluid.numY;
+		header.h = fluid.h;
+		header.density = fluid.density;
+		header.imageBytes = fluid.layout().bytes;
+		header.dataOffset = checkpointDataAlignment;
+		header.scene = scene;
+		header.numScalars = fluid.numScalars;
+		header.smokeRefinement = fluid.smokeRefinement;
+
+		std::vector<CheckpointPlane> table(planes.size());
+		std::vector<std::vector<std::uint8_t>> packed(planes.size());
+		std::uint64_t fileOffset = header.dataOffset;
+
+		for (std::size_t k = 0; k < planes.size(); k++) {
+			CheckpointPlane& plane = table[k];
+			plane.arenaOffset = offsets[k];
+			plane.bytes = planes[k]->size() * sizeof(float);
+			plane.elementSize = sizeof(float);
+
+			if (compressed) {
+				Codec::compressElements(planes[k]->data(), planes[k]->size(), sizeof(float), packed[k]);
+				plane.fileOffset = fileOffset;
+				plane.storedBytes = packed[k].size();
+				fileOffset += plane.storedBytes;
+			}
+			else {
+				plane.fileOffset = header.dataOffset + plane.arenaOffset;
+				plane.storedBytes = plane.bytes;
+			}
+		}
+		std::copy(table.begin(), table.begin() + CHECKPOINT_NUM_PLANES, header.planes);
+
+		const std::string temporary = std::string(path) + ".tmp";
+		std::FILE* file = std::fopen(temporary.c_str(), "wb");
+		if (file == nullptr)
+			return false;
+
+		const std::size_t numExtra = table.size() - CHECKPOINT_NUM_PLANES;
+		bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+			std::fwrite(table.data() + CHECKPOINT_NUM_PLANES, sizeof(CheckpointPlane), numExtra, file) == numExtra;
+
+		if (compressed) {
+			ok = ok && detail::seek(file, header.dataOffset);
+			for (std::size_t k = 0; ok && k < planes.size(); k++)
+				ok = std::fwrite(packed[k].data(), 1, packed[k].size(), file) == packed[k].size();
+		}
+		else {
+			// Planes go to their arena offsets; the gaps (padding and scratch planes) read back
+			// as zeros, so the file maps straight back onto Fluid::layoutFor().
+			for (std::size_t k = 0; ok && k < planes.size(); k++) {
+				ok = detail::seek(file, table[k].fileOffset) &&
+					std::fwrite(planes[k]->data(), 1, table[k].bytes, file) == table[k].bytes;
+			}
+
+			const char last = 0;
+			ok = ok && detail::seek(file, header.dataOffset + header.imageBytes - 1);
+			ok = ok && std::fwrite(&last, 1, 1, file) == 1;
+		}
+
+		ok = std::fclose(file) == 0 && ok;
+		ok = ok && detail::replaceFile(temporary.c_str(), path);
+		if (!ok)
+			std::remove(temporary.c_str());
+
+		return ok;
+	}
+
+	// Restores `fluid` (resizing it to the stored grid, channel count and smoke refinement)
+	// and `scene` from `path`. Uncompressed checkpoints are mapped copy-on-write where the platform allows it
+	// and read with one bulk read otherwise. Returns false if the file is missing, invalid
+	// or shorter than its header says; `fluid` is only modified once the header and the
+	// file size have been validated.
+	inline bool loadCheckpoint(const char* path, Fluid& fluid, SceneState& scene)
+	{
+		std::FILE* file = std::fopen(path, "rb");
+		if (file == nullptr)
+			return false;
+
+		CheckpointHeader header;
+		bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+			std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) == 0 &&
+			header.version >= 1 && header.version <= checkpointVersion;
+
+		// Older headers are shorter; what follows them is padding.
+		if (ok && header.version < 2)
+			header.numScalars = 0;
+		if (ok && header.version < 3)
+			header.smokeRefinement = 1;
+		ok = ok && header.numScalars <= checkpointMaxScalars && header.smokeRefinement >= 1;
+
+		const std::size_t numScalars = ok ? static_cast<std::size_t>(header.numScalars) : 0;
+		const std::size_t smokeRefinement = ok ? static_cast<std::size_t>(header.smokeRefinement) : 1;
+
+		std::vector<CheckpointPlane> table;
+		if (ok) {
+			const std::size_t numExtra = numScalars + (smokeRefinement > 1 ? 1 : 0);
+			table.resize(CHECKPOINT_NUM_PLANES + numExtra);
+			std::copy(header.planes, header.planes + CHECKPOINT_NUM_PLANES, table.begin());
+			ok = std::fread(table.data() + CHECKPOINT_NUM_PLANES, sizeof(CheckpointPlane), numExtra, file) == numExtra;
+		}
+
+		// The grid needs an interior, and neither numX * numY nor the arena size may wrap:
+		// the coarse planes take at most 8 + 2 * numScalars cells of up to 8 bytes each, the
+		// two fine planes numCells * smokeRefinement^2 each, and both are kept below a quarter
+		// of the address space.
+		const std::uint64_t maxBytes = SIZE_MAX / 4;
+		ok = ok && header.numX >= 3 && header.numY >= 3 &&
+			header.numX <= maxBytes / (sizeof(double) * (8 + 2 * numScalars)) / header.numY;
+		const std::size_t numCells = ok ? static_cast<std::size_t>(header.numX * header.numY) : 0;
+		ok = ok && smokeRefinement <= maxBytes / (2 * sizeof(double)) / numCells / smokeRefinement;
+
+		const Fluid::Layout layout = Fluid::layoutFor(ok ? numCells : 0, numScalars, ok ? smokeRefinement : 1);
+		const std::vector<std::size_t> offsets = detail::checkpointOffsets(layout, numScalars, smokeRefinement);
+
+		ok = ok && layout.bytes == header.imageBytes;
+		for (std::size_t k = 0; ok && k < table.size(); k++)
+			ok = table[k].arenaOffset == offsets[k] && table[k].elementSize == sizeof(float);
+
+		// A truncated file would map fine and fault on first access to the missing pages.
+		std::uint64_t fileSize = 0;
+		ok = ok && detail::fileSize(file, fileSize);
+		if (ok && !(header.flags & CHECKPOINT_COMPRESSED))
+			ok = detail::fits(header.dataOffset, header.imageBytes, fileSize);
+		for (std::size_t k = 0; ok && (header.flags & CHECKPOINT_COMPRESSED) && k < table.size(); k++)
+			ok = detail::fits(table[k].fileOffset, table[k].storedBytes, fileSize);
+
+		if (!ok) {
+			std::fclose(file);
+			return false;
+		}
+
+		// Like setGridSize(), the channel count and refinement are set without allocating;
+		// the arena is mapped or reserved below. Files without a fine grid keep the fluid's.
+		fluid.setGridSize(header.numX, header.numY);
+		fluid.numScalars = numScalars;
+		if (header.version >= 3)
+			fluid.smokeRefinement = smokeRefinement;
+
+		// A new grid size invalidates the tuning probe and factor, even if reading the planes
+		// fails below.
+		fluid.retuneOverRelaxation();
+		fluid.h = header.h;
+		fluid.density = header.density;
+
+		// The image can only be mapped as the whole arena when nothing follows the stored planes.
+		const std::size_t arenaBytes = fluid.layout().bytes;
+		bool mapped = false;
+
+		if (!(header.flags & CHECKPOINT_COMPRESSED)) {
+#if defined(__linux__)
+			if (arenaBytes == header.imageBytes && header.dataOffset % static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) == 0)
+				mapped = fluid.arena->mapFile(path, header.dataOffset, header.imageBytes);
+#endif
+			if (!mapped) {
+				fluid.arena->reserve(arenaBytes);
+				ok = detail::seek(file, header.dataOffset) &&
+					std::fread(fluid.arena->data(), 1, header.imageBytes, file) == header.imageBytes;
+			}
+
+			fluid.carve();
+		}
+		else {
+			fluid.arena->reserve(arenaBytes);
+			fluid.carve();
+			std::memset(fluid.arena->data(), 0, header.imageBytes);
+
+			const std::vector<FieldPlane<float>*> planes = detail::checkpointPlanes(fluid);
+			std::vector<std::uint8_t> packed;
+			for (std::size_t k = 0; ok && k < table.size(); k++) {
+				const CheckpointPlane& plane = table[k];
+				packed.resize(plane.storedBytes);
+
+				ok = detail::seek(file, plane.fileOffset) &&
+					std::fread(packed.data(), 1, packed.size(), file) == packed.size() &&
+					Codec::decompressElements(packed.data(), packed.size(), planes[k]->data(), planes[k]->size(), sizeof(float));
+			}
+		}
+
+		std::fclose(file);
+
+		if (ok && header.version < 3)
+			fluid.refineSmoke();
+
+		if (ok)
+			scene = header.scene;
+
+		return ok;
+	}
+
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Byte-oriented LZ77 block codec in the spirit of LZ4, without external dependencies.
+	// A block is a series of (literal run, match) sequences, lengths and offsets as varints;
+	// a match length of 0 ends the block.
+	namespace Codec
+	{
+
+		inline void putVarint(std::vector<std::uint8_t>& out, std::uint64_t value)
+		{
+			while (value >= 0x80) {
+				out.push_back(static_cast<std::uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<std::uint8_t>(value));
+		}
+
+		inline bool getVarint(const std::uint8_t*& in, const std::uint8_t* end, std::uint64_t& value)
+		{
+			value = 0;
+			for (unsigned shift = 0; in < end && shift < 64; shift += 7) {
+				const std::uint8_t byte = *in++;
+				value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+				if ((byte & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+
+		inline std::uint32_t read32(const std::uint8_t* p)
+		{
+			std::uint32_t value;
+			std::memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		// IEEE 754 binary16 conversion with round-to-nearest-even; overflow saturates to infinity.
+		inline std::uint16_t floatToHalf(const float value)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+
+			const std::uint32_t sign = (bits >> 16) & 0x8000u;
+			const std::uint32_t exponent = (bits >> 23) & 0xffu;
+			std::uint32_t mantissa = bits & 0x7fffffu;
+
+			if (exponent == 0xffu)
+				return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+
+			const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+			if (halfExponent >= 0x1f)
+				return static_cast<std::uint16_t>(sign | 0x7c00u);
+
+			if (halfExponent <= 0) {
+				if (halfExponent < -10)
+					return static_cast<std::uint16_t>(sign);
+
+				mantissa |= 0x800000u;
+				const unsigned shift = static_cast<unsigned>(14 - halfExponent);
+				std::uint32_t half = mantissa >> shift;
+				const std::uint32_t rest = mantissa & ((1u << shift) - 1);
+				const std::uint32_t halfway = 1u << (shift - 1);
+				if (rest > halfway || (rest == halfway && (half & 1u)))
+					half++;
+				return static_cast<std::uint16_t>(sign | half);
+			}
+
+			std::uint32_t half = (static_cast<std::uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+			const std::uint32_t rest = mantissa & 0x1fffu;
+			if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+				half++;	// may carry into the exponent, which is the correct rounding
+			return static_cast<std::uint16_t>(sign | half);
+		}
+
+		inline float halfToFloat(const std::uint16_t half)
+		{
+			const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+			const std::uint32_t exponent = (half >> 10) & 0x1fu;
+			std::uint32_t mantissa = half & 0x3ffu;
+			std::uint32_t bits;
+
+			if (exponent == 0) {
+				if (mantissa == 0) {
+					bits = sign;
+				}
+				else {
+					int shift = 0;
+					while ((mantissa & 0x400u) == 0) {
+						mantissa <<= 1;
+						shift++;
+					}
+					bits = sign | (static_cast<std::uint32_t>(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ffu) << 13);
+				}
+			}
+			else if (exponent == 0x1f) {
+				bits = sign | 0x7f800000u | (mantissa << 13);
+			}
+			else {
+				bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+			}
+
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		// Groups byte k of every element together. Neighbouring floats of a smooth field share
+		// sign and exponent bytes, which turns them into long runs the LZ stage can match.
+		inline void shuffle(const std::uint8_t* src, std::uint8_t* dst, const std::size_t count, const std::size_t elementSize)
+		{
+			for (std::size_t i = 0; i < count; i++)
+				for (std::size_t k = 0; k < elementSize; k++)
+					dst[k * count + i] = src[i * elementSize + k];
+		}
+
+		inline void unshuffle(const std::uint8_t* src, std::uint8_t* dst, const std::size_t count, const std::size_t elementSize)
+		{
+			for (std::size_t i = 0; i < count; i++)
+				for (std::size_t k = 0; k < elementSize; k++)
+					dst[i * elementSize + k] = src[k * count + i];
+		}
+
+		// Appends the compressed form of src[0, size) to out.
+		inline void compress(const std::uint8_t* src, const std::size_t size, std::vector<std::uint8_t>& out)
+		{
+			constexpr unsigned hashBits = 16;
+			constexpr std::size_t minMatch = 4;
+			std::vector<std::size_t> table(std::size_t{ 1 } << hashBits, SIZE_MAX);
+
+			std::size_t anchor = 0;
+			std::size_t i = 0;
+
+			while (i + minMatch <= size) {
+				const std::uint32_t sequence = read32(src + i);
+				const std::uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+				const std::size_t candidate = table[hash];
+				table[hash] = i;
+
+				if (candidate == SIZE_MAX || read32(src + candidate) != sequence) {
+					i++;
+					continue;
+				}
+
+				std::size_t length = minMatch;
+				while (i + length < size && src[candidate + length] == src[i + length])
+					length++;
+
+				putVarint(out, i - anchor);
+				out.insert(out.end(), src + anchor, src + i);
+				putVarint(out, length);
+				putVarint(out, i - candidate);
+
+				i += length;
+				anchor = i;
+			}
+
+			putVarint(out, size - anchor);
+			out.insert(out.end(), src + anchor, src + size);
+			putVarint(out, 0);
+		}
+
+		// Decodes one block into dst[0, size). Returns false on malformed input, which is
+		// never written past dst + size: lengths are compared with the space left, as a
+		// forged varint near 2^64 would wrap `written + length`.
+		inline bool decompress(const std::uint8_t* src, const std::size_t srcSize, std::uint8_t* dst, const std::size_t size)
+		{
+			const std::uint8_t* in = src;
+			const std::uint8_t* end = src + srcSize;
+			std::size_t written = 0;
+
+			for (;;) {
+				std::uint64_t literals = 0;
+				if (!getVarint(in, end, literals) || literals > static_cast<std::uint64_t>(end - in) || literals > size - written)
+					return false;
+
+				std::memcpy(dst + written, in, literals);
+				in += literals;
+				written += literals;
+
+				std::uint64_t length = 0;
+				if (!getVarint(in, end, length))
+					return false;
+				if (length == 0)
+					return written == size;
+
+				std::uint64_t offset = 0;
+				if (!getVarint(in, end, offset) || offset == 0 || offset > written || length > size - written)
+					return false;
+
+				// Byte-wise on purpose: matches may overlap their own output.
+				for (std::uint64_t k = 0; k < length; k++, written++)
+					dst[written] = dst[written - offset];
+			}
+		}
+
+		// Shuffle + compress for arrays of fixed-size elements.
+		inline void compressElements(const void* src, const std::size_t count, const std::size_t elementSize, std::vector<std::uint8_t>& out)
+		{
+			std::vector<std::uint8_t> shuffled(count * elementSize);
+			shuffle(static_cast<const std::uint8_t*>(src), shuffled.data(), count, elementSize);
+			compress(shuffled.data(), shuffled.size(), out);
+		}
+
+		inline bool decompressElements(const std::uint8_t* src, const std::size_t srcSize, void* dst, const std::size_t count, const std::size_t elementSize)
+		{
+			std::vector<std::uint8_t> shuffled(count * elementSize);
+			if (!decompress(src, srcSize, shuffled.data(), shuffled.size()))
+				return false;
+
+			unshuffle(shuffled.data(), static_cast<std::uint8_t*>(dst), count, elementSize);
+			return true;
+		}
+
+	}
+
+	// File helpers shared by the checkpoint and stream readers, which check every size
+	// read from a file against the file before allocating for it.
+	namespace detail
+	{
+		// fseek takes a long, which is 32 bits on Windows.
+		inline bool seek(std::FILE* file, const std::uint64_t offset)
+		{
+#if defined(_WIN32)
+			return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+			return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+		}
+
+		inline bool fileSize(std::FILE* file, std::uint64_t& size)
+		{
+#if defined(_WIN32)
+			if (_fseeki64(file, 0, SEEK_END) != 0)
+				return false;
+			const __int64 end = _ftelli64(file);
+#else
+			if (fseeko(file, 0, SEEK_END) != 0)
+				return false;
+			const off_t end = ftello(file);
+#endif
+			if (end < 0)
+				return false;
+
+			size = static_cast<std::uint64_t>(end);
+			return true;
+		}
+
+		// Whether [offset, offset + bytes) lies inside a file of `size` bytes.
+		inline bool fits(const std::uint64_t offset, const std::uint64_t bytes, const std::uint64_t size)
+		{
+			return offset <= size && bytes <= size - offset;
+		}
+	}
+
+}
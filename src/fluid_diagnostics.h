@@ -0,0 +1,435 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Fixed-capacity ring buffer; once full, pushing overwrites the oldest element.
+	template<typename T>
+	class RingBuffer
+	{
+	public:
+		explicit RingBuffer(const std::size_t capacity = 4096)
+			: m_items(std::max<std::size_t>(1, capacity))
+		{
+		}
+
+		void push(const T& item)
+		{
+			m_items[(m_first + m_size) % m_items.size()] = item;
+			if (m_size < m_items.size())
+				m_size++;
+			else
+				m_first = (m_first + 1) % m_items.size();
+		}
+
+		// i = 0 is the oldest element.
+		const T& operator[](const std::size_t i) const { return m_items[(m_first + i) % m_items.size()]; }
+		std::size_t size() const { return m_size; }
+		std::size_t capacity() const { return m_items.size(); }
+		void clear() { m_first = 0; m_size = 0; }
+
+	private:
+		std::vector<T> m_items;
+		std::size_t m_first = 0;
+		std::size_t m_size = 0;
+	};
+
+	struct FlowStats
+	{
+		std::uint64_t step = 0;
+		float kineticEnergy = 0.0f;
+		float maxDivergence = 0.0f;	// max |div u| over fluid cells, 1/s
+		float vorticityMin = 0.0f;
+		float vorticityMax = 0.0f;
+		float vorticityMean = 0.0f;
+		float enstrophy = 0.0f;	// 0.5 * sum(w^2) * h^2
+		float drag = 0.0f;	// pressure force on interior solid cells, per unit depth
+		float lift = 0.0f;
+	};
+
+	struct ProbeSample
+	{
+		std::uint64_t step = 0;
+		float h_v = 0.0f;
+		float v_v = 0.0f;
+		float pressure = 0.0f;
+		float smoke = 0.0f;
+	};
+
+	// Point probe in simulation coordinates (the units of sampleField).
+	struct Probe
+	{
+		float x = 0.0f;
+		float y = 0.0f;
+		RingBuffer<ProbeSample> samples;
+
+		Probe(const float x, const float y, const std::size_t capacity)
+			: x(x), y(y), samples(capacity)
+		{
+		}
+	};
+
+	// Per-cell diagnostic fields for display, computed on the first request after a step and
+	// cached until the next one. Register it as a step observer; a step only marks the fields
+	// stale, so a frame that shows none of them costs nothing. Solid and border cells read 0.
+	// PRESSURE is the fluid's own plane, which holds the last solve's pressure only while
+	// Fluid::trackPressure is on.
+	class DiagnosticFields : public StepObserver
+	{
+	public:
+		enum field_t
+		{
+			PRESSURE,
+			VORTICITY,	// cell-centred curl, 1/s, as Fluid::curlColumn() gives it to confinement
+			DIVERGENCE,	// 1/s
+			SPEED,	// magnitude of the cell-centred velocity
+			NUM_FIELDS
+		};
+
+		// Over fluid cells only; both 0 if there are none.
+		struct Range
+		{
+			float min = 0.0f;
+			float max = 0.0f;
+		};
+
+		explicit DiagnosticFields(Fluid& fluid)
+			: m_fluid(fluid)
+		{
+			invalidate();
+		}
+
+		void observe(Fluid& fluid, float dt) override
+		{
+			(void)fluid;
+			(void)dt;
+			invalidate();
+		}
+
+		// Marks every field stale; call it after changing the fluid outside simulate().
+		void invalidate()
+		{
+			for (std::size_t f = 0; f < NUM_FIELDS; f++) {
+				m_fieldValid[f] = false;
+				m_rangeValid[f] = false;
+			}
+		}
+
+		// numCells values, indexed like the fluid's planes.
+		const float* field(const field_t f)
+		{
+			if (f == PRESSURE)
+				return m_fluid.pressure.data();
+
+			if (!m_fieldValid[f]) {
+				compute(f);
+				m_fieldValid[f] = true;
+			}
+
+			return m_planes[f].data();
+		}
+
+		Range range(const field_t f)
+		{
+			if (!m_rangeValid[f]) {
+				m_ranges[f] = scan(field(f));
+				m_rangeValid[f] = true;
+			}
+
+			return m_ranges[f];
+		}
+
+	private:
+		void compute(const field_t f)
+		{
+			Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+			const float h1 = 1.0f / fluid.h;
+
+			std::vector<float>& plane = m_planes[f];
+			plane.assign(fluid.numCells, 0.0f);
+
+			fluid.forColumns(1, fluid.numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const float* s = fluid.solid.data() + i * n;
+					const float* u = fluid.h_v.data() + i * n;
+					const float* uRight = fluid.h_v.data() + (i + 1) * n;
+					const float* v = fluid.v_v.data() + i * n;
+					float* out = plane.data() + i * n;
+
+					if (f == VORTICITY) {
+						fluid.curlColumn(i, out);
+					}
+					else if (f == DIVERGENCE) {
+						for (std::size_t j = 1; j < n - 1; j++)
+							out[j] = s[j] != 0.0f ? (uRight[j] - u[j] + v[j + 1] - v[j]) * h1 : 0.0f;
+					}
+					else {
+						for (std::size_t j = 1; j < n - 1; j++) {
+							const float uc = 0.5f * (u[j] + uRight[j]);
+							const float vc = 0.5f * (v[j] + v[j + 1]);
+							out[j] = s[j] != 0.0f ? std::sqrt(uc * uc + vc * vc) : 0.0f;
+						}
+					}
+				}
+			});
+		}
+
+		Range scan(const float* values)
+		{
+			Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+
+			Range total = { INFINITY, -INFINITY };
+			std::mutex mutex;
+
+			fluid.forColumns(1, fluid.numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				Range partial = { INFINITY, -INFINITY };
+				for (std::size_t i = begin; i < end; i++) {
+					for (std::size_t j = 1; j < n - 1; j++) {
+						if (fluid.solid[i * n + j] == 0.0f)
+							continue;
+						partial.min = std::min(partial.min, values[i * n + j]);
+						partial.max = std::max(partial.max, values[i * n + j]);
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				total.min = std::min(total.min, partial.min);
+				total.max = std::max(total.max, partial.max);
+			});
+
+			if (total.min > total.max)
+				return Range();
+			return total;
+		}
+
+		Fluid& m_fluid;
+		std::vector<float> m_planes[NUM_FIELDS];
+		Range m_ranges[NUM_FIELDS];
+		bool m_fieldValid[NUM_FIELDS];
+		bool m_rangeValid[NUM_FIELDS];
+	};
+
+	// Computes FlowStats every `every` steps in one fused parallel pass over h_v, v_v,
+	// pressure and solid, and records point probes, instead of dumping full fields.
+	class FlowDiagnostics : public StepObserver
+	{
+	public:
+		std::size_t every = 1;
+		RingBuffer<FlowStats> stats;
+		std::vector<Probe> probes;
+
+		explicit FlowDiagnostics(const std::size_t capacity = 4096)
+			: stats(capacity), m_capacity(capacity)
+		{
+		}
+
+		void addProbe(const float x, const float y)
+		{
+			probes.emplace_back(x, y, m_capacity);
+		}
+
+		void observe(Fluid& fluid, float dt) override
+		{
+			(void)dt;
+
+			const std::uint64_t step = m_step++;
+			if (step % std::max<std::size_t>(1, every) != 0)
+				return;
+
+			FlowStats current = reduce(fluid);
+			current.step = step;
+			stats.push(current);
+
+			for (Probe& probe : probes) {
+				ProbeSample sample;
+				sample.step = step;
+				sample.h_v = fluid.sampleField(probe.x, probe.y, H_FIELD);
+				sample.v_v = fluid.sampleField(probe.x, probe.y, V_FIELD);
+				sample.smoke = fluid.sampleField(probe.x, probe.y, S_FIELD);
+
+				const std::size_t i = std::min(static_cast<std::size_t>(std::max(probe.x / fluid.h, 0.0f)), fluid.numX - 1);
+				const std::size_t j = std::min(static_cast<std::size_t>(std::max(probe.y / fluid.h, 0.0f)), fluid.numY - 1);
+				sample.pressure = fluid.pressure[i * fluid.numY + j];
+
+				probe.samples.push(sample);
+			}
+		}
+
+		// One sweep over the grid, split by Fluid::forColumns; every worker reduces its strip
+		// locally and merges once.
+		static FlowStats reduce(Fluid& fluid)
+		{
+			const std::size_t n = fluid.numY;
+			const float h = fluid.h;
+			const float h1 = 1.0f / h;
+
+			struct Partial
+			{
+				double kinetic = 0.0;
+				double vorticity = 0.0;
+				double enstrophy = 0.0;
+				double drag = 0.0;
+				double lift = 0.0;
+				float maxDivergence = 0.0f;
+				float vorticityMin = INFINITY;
+				float vorticityMax = -INFINITY;
+				std::size_t cells = 0;
+			};
+
+			Partial total;
+			std::mutex mutex;
+
+			// Domain walls are excluded from the forces: only solid cells strictly inside count
+			// as obstacle.
+			auto isObstacle = [&](const std::size_t i, const std::size_t j) {
+				return i > 0 && j > 0 && i < fluid.numX - 1 && j < fluid.numY - 1 && fluid.solid[i * n + j] == 0.0f;
+			};
+
+			fluid.forColumns(1, fluid.numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				Partial partial;
+				std::vector<float> curl(n);
+
+				for (std::size_t i = begin; i < end; i++) {
+					// Cell-centred, the curl vorticity confinement acts on.
+					fluid.curlColumn(i, curl.data());
+
+					for (std::size_t j = 1; j < fluid.numY - 1; j++) {
+						if (fluid.solid[i * n + j] == 0.0f)
+							continue;
+
+						const float w = curl[j];
+						partial.vorticity += w;
+						partial.enstrophy += 0.5 * w * w * h * h;
+						partial.vorticityMin = std::min(partial.vorticityMin, w);
+						partial.vorticityMax = std::max(partial.vorticityMax, w);
+						partial.cells++;
+
+						const float u0 = fluid.h_v[i * n + j];
+						const float u1 = fluid.h_v[(i + 1) * n + j];
+						const float v0 = fluid.v_v[i * n + j];
+						const float v1 = fluid.v_v[i * n + j + 1];
+
+						const float u = 0.5f * (u0 + u1);
+						const float v = 0.5f * (v0 + v1);
+						partial.kinetic += 0.5 * fluid.density * (u * u + v * v) * h * h;
+						partial.maxDivergence = std::max(partial.maxDivergence, std::abs(u1 - u0 + v1 - v0) * h1);
+
+						// The fluid pushes on every obstacle face it touches.
+						const float p = fluid.pressure[i * n + j];
+						if (isObstacle(i + 1, j)) partial.drag += p * h;
+						if (isObstacle(i - 1, j)) partial.drag -= p * h;
+						if (isObstacle(i, j + 1)) partial.lift += p * h;
+						if (isObstacle(i, j - 1)) partial.lift -= p * h;
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				total.kinetic += partial.kinetic;
+				total.vorticity += partial.vorticity;
+				total.enstrophy += partial.enstrophy;
+				total.drag += partial.drag;
+				total.lift += partial.lift;
+				total.maxDivergence = std::max(total.maxDivergence, partial.maxDivergence);
+				total.vorticityMin = std::min(total.vorticityMin, partial.vorticityMin);
+				total.vorticityMax = std::max(total.vorticityMax, partial.vorticityMax);
+				total.cells += partial.cells;
+			});
+
+			FlowStats result;
+			result.kineticEnergy = static_cast<float>(total.kinetic);
+			result.maxDivergence = total.maxDivergence;
+			result.vorticityMin = total.cells ? total.vorticityMin : 0.0f;
+			result.vorticityMax = total.cells ? total.vorticityMax : 0.0f;
+			result.vorticityMean = total.cells ? static_cast<float>(total.vorticity / total.cells) : 0.0f;
+			result.enstrophy = static_cast<float>(total.enstrophy);
+			result.drag = static_cast<float>(total.drag);
+			result.lift = static_cast<float>(total.lift);
+			return result;
+		}
+
+		// One row per recorded step. Returns false on I/O failure.
+		bool writeStatsCsv(const char* path) const
+		{
+			std::FILE* file = std::fopen(path, "w");
+			if (file == nullptr)
+				return false;
+
+			std::fprintf(file, "step,kinetic_energy,max_divergence,vorticity_min,vorticity_max,vorticity_mean,enstrophy,drag,lift\n");
+			for (std::size_t k = 0; k < stats.size(); k++) {
+				const FlowStats& s = stats[k];
+				std::fprintf(file, "%llu,%g,%g,%g,%g,%g,%g,%g,%g\n", static_cast<unsigned long long>(s.step),
+					s.kineticEnergy, s.maxDivergence, s.vorticityMin, s.vorticityMax, s.vorticityMean, s.enstrophy, s.drag, s.lift);
+			}
+
+			return std::fclose(file) == 0;
+		}
+
+		// One row per sample: probe index, position and the sampled values.
+		bool writeProbesCsv(const char* path) const
+		{
+			std::FILE* file = std::fopen(path, "w");
+			if (file == nullptr)
+				return false;
+
+			std::fprintf(file, "probe,x,y,step,h_v,v_v,pressure,smoke\n");
+			for (std::size_t p = 0; p < probes.size(); p++) {
+				const Probe& probe = probes[p];
+				for (std::size_t k = 0; k < probe.samples.size(); k++) {
+					const ProbeSample& s = probe.samples[k];
+					std::fprintf(file, "%zu,%g,%g,%llu,%g,%g,%g,%g\n", p, probe.x, probe.y,
+						static_cast<unsigned long long>(s.step), s.h_v, s.v_v, s.pressure, s.smoke);
+				}
+			}
+
+			return std::fclose(file) == 0;
+		}
+
+		// Raw dump: uint64 stats count, FlowStats records, uint64 probe count, then per probe
+		// x, y, uint64 sample count and the ProbeSample records (native byte order).
+		bool writeBinary(const char* path) const
+		{
+			std::FILE* file = std::fopen(path, "wb");
+			if (file == nullptr)
+				return false;
+
+			bool ok = true;
+			auto put = [&](const void* data, const std::size_t bytes) {
+				ok = ok && std::fwrite(data, 1, bytes, file) == bytes;
+			};
+
+			const std::uint64_t numStats = stats.size();
+			put(&numStats, sizeof(numStats));
+			for (std::size_t k = 0; k < stats.size(); k++)
+				put(&stats[k], sizeof(FlowStats));
+
+			const std::uint64_t numProbes = probes.size();
+			put(&numProbes, sizeof(numProbes));
+			for (const Probe& probe : probes) {
+				const std::uint64_t numSamples = probe.samples.size();
+				put(&probe.x, sizeof(probe.x));
+				put(&probe.y, sizeof(probe.y));
+				put(&numSamples, sizeof(numSamples));
+				for (std::size_t k = 0; k < probe.samples.size(); k++)
+					put(&probe.samples[k], sizeof(ProbeSample));
+			}
+
+			return std::fclose(file) == 0 && ok;
+		}
+
+	private:
+		std::size_t m_capacity = 4096;
+		std::uint64_t m_step = 0;
+	};
+
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace FluidSims
+{
+
+	enum halo_side_t : std::size_t
+	{
+		HALO_LEFT = 0,
+		HALO_RIGHT = 1
+	};
+
+	// Moves halo columns between ranks. Every rank owns two send slots (its leftmost and
+	// rightmost owned columns); an exchange writes them, waits for all ranks, reads the
+	// neighbours' slots and waits again before the slots may be reused.
+	class HaloTransport
+	{
+	public:
+		virtual ~HaloTransport() = default;
+
+		virtual float* slot(std::size_t rank, std::size_t side) = 0;
+		virtual void barrier() = 0;
+
+		// Scratch memory visible to every rank, e.g. for gathering results.
+		virtual float* shared() = 0;
+	};
+
+	// Ranks are threads of one process.
+	class LocalTransport : public HaloTransport
+	{
+	public:
+		LocalTransport(const std::size_t numRanks, const std::size_t slotFloats, const std::size_t sharedFloats = 0)
+			: m_numRanks(numRanks), m_slotFloats(slotFloats), m_memory(numRanks * 2 * slotFloats + sharedFloats)
+		{
+		}
+
+		float* slot(const std::size_t rank, const std::size_t side) override
+		{
+			return m_memory.data() + (rank * 2 + side) * m_slotFloats;
+		}
+
+		void barrier() override
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			const std::size_t generation = m_generation;
+			if (++m_waiting == m_numRanks) {
+				m_waiting = 0;
+				m_generation++;
+				m_wake.notify_all();
+				return;
+			}
+			m_wake.wait(lock, [&] { return m_generation != generation; });
+		}
+
+		float* shared() override { return m_memory.data() + m_numRanks * 2 * m_slotFloats; }
+
+	private:
+		std::size_t m_numRanks = 0;
+		std::size_t m_slotFloats = 0;
+		std::vector<float> m_memory;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::size_t m_waiting = 0;
+		std::size_t m_generation = 0;
+	};
+
+#if defined(__linux__)
+	// Ranks are processes on one machine sharing a POSIX shared-memory segment with a
+	// process-shared barrier. The creating process sets the segment up; ranks started with
+	// fork() inherit it, independently launched ones attach by name with create = false.
+	class ShmTransport : public HaloTransport
+	{
+	public:
+		ShmTransport(const std::string& name, const std::size_t numRanks, const std::size_t slotFloats,
+			const std::size_t sharedFloats = 0, const bool create = true)
+			: m_name(name), m_numRanks(numRanks), m_slotFloats(slotFloats), m_owner(create)
+		{
+			m_bytes = alignUp(sizeof(pthread_barrier_t), cacheLineSize) + (numRanks * 2 * slotFloats + sharedFloats) * sizeof(float);
+
+			const int fd = shm_open(name.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0600);
+			if (fd < 0)
+				return;
+
+			if (create && ftruncate(fd, static_cast<off_t>(m_bytes)) != 0) {
+				close(fd);
+				return;
+			}
+
+			void* memory = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if (memory == MAP_FAILED)
+				return;
+
+			m_memory = static_cast<std::byte*>(memory);
+
+			if (create) {
+				pthread_barrierattr_t attributes;
+				pthread_barrierattr_init(&attributes);
+				pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+				pthread_barrier_init(barrierHandle(), &attributes, static_cast<unsigned>(numRanks));
+				pthread_barrierattr_destroy(&attributes);
+			}
+		}
+
+		ShmTransport(const ShmTransport&) = delete;
+		ShmTransport& operator=(const ShmTransport&) = delete;
+
+		~ShmTransport() override
+		{
+			if (m_memory != nullptr)
+				munmap(m_memory, m_bytes);
+			if (m_owner && getpid() == m_creator)
+				shm_unlink(m_name.c_str());
+		}
+
+		bool good() const { return m_memory != nullptr; }
+
+		float* slot(const std::size_t rank, const std::size_t side) override
+		{
+			return data() + (rank * 2 + side) * m_slotFloats;
+		}
+
+		void barrier() override
+		{
+			pthread_barrier_wait(barrierHandle());
+		}
+
+		float* shared() override { return data() + m_numRanks * 2 * m_slotFloats; }
+
+	private:
+		pthread_barrier_t* barrierHandle() { return reinterpret_cast<pthread_barrier_t*>(m_memory); }
+		float* data() { return reinterpret_cast<float*>(m_memory + alignUp(sizeof(pthread_barrier_t), cacheLineSize)); }
+
+		std::string m_name;
+		std::size_t m_numRanks = 0;
+		std::size_t m_slotFloats = 0;
+		std::size_t m_bytes = 0;
+		std::byte* m_memory = nullptr;
+		bool m_owner = false;
+		pid_t m_creator = getpid();
+	};
+#endif
+
+	// The columns of the global grid one rank owns, plus the ghost columns it mirrors.
+	struct Subdomain
+	{
+		std::size_t rank = 0;
+		std::size_t numRanks = 1;
+		std::size_t begin = 0;	// first owned global column (global columns include the borders)
+		std::size_t end = 0;
+		std::size_t ghostLeft = 0;	// zero at the global domain edges
+		std::size_t ghostRight = 0;
+
+		std::size_t origin() const { return begin - ghostLeft; }
+		std::size_t localColumns() const { return end - begin + ghostLeft + ghostRight; }
+
+		static Subdomain decompose(const std::size_t globalNumX, const std::size_t rank, const std::size_t numRanks, const std::size_t ghost)
+		{
+			Subdomain domain;
+			domain.rank = rank;
+			domain.numRanks = numRanks;
+
+			const std::pair<std::size_t, std::size_t> strip = stripOf(globalNumX, rank, numRanks);
+			domain.begin = strip.first;
+			domain.end = strip.second;
+			domain.ghostLeft = rank > 0 ? ghost : 0;
+			domain.ghostRight = rank + 1 < numRanks ? ghost : 0;
+
+			assert(domain.end - domain.begin >= ghost && "subdomains must be at least as wide as the ghost layer");
+			return domain;
+		}
+	};
+
+	// One rank of a Fluid decomposed into column strips. Each rank steps a local Fluid over
+	// its owned columns plus `ghost` mirrored columns per inner side and refreshes the ghosts
+	// after every red-black half sweep and before advection. Sweeps use the global cell
+	// colour, so each rank's owned cells see exactly the single-domain projection. The local
+	// fluid's columnOrigin puts its backtraces on global positions, so advection matches
+	// bit for bit as long as the ghost layer is wider than the backtrace (max |u| * dt / h +
+	// 2 cells). The ghost layer is at
+	// least 3 columns: narrower ones leave the shared faces without the neighbour's
+	// pressure correction (the outermost ghost column is the local border and is never
+	// relaxed) and cannot hold even a zero backtrace.
+	class DomainSolver
+	{
+	public:
+		Subdomain domain;
+		std::size_t globalNumX = 0;
+		Fluid fluid;
+
+		// numX and numY are the global interior sizes, as for Fluid.
+		DomainSolver(Integrator* integrator, const float density, const std::size_t numX, const std::size_t numY, const float h,
+			const std::size_t rank, const std::size_t numRanks, const std::size_t ghost, HaloTransport& transport,
+			std::shared_ptr<ThreadPool> pool = nullptr)
+			: domain(Subdomain::decompose(numX + 2, rank, numRanks, ghost)),
+			globalNumX(numX + 2),
+			fluid(integrator, density, domain.localColumns() - 2, numY, h, nullptr, std::move(pool)),
+			m_ghost(ghost),
+			m_transport(transport)
+		{
+			assert(ghost >= 3 && "the ghost layer must be at least 3 columns wide");
+			fluid.columnOrigin = domain.origin();
+			fluid.trackPressure = false;
+		}
+
+		// Floats one send slot needs: the widest exchange sends h_v, v_v, smoke and every
+		// scalar channel.
+		static std::size_t slotFloats(const std::size_t ghost, const std::size_t numY, const std::size_t numScalars = 0)
+		{
+			return ghost * (numY + 2) * (3 + numScalars);
+		}
+
+		// Calls fn(localColumn, globalColumn) for every local column, ghosts included.
+		template<typename Fn>
+		void forLocalColumns(Fn&& fn)
+		{
+			for (std::size_t i = 0; i < fluid.numX; i++)
+				fn(i, i + domain.origin());
+		}
+
+		void simulate(const float dt, const float gravity, const std::size_t numIters)
+		{
+			assert(fluid.smokeRefinement == 1 && "the fine smoke grid is not exchanged between ranks");
+			// The inflow and outflow columns are global: each rank would only see its own end of
+			// the tunnel.
+			assert(!fluid.inflow.enabled && !fluid.convectiveOutflow && "open boundaries are not decomposed");
+			// The step below always runs a fixed number of red-black sweeps from zero pressure.
+			// The other solvers and the tuning probe need the whole grid between sweeps, and
+			// the sweeps never accumulate the pressure.
+			assert(!fluid.warmStart && fluid.tolerance == 0.0f && "warm starts are not decomposed");
+			assert(!fluid.spectral && "the spectral solver is not decomposed");
+			assert(!fluid.autoOverRelaxation && "over-relaxation tuning is not decomposed");
+			assert(!fluid.trackPressure && "the pressure is not exchanged between ranks");
+
+			fluid.integrate(dt, gravity);
+
+			fluid.pressure.fill(0.0f);
+
+			const float cp = fluid.density * fluid.h / dt;
+			for (std::size_t iter = 0; iter < numIters; iter++) {
+				for (std::size_t colour = 0; colour < 2; colour++) {
+					fluid.solveColour((colour + domain.origin()) % 2, cp);
+					exchange({ &fluid.h_v, &fluid.v_v });
+				}
+			}
+
+			for (StepObserver* observer : fluid.observers)
+				observer->observe(fluid, dt);
+
+			fluid.extrapolate(dt);
+			exchange({ &fluid.h_v, &fluid.v_v });
+			fluid.advectVel(dt);
+
+			// Channels are advected with the smoke and their ghosts must be as fresh.
+			std::vector<FieldPlane<float>*> advected = { &fluid.h_v, &fluid.v_v, &fluid.smoke };
+			for (FieldPlane<float>& channel : fluid.scalars)
+				advected.push_back(&channel);
+			exchange(advected);
+			fluid.advectSmoke(dt);
+		}
+
+		// Copies the owned columns of each rank's planes to the ghost columns of its neighbours.
+		// The transport's slots must hold slotFloats() for the fluid's channel count.
+		void exchange(const std::vector<FieldPlane<float>*>& planes)
+		{
+			if (domain.numRanks == 1)
+				return;
+
+			const std::size_t n = fluid.numY;
+			const std::size_t block = m_ghost * n;
+			const std::size_t firstOwned = domain.ghostLeft;
+			const std::size_t lastOwned = fluid.numX - domain.ghostRight - m_ghost;
+
+			std::size_t offset = 0;
+			for (FieldPlane<float>* plane : planes) {
+				if (domain.ghostLeft)
+					std::memcpy(m_transport.slot(domain.rank, HALO_LEFT) + offset, plane->data() + firstOwned * n, block * sizeof(float));
+				if (domain.ghostRight)
+					std::memcpy(m_transport.slot(domain.rank, HALO_RIGHT) + offset, plane->data() + lastOwned * n, block * sizeof(float));
+				offset += block;
+			}
+
+			m_transport.barrier();
+
+			offset = 0;
+			for (FieldPlane<float>* plane : planes) {
+				if (domain.ghostLeft)
+					std::memcpy(plane->data(), m_transport.slot(domain.rank - 1, HALO_RIGHT) + offset, block * sizeof(float));
+				if (domain.ghostRight)
+					std::memcpy(plane->data() + (fluid.numX - m_ghost) * n, m_transport.slot(domain.rank + 1, HALO_LEFT) + offset, block * sizeof(float));
+				offset += block;
+			}
+
+			m_transport.barrier();
+		}
+
+		// Copies the owned columns of `plane` into a global-sized array (e.g. HaloTransport::shared()).
+		void gather(const FieldPlane<float>& plane, float* global) const
+		{
+			const std::size_t n = fluid.numY;
+			std::memcpy(global + domain.begin * n, plane.data() + domain.ghostLeft * n, (domain.end - domain.begin) * n * sizeof(float));
+		}
+
+	private:
+		std::size_t m_ghost = 0;
+		HaloTransport& m_transport;
+	};
+
+	// Runs fn(rank) on `numRanks` ranks and waits for all of them. On Linux every rank but 0
+	// is a forked process (fork before creating threads); elsewhere ranks are threads.
+	// Returns false if a rank failed to start or exited abnormally.
+	inline bool launchLocalRanks(const std::size_t numRanks, const std::function<void(std::size_t)>& fn)
+	{
+#if defined(__linux__)
+		std::vector<pid_t> children;
+		for (std::size_t rank = 1; rank < numRanks; rank++) {
+			const pid_t pid = fork();
+			if (pid == 0) {
+				fn(rank);
+				_exit(0);
+			}
+			if (pid < 0)
+				return false;
+			children.push_back(pid);
+		}
+
+		fn(0);
+
+		bool ok = true;
+		for (const pid_t child : children) {
+			int status = 0;
+			ok = waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+		}
+		return ok;
+#else
+		std::vector<std::thread> threads;
+		for (std::size_t rank = 1; rank < numRanks; rank++)
+			threads.emplace_back(fn, rank);
+		fn(0);
+		for (std::thread& thread : threads)
+			thread.join();
+		return true;
+#endif
+	}
+
+}
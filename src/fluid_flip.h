@@ -0,0 +1,353 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// FLIP/PIC stepper on a Fluid's MAC grid. Velocity lives on particles, so it is not
+	// re-interpolated every step the way advectVel() does it and vortices survive on far
+	// coarser grids. The grid, the solid mask, the obstacle and inflow face velocities, the
+	// pressure solve (any of Fluid's solvers) and smoke advection are the Fluid's own. Each step:
+	//
+	//   rebin                 drop particles in solids or outside the interior, reseed fluid
+	//                         cells with fewer than minParticlesPerCell, counting-sort by cell
+	//   particles -> grid     bilinear splat into every face with fluid on both sides; faces
+	//                         next to solids keep the velocity the scene prescribed
+	//   integrate, project    as Fluid::simulate(), observers included
+	//   grid -> particles     u += pic - old blended with pic by flipRatio
+	//   advect particles      midpoint rule through the projected grid velocity
+	//   advect smoke          Fluid::advectSmoke()
+	//
+	// The splat runs without atomics: the columns are cut into 2 * W strips at least two
+	// columns wide, even strips splat in parallel, then odd ones. A particle in column i only
+	// reaches faces in columns i - 1 to i + 1, so strips of one colour never share a face.
+	class FlipSolver
+	{
+	public:
+		// Structure of arrays; particle p is (x[p], y[p]) with velocity (u[p], v[p]), in the
+		// units of Fluid::sampleField(). Sorted by cell after every rebin().
+		struct Particles
+		{
+			std::vector<float> x, y, u, v;
+
+			std::size_t size() const { return x.size(); }
+
+			void resize(const std::size_t count)
+			{
+				x.resize(count);
+				y.resize(count);
+				u.resize(count);
+				v.resize(count);
+			}
+		};
+
+		Particles particles;
+
+		// 1 is pure FLIP (no numerical dissipation, noisier), 0 pure PIC (as diffusive as a
+		// grid transfer every step).
+		float flipRatio = 0.95f;
+
+		// Fluid cells are topped up to particlesPerCell when they hold fewer than
+		// minParticlesPerCell, which seeds an empty fluid, feeds inflows and fills the
+		// shadow of a moving obstacle.
+		std::size_t particlesPerCell = 4;
+		std::size_t minParticlesPerCell = 2;
+
+		explicit FlipSolver(Fluid& fluid)
+			: m_fluid(fluid)
+		{
+		}
+
+		// Drops every particle; the next step reseeds from the grid velocity.
+		void reset()
+		{
+			particles.resize(0);
+		}
+
+		void simulate(const float dt, const float gravity, const std::size_t numIters)
+		{
+			Fluid& fluid = m_fluid;
+
+			rebin();
+			transferToGrid();
+
+			// The pre-solve velocities go to the advection scratch planes, which FLIP does
+			// not otherwise use, for the FLIP update.
+			fluid.forColumns(0, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+				const std::size_t n = fluid.numY;
+				std::copy(fluid.h_v.data() + begin * n, fluid.h_v.data() + end * n, fluid.newH_v.data() + begin * n);
+				std::copy(fluid.v_v.data() + begin * n, fluid.v_v.data() + end * n, fluid.newV_v.data() + begin * n);
+			});
+
+			fluid.integrate(dt, gravity);
+			fluid.project(numIters, dt);
+
+			for (StepObserver* observer : fluid.observers)
+				observer->observe(fluid, dt);
+
+			fluid.extrapolate(dt);
+
+			transferToParticles();
+			advectParticles(dt);
+
+			fluid.advectSmoke(dt);
+
+			m_step++;
+		}
+
+		// Removes particles that left the interior or sit in a solid cell, seeds the fluid
+		// cells that ran low and sorts everything by cell (column-major, like the planes).
+		void rebin()
+		{
+			Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+			const std::size_t count = particles.size();
+			const float h1 = 1.0f / fluid.h;
+
+			m_cell.resize(count);
+			m_cellStart.assign(fluid.numCells + 1, 0);
+
+			for (std::size_t p = 0; p < count; p++) {
+				const std::size_t cell = cellOf(particles.x[p] * h1, particles.y[p] * h1);
+				m_cell[p] = cell;
+				if (cell != noCell)
+					m_cellStart[cell + 1]++;
+			}
+
+			// Top-ups are counted with the survivors so every cell's slots are contiguous.
+			for (std::size_t i = 1; i < fluid.numX - 1; i++) {
+				for (std::size_t j = 1; j < n - 1; j++) {
+					const std::size_t cell = i * n + j;
+					const std::size_t existing = m_cellStart[cell + 1];
+					if (fluid.solid[cell] != 0.0f && existing < minParticlesPerCell && existing < particlesPerCell)
+						m_cellStart[cell + 1] = particlesPerCell;
+				}
+			}
+
+			for (std::size_t cell = 0; cell < fluid.numCells; cell++)
+				m_cellStart[cell + 1] += m_cellStart[cell];
+
+			m_sorted.resize(m_cellStart[fluid.numCells]);
+			m_cursor.assign(m_cellStart.begin(), m_cellStart.end() - 1);
+
+			for (std::size_t p = 0; p < count; p++) {
+				if (m_cell[p] == noCell)
+					continue;
+
+				const std::size_t slot = m_cursor[m_cell[p]]++;
+				m_sorted.x[slot] = particles.x[p];
+				m_sorted.y[slot] = particles.y[p];
+				m_sorted.u[slot] = particles.u[p];
+				m_sorted.v[slot] = particles.v[p];
+			}
+
+			std::swap(particles, m_sorted);
+
+			// The slots the survivors left free are the seeds. They take the grid velocity at
+			// their position, i.e. start out as PIC particles.
+			fluid.forColumns(0, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t cell = begin * n; cell < end * n; cell++) {
+					std::uint32_t key = hashBits(static_cast<std::uint32_t>(cell) ^ hashBits(static_cast<std::uint32_t>(m_step)));
+
+					for (std::size_t slot = m_cursor[cell]; slot < m_cellStart[cell + 1]; slot++) {
+						key = hashBits(key);
+						const float rx = unitFloat(key);
+						key = hashBits(key);
+						const float ry = unitFloat(key);
+
+						const float x = (cell / n + rx) * fluid.h;
+						const float y = (cell % n + ry) * fluid.h;
+						particles.x[slot] = x;
+						particles.y[slot] = y;
+						particles.u[slot] = fluid.sampleField(x, y, H_FIELD);
+						particles.v[slot] = fluid.sampleField(x, y, V_FIELD);
+					}
+				}
+			});
+		}
+
+		// Splats the particle velocities onto the faces between two fluid cells. Faces no
+		// particle reaches keep their velocity. Requires rebin() since the particles moved.
+		void transferToGrid()
+		{
+			Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+
+			m_uSum.resize(fluid.numCells);
+			m_uWeight.resize(fluid.numCells);
+			m_vSum.resize(fluid.numCells);
+			m_vWeight.resize(fluid.numCells);
+
+			fluid.forColumns(0, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::vector<float>* plane : { &m_uSum, &m_uWeight, &m_vSum, &m_vWeight })
+					std::fill(plane->data() + begin * n, plane->data() + end * n, 0.0f);
+			});
+
+			const std::size_t workers = fluid.pool ? fluid.pool->size() : 1;
+			const std::size_t pairs = std::max<std::size_t>(1, std::min(workers, fluid.numX / 4));
+
+			for (std::size_t colour = 0; colour < 2; colour++) {
+				forRange(pairs, [&](const std::size_t first, const std::size_t last) {
+					for (std::size_t pair = first; pair < last; pair++) {
+						const std::pair<std::size_t, std::size_t> strip = stripOf(fluid.numX, 2 * pair + colour, 2 * pairs);
+						for (std::size_t p = m_cellStart[strip.first * n]; p < m_cellStart[strip.second * n]; p++)
+							splat(p);
+					}
+				});
+			}
+
+			const std::size_t lastX = fluid.numX - 1;
+			fluid.forColumns(1, fluid.numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const float* s = fluid.solid.data() + i * n;
+					const float* sLeft = s - n;
+					float* u = fluid.h_v.data() + i * n;
+					float* v = fluid.v_v.data() + i * n;
+					const float* uSum = m_uSum.data() + i * n;
+					const float* uWeight = m_uWeight.data() + i * n;
+					const float* vSum = m_vSum.data() + i * n;
+					const float* vWeight = m_vWeight.data() + i * n;
+
+					for (std::size_t j = 1; j < n; j++) {
+						if (j < n - 1 && s[j] != 0.0f && sLeft[j] != 0.0f && uWeight[j] > 0.0f)
+							u[j] = uSum[j] / uWeight[j];
+						if (i < lastX && s[j] != 0.0f && s[j - 1] != 0.0f && vWeight[j] > 0.0f)
+							v[j] = vSum[j] / vWeight[j];
+					}
+				}
+			});
+		}
+
+		// Blends the PIC velocity (the projected grid) with the FLIP one (the particle's own
+		// plus the grid's change over this step, newH_v and newV_v holding the pre-solve grid).
+		void transferToParticles()
+		{
+			Fluid& fluid = m_fluid;
+			const float h2 = 0.5f * fluid.h;
+
+			forParticles([&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t p = begin; p < end; p++) {
+					const float x = particles.x[p];
+					const float y = particles.y[p];
+
+					const float picU = fluid.samplePlane(fluid.h_v, x, y, 0.0f, h2);
+					const float picV = fluid.samplePlane(fluid.v_v, x, y, h2, 0.0f);
+					const float oldU = fluid.samplePlane(fluid.newH_v, x, y, 0.0f, h2);
+					const float oldV = fluid.samplePlane(fluid.newV_v, x, y, h2, 0.0f);
+
+					particles.u[p] = picU + flipRatio * (particles.u[p] - oldU);
+					particles.v[p] = picV + flipRatio * (particles.v[p] - oldV);
+				}
+			});
+		}
+
+		void advectParticles(const float dt)
+		{
+			Fluid& fluid = m_fluid;
+
+			forParticles([&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t p = begin; p < end; p++) {
+					const float x = particles.x[p];
+					const float y = particles.y[p];
+
+					const float xMid = x + 0.5f * dt * fluid.sampleField(x, y, H_FIELD);
+					const float yMid = y + 0.5f * dt * fluid.sampleField(x, y, V_FIELD);
+
+					particles.x[p] = x + dt * fluid.sampleField(xMid, yMid, H_FIELD);
+					particles.y[p] = y + dt * fluid.sampleField(xMid, yMid, V_FIELD);
+				}
+			});
+		}
+
+	private:
+		static constexpr std::size_t noCell = static_cast<std::size_t>(-1);
+
+		// The interior fluid cell containing grid position (gx, gy), or noCell.
+		std::size_t cellOf(const float gx, const float gy) const
+		{
+			const Fluid& fluid = m_fluid;
+			if (!(gx >= 1.0f && gy >= 1.0f))
+				return noCell;
+
+			const std::size_t i = static_cast<std::size_t>(gx);
+			const std::size_t j = static_cast<std::size_t>(gy);
+			if (i >= fluid.numX - 1 || j >= fluid.numY - 1)
+				return noCell;
+
+			const std::size_t cell = i * fluid.numY + j;
+			return fluid.solid[cell] != 0.0f ? cell : noCell;
+		}
+
+		// Adds particle p to the four u and four v faces around it.
+		void splat(const std::size_t p)
+		{
+			const Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+			const float h1 = 1.0f / fluid.h;
+
+			auto add = [&](std::vector<float>& sum, std::vector<float>& weight, const float gx, const float gy, const float value) {
+				const float x0 = std::floor(gx);
+				const float y0 = std::floor(gy);
+				const float tx = gx - x0;
+				const float ty = gy - y0;
+				const std::size_t k = static_cast<std::size_t>(x0) * n + static_cast<std::size_t>(y0);
+
+				const float w00 = (1.0f - tx) * (1.0f - ty);
+				const float w10 = tx * (1.0f - ty);
+				const float w01 = (1.0f - tx) * ty;
+				const float w11 = tx * ty;
+
+				sum[k] += w00 * value;
+				sum[k + n] += w10 * value;
+				sum[k + 1] += w01 * value;
+				sum[k + n + 1] += w11 * value;
+				weight[k] += w00;
+				weight[k + n] += w10;
+				weight[k + 1] += w01;
+				weight[k + n + 1] += w11;
+			};
+
+			const float gx = particles.x[p] * h1;
+			const float gy = particles.y[p] * h1;
+			add(m_uSum, m_uWeight, gx, gy - 0.5f, particles.u[p]);
+			add(m_vSum, m_vWeight, gx - 0.5f, gy, particles.v[p]);
+		}
+
+		template<typename Fn>
+		void forRange(const std::size_t count, Fn&& fn)
+		{
+			if (!m_fluid.pool) {
+				fn(0, count);
+				return;
+			}
+
+			m_fluid.pool->parallelFor(count, 0, count, [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				fn(begin, end);
+			});
+		}
+
+		template<typename Fn>
+		void forParticles(Fn&& fn)
+		{
+			forRange(particles.size(), fn);
+		}
+
+		Fluid& m_fluid;
+		std::size_t m_step = 0;
+
+		std::vector<std::size_t> m_cell;
+		std::vector<std::size_t> m_cellStart;
+		std::vector<std::size_t> m_cursor;
+		Particles m_sorted;
+
+		std::vector<float> m_uSum, m_uWeight, m_vSum, m_vWeight;
+	};
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "fluid_threads.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Box-filtered mip levels of a column-major plane, for drawing a field with fewer quads
+	// than it has cells when a cell covers less than a pixel. Level 0 is the plane itself;
+	// level l is half the size of level l - 1, rounded up, and built from it, so a build
+	// costs about a third of a pass over the plane whatever the level. Only the levels up
+	// to the one asked for are built, and their buffers are kept between builds.
+	class FieldPyramid
+	{
+	public:
+		struct Level
+		{
+			const float* values = nullptr;
+			std::size_t width = 0;
+			std::size_t height = 0;
+		};
+
+		// Rebuilds levels 1 to `last` from `base`, width x height values with column stride
+		// `height`. `base` must stay valid while level 0 is read.
+		void build(const float* base, const std::size_t width, const std::size_t height, const std::size_t last, ThreadPool* pool)
+		{
+			m_levels.resize(last + 1);
+			m_storage.resize(last + 1);
+			m_levels[0] = { base, width, height };
+
+			for (std::size_t l = 1; l <= last; l++) {
+				const Level& below = m_levels[l - 1];
+				std::vector<float>& storage = m_storage[l];
+				storage.resize(reducedSize(below.width, 2) * reducedSize(below.height, 2));
+				reduce(below.values, below.width, below.height, 2, storage.data(), pool);
+				m_levels[l] = { storage.data(), reducedSize(below.width, 2), reducedSize(below.height, 2) };
+			}
+		}
+
+		const Level& level(const std::size_t l) const { return m_levels[l]; }
+		std::size_t numLevels() const { return m_levels.size(); }
+
+		static std::size_t reducedSize(const std::size_t size, const std::size_t factor)
+		{
+			return (size + factor - 1) / factor;
+		}
+
+		// Averages blocks of factor x factor values of `src` (width x height, column-major)
+		// into `dst`, reducedSize(width) x reducedSize(height); blocks cut by the top or
+		// right edge average the values they cover. Split by output columns among the pool's
+		// workers.
+		static void reduce(const float* src, const std::size_t width, const std::size_t height, const std::size_t factor,
+			float* dst, ThreadPool* pool)
+		{
+			const std::size_t dstWidth = reducedSize(width, factor);
+			const std::size_t dstHeight = reducedSize(height, factor);
+
+			auto columns = [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				for (std::size_t a = begin; a < end; a++) {
+					const std::size_t x0 = a * factor;
+					const std::size_t x1 = std::min(x0 + factor, width);
+					float* out = dst + a * dstHeight;
+
+					std::fill(out, out + dstHeight, 0.0f);
+					for (std::size_t x = x0; x < x1; x++) {
+						const float* column = src + x * height;
+
+						// Pairs, the pyramid's case, in a loop the compiler vectorizes.
+						if (factor == 2) {
+							for (std::size_t b = 0; b < height / 2; b++)
+								out[b] += column[2 * b] + column[2 * b + 1];
+							if (height % 2 != 0)
+								out[dstHeight - 1] += column[height - 1];
+							continue;
+						}
+
+						for (std::size_t b = 0; b < dstHeight; b++) {
+							const std::size_t y0 = b * factor;
+							const std::size_t y1 = std::min(y0 + factor, height);
+							float sum = 0.0f;
+							for (std::size_t y = y0; y < y1; y++)
+								sum += column[y];
+							out[b] += sum;
+						}
+					}
+
+					for (std::size_t b = 0; b < dstHeight; b++) {
+						const std::size_t rows = std::min(b * factor + factor, height) - b * factor;
+						out[b] /= static_cast<float>((x1 - x0) * rows);
+					}
+				}
+			};
+
+			if (pool)
+				pool->parallelFor(dstWidth, 0, dstWidth, columns);
+			else
+				columns(0, 0, dstWidth);
+		}
+
+	private:
+		std::vector<Level> m_levels;
+		std::vector<std::vector<float>> m_storage;
+	};
+
+}
@@ -0,0 +1,324 @@
+#pragma once
+
+#include "fluid_threads.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace FluidSims
+{
+
+	// Read-only contents of a file: a private mapping on Linux, so large files are paged in
+	// as they are read, and a plain copy elsewhere or when mapping fails.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile()
+		{
+			release();
+		}
+
+		// Returns false if the file cannot be read; the object is left empty then.
+		bool open(const char* path)
+		{
+			release();
+
+#if defined(__linux__)
+			const int fd = ::open(path, O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0) {
+				void* data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data != MAP_FAILED) {
+					close(fd);
+					m_data = static_cast<const unsigned char*>(data);
+					m_size = static_cast<std::size_t>(info.st_size);
+					m_mapped = true;
+					return true;
+				}
+			}
+			close(fd);
+#endif
+
+			std::FILE* file = std::fopen(path, "rb");
+			if (file == nullptr)
+				return false;
+
+			unsigned char buffer[1 << 16];
+			std::size_t read;
+			while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+				m_copy.insert(m_copy.end(), buffer, buffer + read);
+
+			const bool ok = !std::ferror(file);
+			std::fclose(file);
+			if (!ok) {
+				m_copy = std::vector<unsigned char>();
+				return false;
+			}
+
+			m_data = m_copy.data();
+			m_size = m_copy.size();
+			return true;
+		}
+
+		void release()
+		{
+#if defined(__linux__)
+			if (m_mapped)
+				munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+			m_copy = std::vector<unsigned char>();
+			m_data = nullptr;
+			m_size = 0;
+			m_mapped = false;
+		}
+
+		const unsigned char* data() const { return m_data; }
+		std::size_t size() const { return m_size; }
+
+	private:
+		const unsigned char* m_data = nullptr;
+		std::size_t m_size = 0;
+		bool m_mapped = false;
+		std::vector<unsigned char> m_copy;
+	};
+
+	// Cells of an ObstacleShape stretched over a box of width x height cells, column-major
+	// like the fluid's planes: inside[a * height + b] is cell (a, b) of the box.
+	struct ObstacleFootprint
+	{
+		std::size_t width = 0;
+		std::size_t height = 0;
+		std::vector<std::uint8_t> inside;
+	};
+
+	// Obstacle cross-section loaded from a file, for shapes the scene cannot describe with
+	// a few parameters (airfoils, building footprints). Two formats:
+	//   PGM (P5 binary, 8 or 16 bit, or P2 text): dark pixels, below half of maxval, are solid.
+	//   SDF: "FSDF", uint32 width, uint32 height, then width * height floats (native byte
+	//        order), x fastest, the bottom row first; negative inside. The file is mapped and
+	//        the distances are used in place.
+	// The shape is sampled bilinearly at cell centres, so a footprint is rasterized from the
+	// zero level set rather than snapped to the nearest pixel.
+	class ObstacleShape
+	{
+	public:
+		ObstacleShape() = default;
+
+		ObstacleShape(const ObstacleShape&) = delete;
+		ObstacleShape& operator=(const ObstacleShape&) = delete;
+
+		// Picks the format by the file's magic. Returns false if the file cannot be read or
+		// is malformed; the shape is left empty then.
+		bool load(const char* path)
+		{
+			clear();
+			if (!m_file.open(path))
+				return false;
+
+			const unsigned char* data = m_file.data();
+			const std::size_t size = m_file.size();
+			bool ok = false;
+			if (size >= 2 && data[0] == 'P' && (data[1] == '5' || data[1] == '2'))
+				ok = parsePgm(data, size);
+			else if (size >= sdfHeaderBytes && std::memcmp(data, sdfMagic, 4) == 0)
+				ok = parseSdf(data, size);
+
+			if (!ok)
+				clear();
+			return ok;
+		}
+
+		void clear()
+		{
+			m_file.release();
+			m_decoded = std::vector<float>();
+			m_values = nullptr;
+			m_width = 0;
+			m_height = 0;
+			m_footprints.clear();
+		}
+
+		bool empty() const { return m_values == nullptr; }
+		std::size_t width() const { return m_width; }
+		std::size_t height() const { return m_height; }
+
+		// The shape at (x, y) in pixels from its lower left corner; negative inside. Clamped
+		// to the edge pixels outside the image.
+		float distance(const float x, const float y) const
+		{
+			const float lastX = static_cast<float>(m_width - 1);
+			const float lastY = static_cast<float>(m_height - 1);
+			const float px = std::max(std::min(x - 0.5f, lastX), 0.0f);
+			const float py = std::max(std::min(y - 0.5f, lastY), 0.0f);
+
+			const std::size_t x0 = std::min(static_cast<std::size_t>(px), m_width - 1);
+			const std::size_t y0 = std::min(static_cast<std::size_t>(py), m_height - 1);
+			const std::size_t x1 = std::min(x0 + 1, m_width - 1);
+			const std::size_t y1 = std::min(y0 + 1, m_height - 1);
+			const float tx = px - x0;
+			const float ty = py - y0;
+
+			const float* row0 = m_values + y0 * m_width;
+			const float* row1 = m_values + y1 * m_width;
+			return (1.0f - ty) * ((1.0f - tx) * row0[x0] + tx * row0[x1]) +
+				ty * ((1.0f - tx) * row1[x0] + tx * row1[x1]);
+		}
+
+		// The shape stretched over width x height cells. Rasterized on first use, split by
+		// columns among the pool's workers, and cached per size until the next load(), so
+		// setting up a scene again on the same grid reuses it.
+		const ObstacleFootprint& footprint(const std::size_t width, const std::size_t height, ThreadPool* pool)
+		{
+			const std::pair<std::size_t, std::size_t> key(width, height);
+			const auto found = m_footprints.find(key);
+			if (found != m_footprints.end())
+				return found->second;
+
+			ObstacleFootprint& result = m_footprints[key];
+			result.width = width;
+			result.height = height;
+			result.inside.assign(width * height, 0);
+			if (empty())
+				return result;
+
+			const float scaleX = static_cast<float>(m_width) / width;
+			const float scaleY = static_cast<float>(m_height) / height;
+			auto rasterize = [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				for (std::size_t a = begin; a < end; a++) {
+					std::uint8_t* column = result.inside.data() + a * height;
+					for (std::size_t b = 0; b < height; b++)
+						column[b] = distance((a + 0.5f) * scaleX, (b + 0.5f) * scaleY) < 0.0f;
+				}
+			};
+
+			if (pool)
+				pool->parallelFor(width, 0, width, rasterize);
+			else
+				rasterize(0, 0, width);
+
+			return result;
+		}
+
+	private:
+		static constexpr char sdfMagic[4] = { 'F', 'S', 'D', 'F' };
+		static constexpr std::size_t sdfHeaderBytes = 12;
+
+		bool parseSdf(const unsigned char* data, const std::size_t size)
+		{
+			std::uint32_t width, height;
+			std::memcpy(&width, data + 4, sizeof(width));
+			std::memcpy(&height, data + 8, sizeof(height));
+
+			const std::size_t count = static_cast<std::size_t>(width) * height;
+			if (count == 0 || (size - sdfHeaderBytes) / sizeof(float) < count)
+				return false;
+
+			// The header keeps the distances 4-byte aligned in the page-aligned mapping.
+			m_width = width;
+			m_height = height;
+			m_values = reinterpret_cast<const float*>(data + sdfHeaderBytes);
+			return true;
+		}
+
+		bool parsePgm(const unsigned char* data, const std::size_t size)
+		{
+			const bool binary = data[1] == '5';
+			std::size_t at = 2;
+
+			// Width, height and maxval: decimal, separated by whitespace and # comments.
+			auto number = [&](std::size_t& value) {
+				while (at < size && (std::isspace(data[at]) || data[at] == '#')) {
+					if (data[at] == '#')
+						while (at < size && data[at] != '\n')
+							at++;
+					else
+						at++;
+				}
+
+				if (at == size || !std::isdigit(data[at]))
+					return false;
+
+				value = 0;
+				while (at < size && std::isdigit(data[at]) && value < (std::size_t{ 1 } << 32))
+					value = value * 10 + (data[at++] - '0');
+				return true;
+			};
+
+			std::size_t width, height, maxValue;
+			if (!number(width) || !number(height) || !number(maxValue) || width == 0 || height == 0 || maxValue == 0 || maxValue > 65535)
+				return false;
+
+			if (width > SIZE_MAX / height)
+				return false;
+
+			// The samples must fit in the rest of the file before anything is allocated for them.
+			const std::size_t count = width * height;
+			const std::size_t bytesPerPixel = maxValue < 256 ? 1 : 2;
+			if (binary) {
+				// One whitespace character ends the header.
+				at++;
+				if (at > size || (size - at) / bytesPerPixel < count)
+					return false;
+			}
+			else if ((size - at + 1) / 2 < count) {
+				// A text sample takes a digit and a separator, except the last one.
+				return false;
+			}
+
+			m_decoded.resize(count);
+
+			const float scale = 1.0f / maxValue;
+			for (std::size_t row = 0; row < height; row++) {
+				// PGM stores the top row first.
+				float* out = m_decoded.data() + (height - 1 - row) * width;
+				for (std::size_t x = 0; x < width; x++) {
+					std::size_t value;
+					if (binary) {
+						value = bytesPerPixel == 1 ? data[at] : (data[at] << 8 | data[at + 1]);
+						at += bytesPerPixel;
+					}
+					else if (!number(value))
+						return false;
+
+					out[x] = std::min(value, maxValue) * scale - 0.5f;
+				}
+			}
+
+			m_file.release();
+			m_width = width;
+			m_height = height;
+			m_values = m_decoded.data();
+			return true;
+		}
+
+		MappedFile m_file;
+		std::vector<float> m_decoded;
+		const float* m_values = nullptr;
+		std::size_t m_width = 0;
+		std::size_t m_height = 0;
+
+		std::map<std::pair<std::size_t, std::size_t>, ObstacleFootprint> m_footprints;
+	};
+
+}
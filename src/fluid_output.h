@@ -0,0 +1,491 @@
+#pragma once
+
+#include "fluid_codec.h"
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FluidSims
+{
+
+	enum output_field_t : unsigned
+	{
+		OUTPUT_SMOKE = 1 << 0,
+		OUTPUT_PRESSURE = 1 << 1,
+		OUTPUT_H_V = 1 << 2,
+		OUTPUT_V_V = 1 << 3,
+		OUTPUT_NUM_FIELDS = 4
+	};
+
+	enum class output_encoding_t : std::uint32_t
+	{
+		float32,
+		half,	// IEEE binary16
+		quantized16	// 16-bit codes with a per-frame offset and scale
+	};
+
+	struct OutputOptions
+	{
+		unsigned fields = OUTPUT_SMOKE | OUTPUT_PRESSURE | OUTPUT_H_V | OUTPUT_V_V;
+		output_encoding_t encoding = output_encoding_t::half;
+		bool delta = true;	// store codes as differences to the previous frame
+		bool compress = true;	// shuffle + LZ block compression on top
+		std::size_t every = 1;	// record every k-th submitted step
+		std::size_t keyframeInterval = 60;	// frames between frames that do not depend on the previous one
+		std::size_t queueDepth = 3;	// snapshots in flight before new frames are dropped
+	};
+
+	// Stream layout (native byte order): StreamHeader, then per frame a StreamFrameHeader
+	// followed by one StreamPlaneHeader and its payload per recorded field, in bit order.
+	constexpr char streamMagic[8] = { 'F', 'L', 'U', 'I', 'D', 'S', 'T', 'R' };
+	constexpr std::uint32_t streamVersion = 1;
+
+	enum stream_plane_flags_t : std::uint32_t
+	{
+		STREAM_DELTA = 1 << 0,
+		STREAM_COMPRESSED = 1 << 1,
+	};
+
+	struct StreamHeader
+	{
+		char magic[8] = {};
+		std::uint32_t version = 0;
+		std::uint32_t fields = 0;
+		std::uint32_t encoding = 0;
+		std::uint32_t reserved = 0;
+		std::uint64_t numX = 0;
+		std::uint64_t numY = 0;
+		float h = 0.0f;
+		float padding = 0.0f;
+	};
+
+	struct StreamFrameHeader
+	{
+		std::uint64_t step = 0;
+		std::uint32_t keyframe = 0;
+		std::uint32_t numPlanes = 0;
+	};
+
+	struct StreamPlaneHeader
+	{
+		std::uint32_t field = 0;
+		std::uint32_t flags = 0;
+		float offset = 0.0f;	// quantized16 only
+		float scale = 0.0f;
+		std::uint64_t storedBytes = 0;
+	};
+
+	namespace detail
+	{
+		inline const FieldPlane<float>& outputPlane(const Fluid& fluid, const unsigned field)
+		{
+			switch (field) {
+			case OUTPUT_PRESSURE: return fluid.pressure;
+			case OUTPUT_H_V: return fluid.h_v;
+			case OUTPUT_V_V: return fluid.v_v;
+			default: return fluid.smoke;
+			}
+		}
+
+		inline std::size_t codeSize(const output_encoding_t encoding)
+		{
+			return encoding == output_encoding_t::float32 ? sizeof(std::uint32_t) : sizeof(std::uint16_t);
+		}
+	}
+
+	// Records selected fields every k steps. The solver thread only copies the fields into a
+	// free snapshot; encoding, compression and disk writes happen on a background thread.
+	class FieldStreamWriter
+	{
+	public:
+		FieldStreamWriter(const char* path, const Fluid& fluid, const OutputOptions& options = OutputOptions())
+			: m_options(options), m_numCells(fluid.numCells)
+		{
+			m_file = std::fopen(path, "wb");
+			if (m_file == nullptr)
+				return;
+
+			StreamHeader header;
+			std::memcpy(header.magic, streamMagic, sizeof(header.magic));
+			header.version = streamVersion;
+			header.fields = options.fields;
+			header.encoding = static_cast<std::uint32_t>(options.encoding);
+			header.numX = fluid.numX;
+			header.numY = fluid.numY;
+			header.h = fluid.h;
+			m_ok = std::fwrite(&header, sizeof(header), 1, m_file) == 1;
+
+			m_snapshots.resize(std::max<std::size_t>(1, options.queueDepth));
+			for (Snapshot& snapshot : m_snapshots) {
+				for (unsigned field = 0; field < OUTPUT_NUM_FIELDS; field++)
+					if (options.fields & (1u << field))
+						snapshot.planes.emplace_back(m_numCells);
+				m_free.push_back(&snapshot);
+			}
+
+			m_previous.resize(m_snapshots.front().planes.size());
+			m_thread = std::thread(&FieldStreamWriter::writerLoop, this);
+		}
+
+		FieldStreamWriter(const FieldStreamWriter&) = delete;
+		FieldStreamWriter& operator=(const FieldStreamWriter&) = delete;
+
+		// Writes every queued frame before closing the file.
+		~FieldStreamWriter()
+		{
+			if (m_thread.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_stop = true;
+				}
+				m_wake.notify_one();
+				m_thread.join();
+			}
+
+			if (m_file != nullptr)
+				std::fclose(m_file);
+		}
+
+		bool good() const { return m_file != nullptr && m_ok; }
+
+		// Hands the fields of `step` to the writer if it is a recorded step. Never waits: when
+		// every snapshot is still in flight the frame is dropped and counted instead.
+		bool submit(const Fluid& fluid, const std::size_t step)
+		{
+			if (!good() || fluid.numCells != m_numCells || step % std::max<std::size_t>(1, m_options.every) != 0)
+				return false;
+
+			Snapshot* snapshot = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_free.empty()) {
+					m_dropped++;
+					return false;
+				}
+				snapshot = m_free.front();
+				m_free.pop_front();
+			}
+
+			snapshot->step = step;
+			std::size_t plane = 0;
+			for (unsigned field = 0; field < OUTPUT_NUM_FIELDS; field++) {
+				if (m_options.fields & (1u << field)) {
+					const FieldPlane<float>& source = detail::outputPlane(fluid, 1u << field);
+					std::copy(source.begin(), source.end(), snapshot->planes[plane++].begin());
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_ready.push_back(snapshot);
+			}
+			m_wake.notify_one();
+			return true;
+		}
+
+		std::size_t framesWritten() const { std::lock_guard<std::mutex> lock(m_mutex); return m_written; }
+		std::size_t framesDropped() const { std::lock_guard<std::mutex> lock(m_mutex); return m_dropped; }
+		std::size_t bytesWritten() const { std::lock_guard<std::mutex> lock(m_mutex); return m_bytes; }
+
+	private:
+		struct Snapshot
+		{
+			std::size_t step = 0;
+			std::vector<std::vector<float>> planes;
+		};
+
+		void writerLoop()
+		{
+			for (;;) {
+				Snapshot* snapshot = nullptr;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [this] { return m_stop || !m_ready.empty(); });
+					if (m_ready.empty())
+						return;
+					snapshot = m_ready.front();
+					m_ready.pop_front();
+				}
+
+				const std::size_t bytes = writeFrame(*snapshot);
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_free.push_back(snapshot);
+				m_written++;
+				m_bytes += bytes;
+			}
+		}
+
+		std::size_t writeFrame(const Snapshot& snapshot)
+		{
+			const bool keyframe = !m_options.delta || m_frame % std::max<std::size_t>(1, m_options.keyframeInterval) == 0;
+			m_frame++;
+
+			StreamFrameHeader frame;
+			frame.step = snapshot.step;
+			frame.keyframe = keyframe ? 1 : 0;
+			frame.numPlanes = static_cast<std::uint32_t>(snapshot.planes.size());
+			m_ok = m_ok && std::fwrite(&frame, sizeof(frame), 1, m_file) == 1;
+			std::size_t bytes = sizeof(frame);
+
+			std::size_t plane = 0;
+			for (unsigned field = 0; field < OUTPUT_NUM_FIELDS; field++) {
+				if (!(m_options.fields & (1u << field)))
+					continue;
+
+				StreamPlaneHeader header;
+				header.field = 1u << field;
+				encodePlane(snapshot.planes[plane], m_previous[plane], keyframe, header);
+				plane++;
+
+				const std::vector<std::uint8_t>& payload = (header.flags & STREAM_COMPRESSED) ? m_packed : m_codes;
+				header.storedBytes = payload.size();
+
+				m_ok = m_ok && std::fwrite(&header, sizeof(header), 1, m_file) == 1;
+				m_ok = m_ok && std::fwrite(payload.data(), 1, payload.size(), m_file) == payload.size();
+				bytes += sizeof(header) + payload.size();
+			}
+
+			return bytes;
+		}
+
+		// Fills m_codes (and m_packed when compressing) for one plane and updates `previous`
+		// to this frame's codes for the next delta.
+		void encodePlane(const std::vector<float>& values, std::vector<std::uint8_t>& previous, const bool keyframe, StreamPlaneHeader& header)
+		{
+			const std::size_t codeSize = detail::codeSize(m_options.encoding);
+			const std::size_t count = values.size();
+			m_codes.resize(count * codeSize);
+
+			if (m_options.encoding == output_encoding_t::float32) {
+				std::memcpy(m_codes.data(), values.data(), m_codes.size());
+			}
+			else {
+				std::uint16_t* codes = reinterpret_cast<std::uint16_t*>(m_codes.data());
+
+				if (m_options.encoding == output_encoding_t::half) {
+					for (std::size_t i = 0; i < count; i++)
+						codes[i] = Codec::floatToHalf(values[i]);
+				}
+				else {
+					const auto range = std::minmax_element(values.begin(), values.end());
+					header.offset = *range.first;
+					header.scale = (*range.second - *range.first) / 65535.0f;
+					const float inverse = header.scale > 0.0f ? 1.0f / header.scale : 0.0f;
+
+					for (std::size_t i = 0; i < count; i++)
+						codes[i] = static_cast<std::uint16_t>(std::lround((values[i] - header.offset) * inverse));
+				}
+			}
+
+			if (!keyframe && previous.size() == m_codes.size()) {
+				header.flags |= STREAM_DELTA;
+				m_delta.resize(m_codes.size());
+
+				if (codeSize == sizeof(std::uint32_t)) {
+					// Float bit patterns are XORed: unchanged high bytes become zero.
+					const std::uint32_t* current = reinterpret_cast<const std::uint32_t*>(m_codes.data());
+					const std::uint32_t* last = reinterpret_cast<const std::uint32_t*>(previous.data());
+					std::uint32_t* delta = reinterpret_cast<std::uint32_t*>(m_delta.data());
+					for (std::size_t i = 0; i < count; i++)
+						delta[i] = current[i] ^ last[i];
+				}
+				else {
+					const std::uint16_t* current = reinterpret_cast<const std::uint16_t*>(m_codes.data());
+					const std::uint16_t* last = reinterpret_cast<const std::uint16_t*>(previous.data());
+					std::uint16_t* delta = reinterpret_cast<std::uint16_t*>(m_delta.data());
+					for (std::size_t i = 0; i < count; i++)
+						delta[i] = static_cast<std::uint16_t>(current[i] - last[i]);
+				}
+
+				previous.swap(m_codes);
+				m_codes.swap(m_delta);
+			}
+			else {
+				previous = m_codes;
+			}
+
+			if (m_options.compress) {
+				header.flags |= STREAM_COMPRESSED;
+				m_packed.clear();
+				Codec::compressElements(m_codes.data(), count, codeSize, m_packed);
+			}
+		}
+
+		OutputOptions m_options;
+		std::size_t m_numCells = 0;
+		std::FILE* m_file = nullptr;
+		std::atomic<bool> m_ok{ false };	// cleared by the writer thread, read by submit()
+
+		std::vector<Snapshot> m_snapshots;
+		std::deque<Snapshot*> m_free;
+		std::deque<Snapshot*> m_ready;
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::thread m_thread;
+		bool m_stop = false;
+
+		std::size_t m_written = 0;
+		std::size_t m_dropped = 0;
+		std::size_t m_bytes = 0;
+
+		// Writer thread only.
+		std::size_t m_frame = 0;
+		std::vector<std::vector<std::uint8_t>> m_previous;
+		std::vector<std::uint8_t> m_codes;
+		std::vector<std::uint8_t> m_delta;
+		std::vector<std::uint8_t> m_packed;
+	};
+
+	// Decodes a stream written by FieldStreamWriter, one frame at a time.
+	class FieldStreamReader
+	{
+	public:
+		explicit FieldStreamReader(const char* path)
+		{
+			m_file = std::fopen(path, "rb");
+			if (m_file == nullptr)
+				return;
+
+			std::uint64_t size = 0;
+			m_ok = std::fread(&m_header, sizeof(m_header), 1, m_file) == 1 &&
+				std::memcmp(m_header.magic, streamMagic, sizeof(m_header.magic)) == 0 &&
+				m_header.version == streamVersion &&
+				m_header.encoding <= static_cast<std::uint32_t>(output_encoding_t::quantized16) &&
+				detail::fileSize(m_file, size) && detail::seek(m_file, sizeof(m_header));
+			if (!m_ok)
+				return;
+
+			// A plane's codes must be addressable, so numX * numY * codeSize may not wrap.
+			const std::size_t codeSize = detail::codeSize(static_cast<output_encoding_t>(m_header.encoding));
+			m_ok = m_header.numX > 0 && m_header.numY > 0 && m_header.numX <= SIZE_MAX / codeSize / m_header.numY;
+			m_count = m_ok ? static_cast<std::size_t>(m_header.numX * m_header.numY) : 0;
+			m_remaining = size - sizeof(m_header);
+			for (unsigned field = 0; field < OUTPUT_NUM_FIELDS; field++)
+				m_numPlanes += (m_header.fields >> field) & 1u;
+		}
+
+		FieldStreamReader(const FieldStreamReader&) = delete;
+		FieldStreamReader& operator=(const FieldStreamReader&) = delete;
+
+		~FieldStreamReader()
+		{
+			if (m_file != nullptr)
+				std::fclose(m_file);
+		}
+
+		bool good() const { return m_file != nullptr && m_ok; }
+		const StreamHeader& header() const { return m_header; }
+
+		// Decodes the next frame into `planes`, one vector per recorded field in bit order.
+		// Returns false at the end of the stream or on malformed data.
+		bool next(std::size_t& step, std::vector<std::vector<float>>& planes)
+		{
+			StreamFrameHeader frame;
+			if (!good() || m_remaining < sizeof(frame) || std::fread(&frame, sizeof(frame), 1, m_file) != 1)
+				return false;
+			m_remaining -= sizeof(frame);
+
+			// Every frame holds one plane per recorded field, and each size read below is
+			// checked against the rest of the file before anything is allocated for it.
+			if (frame.numPlanes != m_numPlanes)
+				return m_ok = false;
+
+			const output_encoding_t encoding = static_cast<output_encoding_t>(m_header.encoding);
+			const std::size_t codeSize = detail::codeSize(encoding);
+			const std::size_t count = m_count;
+
+			step = frame.step;
+			planes.resize(frame.numPlanes);
+			m_previous.resize(frame.numPlanes);
+
+			for (std::size_t plane = 0; plane < frame.numPlanes; plane++) {
+				StreamPlaneHeader header;
+				if (m_remaining < sizeof(header) || std::fread(&header, sizeof(header), 1, m_file) != 1)
+					return m_ok = false;
+				m_remaining -= sizeof(header);
+
+				if (header.storedBytes > m_remaining || (!(header.flags & STREAM_COMPRESSED) && header.storedBytes != count * codeSize))
+					return m_ok = false;
+				m_remaining -= header.storedBytes;
+
+				m_payload.resize(header.storedBytes);
+				if (std::fread(m_payload.data(), 1, m_payload.size(), m_file) != m_payload.size())
+					return m_ok = false;
+
+				m_codes.resize(count * codeSize);
+				if (header.flags & STREAM_COMPRESSED) {
+					if (!Codec::decompressElements(m_payload.data(), m_payload.size(), m_codes.data(), count, codeSize))
+						return m_ok = false;
+				}
+				else {
+					m_codes.swap(m_payload);
+				}
+
+				std::vector<std::uint8_t>& previous = m_previous[plane];
+				if (header.flags & STREAM_DELTA) {
+					if (previous.size() != m_codes.size())
+						return m_ok = false;
+
+					if (codeSize == sizeof(std::uint32_t)) {
+						std::uint32_t* codes = reinterpret_cast<std::uint32_t*>(m_codes.data());
+						const std::uint32_t* last = reinterpret_cast<const std::uint32_t*>(previous.data());
+						for (std::size_t i = 0; i < count; i++)
+							codes[i] ^= last[i];
+					}
+					else {
+						std::uint16_t* codes = reinterpret_cast<std::uint16_t*>(m_codes.data());
+						const std::uint16_t* last = reinterpret_cast<const std::uint16_t*>(previous.data());
+						for (std::size_t i = 0; i < count; i++)
+							codes[i] = static_cast<std::uint16_t>(codes[i] + last[i]);
+					}
+				}
+				previous = m_codes;
+
+				std::vector<float>& values = planes[plane];
+				values.resize(count);
+
+				if (encoding == output_encoding_t::float32) {
+					std::memcpy(values.data(), m_codes.data(), count * sizeof(float));
+				}
+				else {
+					const std::uint16_t* codes = reinterpret_cast<const std::uint16_t*>(m_codes.data());
+					if (encoding == output_encoding_t::half) {
+						for (std::size_t i = 0; i < count; i++)
+							values[i] = Codec::halfToFloat(codes[i]);
+					}
+					else {
+						for (std::size_t i = 0; i < count; i++)
+							values[i] = header.offset + header.scale * codes[i];
+					}
+				}
+			}
+
+			return true;
+		}
+
+	private:
+		std::FILE* m_file = nullptr;
+		bool m_ok = false;
+		StreamHeader m_header;
+		std::size_t m_count = 0;	// cells per plane
+		std::size_t m_numPlanes = 0;
+		std::uint64_t m_remaining = 0;	// bytes of the file not read yet
+
+		std::vector<std::vector<std::uint8_t>> m_previous;
+		std::vector<std::uint8_t> m_payload;
+		std::vector<std::uint8_t> m_codes;
+	};
+
+}
@@ -0,0 +1,424 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Two-level patch refinement: a Fluid with half the cell size laid over a rectangle of a
+	// coarse Fluid that covers the obstacles and the strongest vorticity, and is re-placed
+	// every `regridInterval` steps. The boundary layers and the near wake get the fine
+	// resolution while the far field, most of the domain, stays coarse. Each step:
+	//
+	//   coarse solve    integrate and project the whole coarse domain, as simulate(); under
+	//                   the patch the faces start from the last restriction, which is
+	//                   divergence free, so the solve only carries the outer flow into it
+	//   patch edge      every face on the patch edge takes the velocity of the coarse face
+	//                   it lies on, taken here, before the coarse advection, while the coarse
+	//                   field is divergence free and at the patch's time level; what the
+	//                   coarse solve's residual leaves of the net flux is spread over the
+	//                   open edge faces, so the patch projection, walled in all round, is
+	//                   solvable. The ghost cells outside the edge sample the coarse fields
+	//                   for advection
+	//   coarse advect   as simulate()
+	//   patch step      integrate, project (observers included) and advect, as simulate()
+	//   restriction     coarse faces and cells inside the patch become the averages of the
+	//                   2 fine faces and 4 fine cells they cover, which keeps the coarse
+	//                   velocity divergence free
+	//
+	// The patch mask is `solidAt` at the fine cell centres, so obstacle edges are resolved
+	// at the fine cell size. Obstacles are taken to be at rest, and scalar channels and fine
+	// smoke stay on the coarse grid.
+	class PatchSolver
+	{
+	public:
+		static constexpr std::size_t ratio = 2;
+
+		// Interior coarse cells [i0, i1) x [j0, j1) under the patch.
+		struct Region
+		{
+			std::size_t i0 = 0, j0 = 0;
+			std::size_t i1 = 0, j1 = 0;
+
+			bool empty() const { return i0 >= i1 || j0 >= j1; }
+		};
+
+		Region region;
+
+		// Run on the patch after its projection, as Fluid::observers on the coarse grid.
+		std::vector<StepObserver*> observers;
+
+		// Whether (x, y), in the units of the coarse Fluid::sampleField(), lies inside an
+		// obstacle. Unset, every fine cell takes the mask of its coarse cell.
+		std::function<bool(float x, float y)> solidAt;
+
+		// Coarse cells within `margin` cells of an obstacle, or whose |vorticity| reaches
+		// `vorticityFraction` of the largest, are refined: the patch is their bounding box,
+		// grown by `margin`.
+		std::size_t margin = 12;
+		float vorticityFraction = 0.5f;
+		std::size_t regridInterval = 20;
+
+		explicit PatchSolver(Fluid& coarse)
+			: m_coarse(coarse)
+		{
+		}
+
+		// The fine Fluid; null while nothing is refined.
+		Fluid* patch() { return m_fine.get(); }
+		const Fluid* patch() const { return m_fine.get(); }
+
+		// Cells of both levels, borders included.
+		std::size_t numCells() const
+		{
+			return m_coarse.numCells + (m_fine ? m_fine->numCells : 0);
+		}
+
+		// Drops the patch; the next step places a new one.
+		void reset()
+		{
+			m_fine.reset();
+			region = Region();
+			m_step = 0;
+		}
+
+		// Steps the coarse grid in the pieces of Fluid::simulate() (never the fused path), so
+		// the patch edge can be taken between its projection and its advection.
+		void simulate(const float dt, const float gravity, const std::size_t numIters)
+		{
+			if (m_step++ % std::max<std::size_t>(regridInterval, 1) == 0)
+				regrid();
+
+			Fluid& coarse = m_coarse;
+			coarse.integrate(dt, gravity);
+			coarse.project(numIters, dt);
+
+			for (StepObserver* observer : coarse.observers)
+				observer->observe(coarse, dt);
+
+			coarse.extrapolate(dt);
+			if (m_fine)
+				setEdge();
+
+			coarse.advectVel(dt);
+			coarse.advectSmoke(dt);
+			if (!m_fine)
+				return;
+
+			Fluid& fine = *m_fine;
+			fine.autoOverRelaxation = coarse.autoOverRelaxation;
+			if (!fine.autoOverRelaxation)
+				fine.overRelaxation = coarse.overRelaxation;
+			fine.vorticityConfinement = coarse.vorticityConfinement;
+			fine.warmStart = coarse.warmStart;
+			fine.tolerance = coarse.tolerance;
+
+			fine.integrate(dt, gravity);
+			fine.project(numIters, dt);
+
+			for (StepObserver* observer : observers)
+				observer->observe(fine, dt);
+
+			fine.advectVel(dt);
+			fine.advectSmoke(dt);
+			restrict();
+		}
+
+		// Flags the coarse cells to refine and moves the patch over them. The new patch is
+		// prolonged from the coarse fields, then takes the fine fields of the old patch
+		// where the two overlap.
+		void regrid()
+		{
+			const Fluid& coarse = m_coarse;
+			const std::size_t n = coarse.numY;
+			const std::size_t lastX = coarse.numX - 1;
+			std::mutex mutex;
+
+			auto isObstacle = [&](const std::size_t i, const std::size_t j) {
+				return i > 0 && j > 0 && i < lastX && j < n - 1 && coarse.solid[i * n + j] == 0.0f;
+			};
+
+			// Cell-centred, as FlowDiagnostics measures it and confinement acts on it.
+			std::vector<float> vorticity(coarse.numCells);
+			auto curl = [&](const std::size_t i, const std::size_t j) {
+				return std::abs(vorticity[i * n + j]);
+			};
+
+			float maxCurl = 0.0f;
+			m_coarse.forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+				float local = 0.0f;
+				for (std::size_t i = begin; i < end; i++) {
+					coarse.curlColumn(i, vorticity.data() + i * n);
+					for (std::size_t j = 1; j < n - 1; j++)
+						local = std::max(local, curl(i, j));
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				maxCurl = std::max(maxCurl, local);
+			});
+
+			const float threshold = vorticityFraction * maxCurl;
+			Region flagged = { coarse.numX, n, 0, 0 };
+			m_coarse.forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+				Region local = { coarse.numX, n, 0, 0 };
+				for (std::size_t i = begin; i < end; i++) {
+					for (std::size_t j = 1; j < n - 1; j++) {
+						if (isObstacle(i, j) || (maxCurl > 0.0f && curl(i, j) >= threshold)) {
+							local.i0 = std::min(local.i0, i);
+							local.j0 = std::min(local.j0, j);
+							local.i1 = std::max(local.i1, i + 1);
+							local.j1 = std::max(local.j1, j + 1);
+						}
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				flagged.i0 = std::min(flagged.i0, local.i0);
+				flagged.j0 = std::min(flagged.j0, local.j0);
+				flagged.i1 = std::max(flagged.i1, local.i1);
+				flagged.j1 = std::max(flagged.j1, local.j1);
+			});
+
+			if (flagged.empty()) {
+				reset();
+				m_step = 1;
+				return;
+			}
+
+			Region next;
+			next.i0 = std::max<std::size_t>(1, flagged.i0 - std::min(flagged.i0, margin));
+			next.j0 = std::max<std::size_t>(1, flagged.j0 - std::min(flagged.j0, margin));
+			next.i1 = std::min(lastX, flagged.i1 + margin);
+			next.j1 = std::min(n - 1, flagged.j1 + margin);
+
+			if (m_fine && next.i0 == region.i0 && next.j0 == region.j0 && next.i1 == region.i1 && next.j1 == region.j1)
+				return;
+
+			std::unique_ptr<Fluid> fine = std::make_unique<Fluid>(coarse.integrator, coarse.density,
+				ratio * (next.i1 - next.i0), ratio * (next.j1 - next.j0), coarse.h / ratio, nullptr, coarse.pool);
+			prolong(*fine, next);
+
+			if (m_fine)
+				copyOverlap(*fine, next);
+
+			m_fine = std::move(fine);
+			region = next;
+		}
+
+	private:
+		// Position of the lower left corner of fine cell (0, 0) in coarse units.
+		float originX(const Region& r) const { return r.i0 * m_coarse.h - 0.5f * m_coarse.h; }
+		float originY(const Region& r) const { return r.j0 * m_coarse.h - 0.5f * m_coarse.h; }
+
+		// Fills every field of `fine` from the coarse fields and builds its mask.
+		void prolong(Fluid& fine, const Region& r) const
+		{
+			const Fluid& coarse = m_coarse;
+			const std::size_t n = fine.numY;
+			const std::size_t cn = coarse.numY;
+			const float hf = fine.h;
+			const float ox = originX(r);
+			const float oy = originY(r);
+
+			fine.forColumns(0, fine.numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t a = begin; a < end; a++) {
+					const std::size_t i = r.i0 + (std::max<std::size_t>(a, 1) - 1) / ratio;
+					for (std::size_t b = 0; b < n; b++) {
+						const std::size_t j = r.j0 + (std::max<std::size_t>(b, 1) - 1) / ratio;
+						const float x = ox + (a + 0.5f) * hf;
+						const float y = oy + (b + 0.5f) * hf;
+						const std::size_t k = a * n + b;
+
+						fine.h_v[k] = coarse.sampleField(ox + a * hf, y, H_FIELD);
+						fine.v_v[k] = coarse.sampleField(x, oy + b * hf, V_FIELD);
+						fine.smoke[k] = coarse.sampleField(x, y, S_FIELD);
+
+						const bool edge = a == 0 || b == 0 || a == fine.numX - 1 || b == n - 1;
+						const bool inside = solidAt ? solidAt(x, y) : coarse.solid[std::min(i, r.i1 - 1) * cn + std::min(j, r.j1 - 1)] == 0.0f;
+						fine.solid[k] = edge || inside ? 0.0f : 1.0f;
+					}
+				}
+			});
+
+			// Obstacles are at rest: no flow through the faces of a fine solid cell.
+			fine.forColumns(1, fine.numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t a = begin; a < end; a++) {
+					for (std::size_t b = 1; b < n - 1; b++) {
+						if (fine.solid[a * n + b] != 0.0f)
+							continue;
+						fine.h_v[a * n + b] = fine.h_v[(a + 1) * n + b] = 0.0f;
+						fine.v_v[a * n + b] = fine.v_v[a * n + b + 1] = 0.0f;
+					}
+				}
+			});
+		}
+
+		// Copies the old patch's velocities, pressure and smoke into `fine` where both cover
+		// the same interior cells; the patches are aligned to the coarse grid, so fine cells
+		// coincide. The pressure is what a warm-started solve starts from.
+		void copyOverlap(Fluid& fine, const Region& r) const
+		{
+			const Fluid& old = *m_fine;
+			const std::size_t n = fine.numY;
+			const std::size_t on = old.numY;
+			const std::ptrdiff_t shiftX = static_cast<std::ptrdiff_t>(ratio * r.i0) - static_cast<std::ptrdiff_t>(ratio * region.i0);
+			const std::ptrdiff_t shiftY = static_cast<std::ptrdiff_t>(ratio * r.j0) - static_cast<std::ptrdiff_t>(ratio * region.j0);
+
+			fine.forColumns(1, fine.numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t a = begin; a < end; a++) {
+					const std::ptrdiff_t oa = static_cast<std::ptrdiff_t>(a) + shiftX;
+					if (oa < 1 || oa >= static_cast<std::ptrdiff_t>(old.numX) - 1)
+						continue;
+
+					for (std::size_t b = 1; b < n - 1; b++) {
+						const std::ptrdiff_t ob = static_cast<std::ptrdiff_t>(b) + shiftY;
+						if (ob < 1 || ob >= static_cast<std::ptrdiff_t>(on) - 1)
+							continue;
+
+						const std::size_t k = a * n + b;
+						const std::size_t ok = static_cast<std::size_t>(oa) * on + static_cast<std::size_t>(ob);
+						fine.h_v[k] = old.h_v[ok];
+						fine.v_v[k] = old.v_v[ok];
+						fine.pressure[k] = old.pressure[ok];
+						fine.smoke[k] = old.smoke[ok];
+					}
+				}
+			});
+		}
+
+		// Samples the coarse fields into the ghost frame, sets the edge faces to the coarse
+		// faces they lie on and balances the net flux through the open ones.
+		void setEdge()
+		{
+			const Fluid& coarse = m_coarse;
+			Fluid& fine = *m_fine;
+			const Region& r = region;
+			const std::size_t n = fine.numY;
+			const std::size_t cn = coarse.numY;
+			const std::size_t lastX = fine.numX - 1;
+			const float hf = fine.h;
+			const float ox = originX(r);
+			const float oy = originY(r);
+
+			auto ghost = [&](const std::size_t a, const std::size_t b) {
+				const std::size_t k = a * n + b;
+				fine.h_v[k] = coarse.sampleField(ox + a * hf, oy + (b + 0.5f) * hf, H_FIELD);
+				fine.v_v[k] = coarse.sampleField(ox + (a + 0.5f) * hf, oy + b * hf, V_FIELD);
+				fine.smoke[k] = coarse.sampleField(ox + (a + 0.5f) * hf, oy + (b + 0.5f) * hf, S_FIELD);
+			};
+
+			for (std::size_t b = 0; b < n; b++) {
+				ghost(0, b);
+				ghost(lastX, b);
+			}
+			for (std::size_t a = 1; a < lastX; a++) {
+				ghost(a, 0);
+				ghost(a, n - 1);
+			}
+
+			for (std::size_t b = 1; b < n - 1; b++) {
+				const std::size_t j = r.j0 + (b - 1) / ratio;
+				fine.h_v[1 * n + b] = coarse.h_v[r.i0 * cn + j];
+				fine.h_v[lastX * n + b] = coarse.h_v[r.i1 * cn + j];
+			}
+			for (std::size_t a = 1; a < lastX; a++) {
+				const std::size_t i = r.i0 + (a - 1) / ratio;
+				fine.v_v[a * n + 1] = coarse.v_v[i * cn + r.j0];
+				fine.v_v[a * n + n - 1] = coarse.v_v[i * cn + r.j1];
+			}
+
+			// Calls fn(velocity, sign) for the edge faces between two fluid coarse cells, with
+			// sign * velocity the flux into the patch. Faces on walls and inlets stay as they are.
+			auto openFaces = [&](auto&& fn) {
+				auto open = [&](const std::size_t i0, const std::size_t j0, const std::size_t i1, const std::size_t j1) {
+					return coarse.solid[i0 * cn + j0] != 0.0f && coarse.solid[i1 * cn + j1] != 0.0f;
+				};
+
+				for (std::size_t b = 1; b < n - 1; b++) {
+					const std::size_t j = r.j0 + (b - 1) / ratio;
+					if (open(r.i0 - 1, j, r.i0, j))
+						fn(fine.h_v[1 * n + b], 1.0f);
+					if (open(r.i1 - 1, j, r.i1, j))
+						fn(fine.h_v[lastX * n + b], -1.0f);
+				}
+				for (std::size_t a = 1; a < lastX; a++) {
+					const std::size_t i = r.i0 + (a - 1) / ratio;
+					if (open(i, r.j0 - 1, i, r.j0))
+						fn(fine.v_v[a * n + 1], 1.0f);
+					if (open(i, r.j1 - 1, i, r.j1))
+						fn(fine.v_v[a * n + n - 1], -1.0f);
+				}
+			};
+
+			double inflow = 0.0;
+			std::size_t numOpen = 0;
+			openFaces([&](const float velocity, const float sign) {
+				inflow += sign * velocity;
+				numOpen++;
+			});
+
+			if (numOpen == 0)
+				return;
+
+			const float excess = static_cast<float>(inflow / numOpen);
+			openFaces([&](float& velocity, const float sign) {
+				velocity -= sign * excess;
+			});
+		}
+
+		// Averages the patch onto the coarse faces and cells it covers; the coarse faces on
+		// the edge keep their own values, advected since the patch edge copied them, and the
+		// next coarse solve absorbs the difference. The patch pressure is only
+		// defined up to a constant, so it is shifted to the mean coarse pressure it replaces.
+		void restrict()
+		{
+			Fluid& coarse = m_coarse;
+			const Fluid& fine = *m_fine;
+			const Region& r = region;
+			const std::size_t n = fine.numY;
+			const std::size_t cn = coarse.numY;
+
+			double coarseSum = 0.0, fineSum = 0.0;
+			for (std::size_t i = r.i0; i < r.i1; i++) {
+				for (std::size_t j = r.j0; j < r.j1; j++)
+					coarseSum += coarse.pressure[i * cn + j];
+			}
+			for (std::size_t a = 1; a < fine.numX - 1; a++) {
+				for (std::size_t b = 1; b < n - 1; b++)
+					fineSum += fine.pressure[a * n + b];
+			}
+			const float shift = static_cast<float>((coarseSum - 0.25 * fineSum) / ((r.i1 - r.i0) * (r.j1 - r.j0)));
+
+			coarse.forColumns(r.i0, r.i1, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const std::size_t a = 1 + ratio * (i - r.i0);
+					for (std::size_t j = r.j0; j < r.j1; j++) {
+						const std::size_t b = 1 + ratio * (j - r.j0);
+						const std::size_t k = a * n + b;
+						const std::size_t ck = i * cn + j;
+
+						if (i > r.i0)
+							coarse.h_v[ck] = 0.5f * (fine.h_v[k] + fine.h_v[k + 1]);
+						if (j > r.j0)
+							coarse.v_v[ck] = 0.5f * (fine.v_v[k] + fine.v_v[k + n]);
+
+						coarse.pressure[ck] = shift + 0.25f * (fine.pressure[k] + fine.pressure[k + 1] + fine.pressure[k + n] + fine.pressure[k + n + 1]);
+						coarse.setSmoke(i, j, 0.25f * (fine.smoke[k] + fine.smoke[k + 1] + fine.smoke[k + n] + fine.smoke[k + n + 1]));
+					}
+				}
+			});
+		}
+
+		Fluid& m_coarse;
+		std::unique_ptr<Fluid> m_fine;
+		std::size_t m_step = 0;
+	};
+
+}
@@ -2,17 +2,53 @@
 
 #include "core/scene.h"
 #include "fluid_sims.h"
+#include "fluid_checkpoint.h"
+#include "fluid_output.h"
+#include "fluid_diagnostics.h"
+#include "fluid_flip.h"
+#include "fluid_lod.h"
+#include "fluid_obstacles.h"
+#include "fluid_streamlines.h"
+#include "fluid_tracers.h"
+
+#include <memory>
+#include <string>
 
 
 struct Scene : public ge::NewScene
 {
-  bool drawPressure = false;
+  // Colours the cells by one of DiagnosticFields' fields.
+  bool drawField = false;
+  int drawnField = FluidSims::DiagnosticFields::PRESSURE;
   bool drawSmoke = true;
   bool drawStreamlines = false;
+  bool drawTracers = false;
+  bool fusedStep = false;
+  bool warmStartSolver = false;
+  float solverTolerance = 1.0f;
+  bool spectralSolver = true;
+
+  // Smoke grid cells per velocity cell along each axis; 1 keeps the smoke on the velocity
+  // grid, higher values are opt-in through the "Smoke detail" slider.
+  int smokeRefinement = 1;
+
+  // Carries velocity on FLIP particles instead of advecting it on the grid.
+  bool flipParticles = false;
+
+  // Wind tunnel outlet: a wall with a convective outflow condition instead of an open last
+  // column, which reflects less of the wake back upstream.
+  bool convectiveOutflow = false;
+
+  // Relative amplitude of the wind tunnel's inflow pulsation, one period per second.
+  float inflowPulse = 0.0f;
+
+  // Strength of the force that keeps small eddies from dissipating (0: off).
+  float vorticityConfinement = 0.0f;
 
   std::size_t iterations = 100;
 
   float overRelaxation = 1.0f;
+  bool autoOverRelaxation = false;
 
   float dt = 1.0f / 60;
 
@@ -22,23 +58,63 @@ struct Scene : public ge::NewScene
 
   std::size_t frameCount = 0;
 
+  std::shared_ptr<FluidSims::FieldArena> field_arena = std::make_shared<FluidSims::FieldArena>();
+  // Not pinned: worker 0 is this thread, which also runs the window, GL and ImGui.
+  std::shared_ptr<FluidSims::ThreadPool> thread_pool = std::make_shared<FluidSims::ThreadPool>(0, false);
   std::shared_ptr<FluidSims::Fluid> fluid = nullptr;
+  std::shared_ptr<FluidSims::OverRelaxationTable> omega_table = std::make_shared<FluidSims::OverRelaxationTable>("fluid_omega.txt");
+  std::unique_ptr<FluidSims::FlipSolver> flip_solver;
+  std::unique_ptr<FluidSims::TracerSystem> tracer_system;
+  std::unique_ptr<FluidSims::StreamlineTracer> streamline_tracer;
 
   FluidSims::RigidBody obstacle{ FluidSims::RigidBody::none, { 0.0f, 0.0f}, { 0.0f, 0.0f }, 1.0f, { 10.0f, 10.0f} };
 
   glm::vec2 obstacle_new_pos{ 0.0f, 0.0f };
+
+  // Cross-section for RigidBody::shape, loaded from obstacle_path (PGM or SDF) when first
+  // selected; obstacle.radius is its half height in cells.
+  std::string obstacle_path = "obstacle.pgm";
+  FluidSims::ObstacleShape obstacle_shape;
   FluidSims::RigidBody::type_t obstacle_new_type = FluidSims::RigidBody::none;
 
+  std::string checkpoint_path = "fluid.ckpt";
+  bool compress_checkpoints = false;
+
+  bool recordFields = false;
+  std::string record_path = "fluid_fields.bin";
+  std::unique_ptr<FluidSims::FieldStreamWriter> field_recorder;
+
+  FluidSims::FlowDiagnostics diagnostics;
+  std::unique_ptr<FluidSims::DiagnosticFields> diagnostic_fields;
+
+  // Drag and lift integrate the pressure, which the solver then has to keep.
+  bool measureForces = false;
+
   bool shouldReset = false;
   bool lastShouldReset = false;
 
   std::vector<float> points;
   std::vector<float> lines;
+  std::vector<float> tracer_points;
+
+  // Draws the field from a coarser level of detail where its quads would be smaller than
+  // a pixel; see draw_field_lod().
+  bool fieldLod = true;
+  std::vector<float> lod_smoke;
+  FluidSims::FieldPyramid smoke_pyramid;
+  FluidSims::FieldPyramid field_pyramid;
+  FluidSims::FieldPyramid dye_pyramids[3];
 
   entt::entity drawable_points_entt = entt::null;
   entt::entity drawable_lines_entt = entt::null;
+  entt::entity drawable_tracers_entt = entt::null;
   entt::entity obstacle_entt = entt::null;
 
+  // One sprite per textured obstacle shape, indexed by RigidBody::type_t and loaded once in
+  // on_create; obstacle_entt is the one showing and the others are scaled to zero, so
+  // moving the obstacle never touches a texture.
+  entt::entity obstacle_sprites[FluidSims::RigidBody::shape] = { entt::null, entt::null, entt::null, entt::null };
+
   ge::SmartPtr<ge::Window> m_window;
 
   glm::vec2 size_multiplier = { 1.0f, 1.0f };
@@ -67,6 +143,20 @@ struct Scene : public ge::NewScene
     return !(has_neg && has_pos);
   }
 
+  // Paints a cell in this frame's colour: as a smoke value for the colour map and, when
+  // the fluid carries RGB dye channels, as that colour in the dye.
+  void paint_cell(const std::size_t i, const std::size_t j)
+  {
+    const float value = 0.5f + 0.5f * std::sin(0.1f * frameCount);
+    fluid->setSmoke(i, j, value);
+
+    if (fluid->numScalars >= 3) {
+      const glm::vec3 color = getSciColor(value, 0.0f, 1.0f);
+      for (std::size_t c = 0; c < 3; c++)
+        fluid->scalars[c][i * fluid->numY + j] = color[c];
+    }
+  }
+
   void setObstacleNone()
   {
     const std::size_t n = fluid->numY;
@@ -123,9 +213,9 @@ struct Scene : public ge::NewScene
         if (PointInTriangle(posIJ, point1, point2, point3)) {
           fluid->solid[i * n + j] = 0.0f;
           if (scene_type == FluidSims::scene_type_t::paint)
-            fluid->smoke[i * n + j] = 0.5f + 0.5f * std::sin(0.1f * frameCount);
+            paint_cell(i, j);
           else
-            fluid->smoke[i * n + j] = 1.0f;
+            fluid->setSmoke(i, j, 1.0f);
 
           fluid->h_v[i * n + j] = vx;
           fluid->h_v[(i + 1) * n + j] = vx;
@@ -134,12 +224,6 @@ struct Scene : public ge::NewScene
         }
       }
     }
-
-    if (registry->valid(obstacle_entt))
-    {
-      ge::SpriteComponent& sprite = registry->get<ge::SpriteComponent>(obstacle_entt);
-      sprite.texture.load("d:\\dev\\VS\\VSProjects\\GameEngine\\GameEngine\\GameEngine\\src\\render\\opengl\\shaders\\images\\triangle.png");
-    }
   }
 
   void setObstacleCircle(float x, float y, bool reset)
@@ -170,9 +254,9 @@ struct Scene : public ge::NewScene
         if (dist < r * r) {
           fluid->solid[i * n + j] = 0.0f;
           if (scene_type == FluidSims::scene_type_t::paint)
-            fluid->smoke[i * n + j] = 0.5f + 0.5f * std::sin(0.1f * frameCount);
+            paint_cell(i, j);
           else
-            fluid->smoke[i * n + j] = 1.0f;
+            fluid->setSmoke(i, j, 1.0f);
 
           fluid->h_v[i * n + j] = vx;
           fluid->h_v[(i + 1) * n + j] = vx;
@@ -181,12 +265,6 @@ struct Scene : public ge::NewScene
         }
       }
     }
-
-    if (registry->valid(obstacle_entt))
-    {
-      ge::SpriteComponent& sprite = registry->get<ge::SpriteComponent>(obstacle_entt);
-      sprite.texture.load("d:\\dev\\VS\\VSProjects\\GameEngine\\GameEngine\\GameEngine\\src\\render\\opengl\\shaders\\images\\circle.png");
-    }
   }
 
   void setObstacleSquare(float x, float y, bool reset)
@@ -220,9 +298,9 @@ struct Scene : public ge::NewScene
         {
           fluid->solid[i * n + j] = 0.0f;
           if (scene_type == FluidSims::scene_type_t::paint)
-            fluid->smoke[i * n + j] = 0.5f + 0.5f * std::sin(0.1f * frameCount);
+            paint_cell(i, j);
           else
-            fluid->smoke[i * n + j] = 1.0f;
+            fluid->setSmoke(i, j, 1.0f);
 
           fluid->h_v[i * n + j] = vx;
           fluid->h_v[(i + 1) * n + j] = vx;
@@ -231,16 +309,69 @@ struct Scene : public ge::NewScene
         }
       }
     }
+  }
 
-    if (registry->valid(obstacle_entt))
-    {
-      ge::SpriteComponent& sprite = registry->get<ge::SpriteComponent>(obstacle_entt);
-      sprite.texture.load("d:\\dev\\VS\\VSProjects\\GameEngine\\GameEngine\\GameEngine\\src\\render\\opengl\\shaders\\images\\square.png");
+  void setObstacleShape(float x, float y, bool reset)
+  {
+    float vx = 0.0f;
+    float vy = 0.0f;
+
+    if (!reset) {
+      vx = (x - obstacle.pos.x) / dt * 2.0f;
+      vy = (y - obstacle.pos.y) / dt * 2.0f;
     }
+
+    obstacle.pos.x = x;
+    obstacle.pos.y = y;
+    std::size_t n = fluid->numY;
+
+    // The image keeps its aspect ratio; its footprint is cached per size.
+    const std::size_t height = std::max<std::size_t>(1, static_cast<std::size_t>(2.0f * obstacle.radius));
+    const std::size_t width = std::max<std::size_t>(1, height * obstacle_shape.width() / std::max<std::size_t>(1, obstacle_shape.height()));
+    const FluidSims::ObstacleFootprint& footprint = obstacle_shape.footprint(width, height, fluid->pool.get());
+
+    const long left = std::lround(x * fluid->numX - 0.5f * width);
+    const long bottom = std::lround(y * fluid->numY - 0.5f * height);
+
+    for (std::size_t i = 1; i < fluid->numX - 2; i++) {
+      for (std::size_t j = 1; j < fluid->numY - 2; j++) {
+
+        fluid->solid[i * n + j] = 1.0f;
+
+        const long a = static_cast<long>(i) - left;
+        const long b = static_cast<long>(j) - bottom;
+        if (a < 0 || b < 0 || a >= static_cast<long>(width) || b >= static_cast<long>(height) || !footprint.inside[a * height + b])
+          continue;
+
+        fluid->solid[i * n + j] = 0.0f;
+        if (scene_type == FluidSims::scene_type_t::paint)
+          paint_cell(i, j);
+        else
+          fluid->setSmoke(i, j, 1.0f);
+
+        fluid->h_v[i * n + j] = vx;
+        fluid->h_v[(i + 1) * n + j] = vx;
+        fluid->v_v[i * n + j] = vy;
+        fluid->v_v[i * n + j + 1] = vy;
+      }
+    }
+  }
+
+  void show_obstacle_sprite(const FluidSims::RigidBody::type_t type)
+  {
+    const entt::entity sprite = type < FluidSims::RigidBody::shape ? obstacle_sprites[type] : entt::null;
+    if (sprite == obstacle_entt)
+      return;
+
+    if (registry->valid(obstacle_entt))
+      registry->get<ge::TransformComponent>(obstacle_entt).scale = { 0.0f, 0.0f, 0.0f };
+    obstacle_entt = sprite;
   }
 
   void setObstacle(float x, float y, bool reset) {
 
+    show_obstacle_sprite(obstacle.type);
+
     if (obstacle.type == FluidSims::RigidBody::circle)
     {
       setObstacleCircle(x, y, reset);
@@ -253,6 +384,10 @@ struct Scene : public ge::NewScene
     {
       setObstacleTriangle(x, y, reset);
     }
+    else if (obstacle.type == FluidSims::RigidBody::shape)
+    {
+      setObstacleShape(x, y, reset);
+    }
     else if (obstacle.type == FluidSims::RigidBody::none)
     {
       setObstacleNone();
@@ -309,7 +444,7 @@ struct Scene : public ge::NewScene
         fluid->h_v[i * n + j] = 0.0f;
         fluid->v_v[i * n + j] = 0.0f;
 
-        fluid->smoke[i * n + j] = 1.0f;
+        fluid->setSmoke(i, j, 1.0f);
 
         fluid->pressure[i * n + j] = 0.0f;
 
@@ -327,7 +462,7 @@ struct Scene : public ge::NewScene
     gravity = { 0.0f, 0.0f };
     iterations = 100;
 
-    drawPressure = false;
+    drawField = false;
     drawSmoke = true;
     drawStreamlines = false;
 
@@ -337,7 +472,7 @@ struct Scene : public ge::NewScene
     for (std::size_t i = 0; i < fluid->numX; i++) {
       for (std::size_t j = 0; j < fluid->numY; j++) {
         float solid = 1.0f;	// fluid
-        if (i == 0 || j == 0 || j == fluid->numY - 1)
+        if (i == 0 || j == 0 || j == fluid->numY - 1 || (convectiveOutflow && i == fluid->numX - 1))
           solid = 0.0;	// solid
         fluid->solid[i * n + j] = solid;
 
@@ -348,7 +483,7 @@ struct Scene : public ge::NewScene
           fluid->h_v[i * n + j] = 0.0f;
         }
 
-        fluid->smoke[i * n + j] = 1.0f;
+        fluid->setSmoke(i, j, 1.0f);
       }
     }
 
@@ -357,7 +492,20 @@ struct Scene : public ge::NewScene
     std::size_t maxJ = std::floor(0.5f * fluid->numY + 0.5f * pipeH);
 
     for (std::size_t j = minJ; j < maxJ; j++)
-      fluid->smoke[0 * n + j] = 0.0f;
+      fluid->setSmoke(0, j, 0.0f);
+
+    fluid->inflow.enabled = true;
+    fluid->inflow.speed = inVel;
+    fluid->inflow.pulse = inflowPulse;
+    fluid->convectiveOutflow = convectiveOutflow;
+
+    // Tracers enter with the smoke, along the first fluid column.
+    FluidSims::TracerSystem::Emitter inlet;
+    inlet.x0 = inlet.x1 = 1.5f * fluid->h;
+    inlet.y0 = minJ * fluid->h;
+    inlet.y1 = maxJ * fluid->h;
+    inlet.rate = 20000.0f;
+    tracer_system->emitters.push_back(inlet);
 
     obstacle.radius = 15.0f;
     obstacle.speed = { 0.0f, 0.0f };
@@ -374,7 +522,7 @@ struct Scene : public ge::NewScene
     gravity = { 0.0f, 0.0f };
     iterations = 40;
 
-    drawPressure = false;
+    drawField = false;
     drawSmoke = true;
     drawStreamlines = false;
 
@@ -383,6 +531,11 @@ struct Scene : public ge::NewScene
     obstacle.size = { 10.0f, 10.0f };
     obstacle.type = obstacle_type;
 
+    // The dye starts out in the colour the colour map gives the initial smoke.
+    const glm::vec3 background = getSciColor(1.0f, 0.0f, 1.0f);
+    for (std::size_t c = 0; c < fluid->numScalars && c < 3; c++)
+      fluid->scalars[c].fill(background[c]);
+
     setObstacle(0.4f, 0.5f, true);
   }
 
@@ -390,7 +543,16 @@ struct Scene : public ge::NewScene
   {
     scene_type = type;
 
+    // Paint carries RGB dye, mixed by advection instead of mapping one scalar to colours.
+    fluid->setScalarChannels(type == FluidSims::scene_type_t::paint ? 3 : 0);
+
     clear_field();
+    fluid->inflow = {};
+    fluid->convectiveOutflow = false;
+    flip_solver->reset();
+    tracer_system->emitters.clear();
+    tracer_system->clear();
+    diagnostic_fields->invalidate();
 
     obstacle_new_type = obstacle_type;
 
@@ -401,6 +563,69 @@ struct Scene : public ge::NewScene
       setup_paint(obstacle_type);
   }
 
+  bool save_checkpoint(const std::string& path)
+  {
+    FluidSims::SceneState state;
+    state.sceneType = static_cast<std::uint32_t>(scene_type);
+    state.obstacleType = static_cast<std::uint32_t>(obstacle.type);
+    state.obstaclePos[0] = obstacle.pos.x;
+    state.obstaclePos[1] = obstacle.pos.y;
+    state.obstacleSpeed[0] = obstacle.speed.x;
+    state.obstacleSpeed[1] = obstacle.speed.y;
+    state.obstacleRadius = obstacle.radius;
+    state.obstacleSize[0] = obstacle.size.x;
+    state.obstacleSize[1] = obstacle.size.y;
+    state.dt = dt;
+    state.gravity[0] = gravity.x;
+    state.gravity[1] = gravity.y;
+    state.overRelaxation = overRelaxation;
+    state.iterations = iterations;
+    state.frameCount = frameCount;
+
+    return FluidSims::saveCheckpoint(path.c_str(), *fluid, state, compress_checkpoints);
+  }
+
+  bool load_checkpoint(const std::string& path)
+  {
+    FluidSims::SceneState state;
+    if (!FluidSims::loadCheckpoint(path.c_str(), *fluid, state))
+      return false;
+
+    scene_type = static_cast<FluidSims::scene_type_t>(state.sceneType);
+    obstacle.type = static_cast<FluidSims::RigidBody::type_t>(state.obstacleType);
+    obstacle.pos = { state.obstaclePos[0], state.obstaclePos[1] };
+    obstacle.speed = { state.obstacleSpeed[0], state.obstacleSpeed[1] };
+    obstacle.radius = state.obstacleRadius;
+    obstacle.size = { state.obstacleSize[0], state.obstacleSize[1] };
+    dt = state.dt;
+    gravity = { state.gravity[0], state.gravity[1] };
+    overRelaxation = state.overRelaxation;
+    iterations = state.iterations;
+    frameCount = state.frameCount;
+    smokeRefinement = static_cast<int>(fluid->smokeRefinement);
+
+    if (obstacle.type == FluidSims::RigidBody::shape && !load_obstacle_shape())
+      obstacle.type = FluidSims::RigidBody::none;
+
+    obstacle_new_type = obstacle.type;
+    obstacle_new_pos = obstacle.pos;
+
+    // Particles are not checkpointed; they reseed from the restored grid velocity.
+    flip_solver->reset();
+    diagnostic_fields->invalidate();
+
+    // Re-rasterizes the same mask and moves the sprite to the restored obstacle.
+    setObstacle(obstacle.pos.x, obstacle.pos.y, true);
+
+    return true;
+  }
+
+  // Loads obstacle_path once; later calls reuse the shape and its cached footprints.
+  bool load_obstacle_shape()
+  {
+    return !obstacle_shape.empty() || obstacle_shape.load(obstacle_path.c_str());
+  }
+
   void processInput(GLFWwindow* window)
   {
     obstacle_new_pos = obstacle.pos;
@@ -468,7 +693,19 @@ struct Scene : public ge::NewScene
     float field_width = 220;
     float field_height = 100;
 
-    fluid = std::make_shared<FluidSims::Fluid>(new FluidSims::IntegratorEuler(), 1000.0f, field_width, field_height, 1.0f / field_height);
+    fluid = std::make_shared<FluidSims::Fluid>(new FluidSims::IntegratorEuler(), 1000.0f, field_width, field_height, 1.0f / field_height, field_arena, thread_pool);
+    fluid->overRelaxationTable = omega_table;
+    fluid->setSmokeRefinement(smokeRefinement);
+    flip_solver = std::make_unique<FluidSims::FlipSolver>(*fluid);
+    tracer_system = std::make_unique<FluidSims::TracerSystem>(*fluid);
+    streamline_tracer = std::make_unique<FluidSims::StreamlineTracer>(*fluid);
+
+    // Probe in the wake, for the shedding frequency.
+    diagnostics.addProbe(0.6f * fluid->numX * fluid->h, 0.5f * fluid->numY * fluid->h);
+    fluid->observers.push_back(&diagnostics);
+
+    diagnostic_fields = std::make_unique<FluidSims::DiagnosticFields>(*fluid);
+    fluid->observers.push_back(diagnostic_fields.get());
 
     setup_scene(FluidSims::scene_type_t::wind_tunnel, FluidSims::RigidBody::circle);
 
@@ -485,18 +722,34 @@ struct Scene : public ge::NewScene
     drawable_lines_entt = registry->create();
     registry->emplace<ge::NewDrawable>(drawable_lines_entt);
 
-    obstacle_entt = registry->create();
-    ge::SpriteComponent& sprite = registry->emplace<ge::SpriteComponent>(obstacle_entt);
-
-    sprite.texture.load("d:\\dev\\VS\\VSProjects\\GameEngine\\GameEngine\\GameEngine\\src\\render\\opengl\\shaders\\images\\circle.png");
+    drawable_tracers_entt = registry->create();
+    registry->emplace<ge::NewDrawable>(drawable_tracers_entt);
 
-    ge::TransformComponent transform;
-    transform.translation = { 0.0f, 0.0f, 0.0f };
-    transform.rotation_angle = 0.0f;
-    transform.rotation_axes = { 0.0f, 0.0f, 1.0f };
-    transform.scale = { m_window->width() * 0.15f, m_window->width() * 0.15f, 1.0f };
+    const std::string images = "d:\\dev\\VS\\VSProjects\\GameEngine\\GameEngine\\GameEngine\\src\\render\\opengl\\shaders\\images\\";
+    const std::pair<FluidSims::RigidBody::type_t, const char*> sprites[] = {
+      { FluidSims::RigidBody::circle, "circle.png" },
+      { FluidSims::RigidBody::square, "square.png" },
+      { FluidSims::RigidBody::triangle, "triangle.png" }
+    };
 
-    registry->emplace<ge::TransformComponent>(obstacle_entt, transform);
+    for (const std::pair<FluidSims::RigidBody::type_t, const char*>& entry : sprites)
+    {
+      const entt::entity entity = registry->create();
+      ge::SpriteComponent& sprite = registry->emplace<ge::SpriteComponent>(entity);
+      sprite.texture.load(images + entry.second);
+
+      ge::TransformComponent transform;
+      transform.translation = { 0.0f, 0.0f, 0.0f };
+      transform.rotation_angle = 0.0f;
+      transform.rotation_axes = { 0.0f, 0.0f, 1.0f };
+      transform.scale = { 0.0f, 0.0f, 0.0f };
+      if (entry.first == obstacle.type)
+        transform.scale = { m_window->width() * 0.15f, m_window->width() * 0.15f, 1.0f };
+
+      registry->emplace<ge::TransformComponent>(entity, transform);
+      obstacle_sprites[entry.first] = entity;
+    }
+    obstacle_entt = obstacle_sprites[obstacle.type];
   }
 
   void on_update(const double dt) override
@@ -507,14 +760,23 @@ struct Scene : public ge::NewScene
     processInput(m_window->native());
 
     points.clear();
-    lines.clear();
+    tracer_points.clear();
 
     draw_field_to_vector(points, size_multiplier);
 
+    // The tracer keeps the buffer at a fixed size and overwrites it in place.
     if (this->drawStreamlines)
     {
-      draw_streamlines_to_vector(*fluid, lines, size_multiplier.x, 5, 0.02f);
+      FluidSims::StreamlineTracer::LineStyle style;
+      style.scale = size_multiplier.x / fluid->h;
+      style.offsetX = -static_cast<float>(fluid->numX / 2 + 1) * size_multiplier.x;
+      style.offsetY = -static_cast<float>(fluid->numY / 2 + 10) * size_multiplier.x;
+      style.z = -65.0f;
+      style.colour[0] = style.colour[1] = style.colour[2] = 0.1f;
+      streamline_tracer->trace(style, lines);
     }
+    else
+      lines.clear();
 
     if (this->obstacle.pos != this->obstacle_new_pos || this->obstacle.type != this->obstacle_new_type || this->shouldReset != this->lastShouldReset)
     {
@@ -524,7 +786,42 @@ struct Scene : public ge::NewScene
     }
 
 
-    fluid->simulate(this->dt, this->gravity.y, this->iterations);
+    fluid->fused = this->fusedStep;
+    fluid->warmStart = this->warmStartSolver;
+    fluid->tolerance = this->solverTolerance;
+    fluid->vorticityConfinement = this->vorticityConfinement;
+    fluid->inflow.pulse = this->inflowPulse;
+    fluid->autoOverRelaxation = this->autoOverRelaxation;
+    // The field recorder writes the pressure plane by default.
+    fluid->trackPressure = (this->drawField && this->drawnField == FluidSims::DiagnosticFields::PRESSURE) ||
+      this->measureForces || this->recordFields;
+    if (!this->autoOverRelaxation)
+      fluid->overRelaxation = this->overRelaxation;
+    // Without an obstacle the domain is a plain box with an exact direct solver.
+    fluid->spectral = this->spectralSolver && this->obstacle.type == FluidSims::RigidBody::none;
+    if (this->flipParticles)
+      this->flip_solver->simulate(this->dt, this->gravity.y, this->iterations);
+    else {
+      this->flip_solver->reset();
+      fluid->simulate(this->dt, this->gravity.y, this->iterations);
+    }
+
+    // Tracers only run while shown, so turning them on starts fresh pathlines.
+    if (this->drawTracers)
+    {
+      this->tracer_system->step(this->dt);
+      draw_tracers_to_vector(*this->tracer_system, tracer_points, size_multiplier.x);
+    }
+    else
+      this->tracer_system->clear();
+
+    if (this->recordFields && !this->field_recorder)
+      this->field_recorder = std::make_unique<FluidSims::FieldStreamWriter>(this->record_path.c_str(), *fluid);
+    else if (!this->recordFields)
+      this->field_recorder.reset();
+
+    if (this->field_recorder)
+      this->field_recorder->submit(*fluid, this->frameCount);
 
     this->frameCount++;
 
@@ -540,6 +837,11 @@ struct Scene : public ge::NewScene
     drawable_lines.m_count = drawable_lines.vertices.size() / 6;
     drawable_lines.mode = GL_LINES;
 
+    ge::NewDrawable& drawable_tracers = registry->get<ge::NewDrawable>(drawable_tracers_entt);
+    drawable_tracers.vertices = tracer_points;
+    drawable_tracers.m_count = drawable_tracers.vertices.size() / 6;
+    drawable_tracers.mode = GL_POINTS;
+
 
     ImGui::SetWindowFontScale(1.5f);
 
@@ -562,7 +864,7 @@ struct Scene : public ge::NewScene
 
     ImGui::Spacing();
 
-    const char* items[] = { "Circle", "Square", "Triangle", "None" };
+    const char* items[] = { "Circle", "Square", "Triangle", "None", "Imported" };
     static const char* current_item = items[0];
 
     if (ImGui::BeginCombo("Rigid body", current_item, ImGuiComboFlags_NoPreview))
@@ -585,6 +887,8 @@ struct Scene : public ge::NewScene
         this->obstacle_new_type = FluidSims::RigidBody::triangle;
       else if (current_item == items[3])
         this->obstacle_new_type = FluidSims::RigidBody::none;
+      else if (current_item == items[4])
+        this->obstacle_new_type = this->load_obstacle_shape() ? FluidSims::RigidBody::shape : FluidSims::RigidBody::none;
 
     }
     ImGui::EndGroup();
@@ -596,23 +900,84 @@ struct Scene : public ge::NewScene
     ImGui::SameLine();
 
     ImGui::BeginGroup();
-    ImGui::Checkbox("Draw pressure", &this->drawPressure);
+    ImGui::Checkbox("Draw field", &this->drawField);
+    if (this->drawField)
+    {
+      const char* fields[] = { "Pressure", "Vorticity", "Divergence", "Speed" };
+      ImGui::SameLine();
+      ImGui::Combo("##field", &this->drawnField, fields, IM_ARRAYSIZE(fields));
+    }
     ImGui::Checkbox("Draw smoke", &this->drawSmoke);
     ImGui::Checkbox("Draw streamlines", &this->drawStreamlines);
+    ImGui::Checkbox("Draw tracers", &this->drawTracers);
+    ImGui::Checkbox("Level of detail", &this->fieldLod);
+    ImGui::Checkbox("Fused step", &this->fusedStep);
+    ImGui::Checkbox("Warm-started solver", &this->warmStartSolver);
+    ImGui::SliderFloat("Tolerance", &this->solverTolerance, 0.0f, 10.0f);
+    ImGui::Checkbox("Spectral solver (no obstacle)", &this->spectralSolver);
+    ImGui::Checkbox("FLIP particles", &this->flipParticles);
+    ImGui::SliderFloat("Vorticity confinement", &this->vorticityConfinement, 0.0f, 1.0f);
+    if (ImGui::Checkbox("Convective outflow", &this->convectiveOutflow) && this->scene_type == FluidSims::scene_type_t::wind_tunnel)
+      this->setup_scene(this->scene_type, this->obstacle.type);
+    ImGui::SliderFloat("Inflow pulse", &this->inflowPulse, 0.0f, 0.5f);
+    if (ImGui::SliderInt("Smoke detail", &this->smokeRefinement, 1, 4))
+    {
+      this->fluid->setSmokeRefinement(this->smokeRefinement);
+      this->setup_scene(this->scene_type, this->obstacle.type);
+    }
+    ImGui::Checkbox("Auto over-relaxation", &this->autoOverRelaxation);
+    if (this->autoOverRelaxation) {
+      ImGui::SameLine();
+      if (ImGui::Button("Retune"))
+        this->fluid->retuneOverRelaxation(false);
+    }
+    else
+      ImGui::SliderFloat("Over-relaxation", &this->overRelaxation, 1.0f, 1.99f);
     ImGui::EndGroup();
 
+    ImGui::SameLine();
+    ImGui::Spacing();
+    ImGui::SameLine();
+
+    ImGui::BeginGroup();
+    if (ImGui::Button("Save", { 150.0f, 50.0f }))
+      this->save_checkpoint(this->checkpoint_path);
+    ImGui::SameLine();
+    if (ImGui::Button("Load", { 150.0f, 50.0f }))
+      this->load_checkpoint(this->checkpoint_path);
+    ImGui::Checkbox("Compress checkpoints", &this->compress_checkpoints);
+    ImGui::Checkbox("Record fields", &this->recordFields);
+    ImGui::Checkbox("Measure forces", &this->measureForces);
+    if (ImGui::Button("Export diagnostics", { 300.0f, 50.0f }))
+    {
+      this->diagnostics.writeStatsCsv("fluid_stats.csv");
+      this->diagnostics.writeProbesCsv("fluid_probes.csv");
+    }
+    ImGui::EndGroup();
+
+    if (this->diagnostics.stats.size() > 0)
+    {
+      const FluidSims::FlowStats& stats = this->diagnostics.stats[this->diagnostics.stats.size() - 1];
+      if (this->measureForces)
+        ImGui::Text("Drag %.3f  Lift %.3f  Max div %.2e  Energy %.3f", stats.drag, stats.lift, stats.maxDivergence, stats.kineticEnergy);
+      else
+        ImGui::Text("Max div %.2e  Energy %.3f", stats.maxDivergence, stats.kineticEnergy);
+    }
+    ImGui::Text("Solver %zu iterations  residual %.2e  omega %.3f", this->fluid->solveStats.iterations, this->fluid->solveStats.residual,
+      this->fluid->solveStats.omega);
+
   }
 
   void draw_field_to_vector(std::vector<float>& points, const glm::vec2 size_multiplier)
   {
-    const std::vector<float> pressure = fluid->pressure;
-    float minP = pressure[0];
-    float maxP = pressure[0];
-
-    for (float pressure : pressure)
+    // The field and its range are only computed when drawn, at most once per step.
+    const FluidSims::DiagnosticFields::field_t field = static_cast<FluidSims::DiagnosticFields::field_t>(this->drawnField);
+    const float* values = nullptr;
+    FluidSims::DiagnosticFields::Range range;
+    if (this->drawField)
     {
-      minP = std::min(minP, pressure);
-      maxP = std::max(maxP, pressure);
+      values = diagnostic_fields->field(field);
+      range = diagnostic_fields->range(field);
     }
 
     auto add_point_tri = [&points](const glm::vec3& location, const glm::vec3& color)
@@ -626,156 +991,188 @@ struct Scene : public ge::NewScene
       points.push_back(color[2]);
     };
 
-    for (std::size_t x = 0; x < fluid->numX / 1; ++x)
+    // Two triangles covering [x0, x1) x [y0, y1), in cells.
+    auto add_quad = [&](const float x0, const float y0, const float x1, const float y1, const glm::vec3& color)
     {
-      for (std::size_t y = 0; y < fluid->numY / 1; ++y)
-      {
-        glm::vec3 color;
-        float smoke = fluid->smoke[x * fluid->numY + y];
-        float pressure = fluid->pressure[x * fluid->numY + y];
-        float solid = fluid->solid[x * fluid->numY + y];
+      const float offset_x = fluid->numX / 2.0f + 1;
+      const float offset_y = fluid->numY / 2.0f + 10;
 
-        if (this->drawPressure)
-        {
-          color = getSciColor(pressure, minP, maxP);
-          if (this->drawSmoke)
-          {
-            color.r -= smoke;
-            color.g -= smoke;
-            color.b -= smoke;
-          }
+      const glm::vec3 location1 = { (x0 - offset_x) * size_multiplier.x, (y0 - offset_y) * size_multiplier.x, 0.0f };
+      const glm::vec3 location2 = { (x1 - offset_x) * size_multiplier.x, (y0 - offset_y) * size_multiplier.x, 0.0f };
+      const glm::vec3 location3 = { (x0 - offset_x) * size_multiplier.x, (y1 - offset_y) * size_multiplier.x, 0.0f };
+      const glm::vec3 location4 = { (x1 - offset_x) * size_multiplier.x, (y1 - offset_y) * size_multiplier.x, 0.0f };
 
+      add_point_tri(location1, color);
+      add_point_tri(location2, color);
+      add_point_tri(location3, color);
+
+      add_point_tri(location2, color);
+      add_point_tri(location3, color);
+      add_point_tri(location4, color);
+    };
+
+    // Smoke is drawn from the fine grid when there is one, k x k quads per cell; the dye
+    // channels of the paint scene live on the velocity grid.
+    const bool dye = this->scene_type == FluidSims::scene_type_t::paint && fluid->numScalars >= 3;
+    const std::size_t k = this->drawSmoke && !dye ? fluid->smokeRefinement : 1;
+    const std::size_t fine_n = fluid->fineSizeY();
+    const float quad = 1.0f / k;
+
+    auto color_of = [&](const float smoke, const float value, const glm::vec3& dye_color)
+    {
+      glm::vec3 color;
+      if (this->drawField)
+      {
+        color = getSciColor(value, range.min, range.max);
+        if (this->drawSmoke)
+        {
+          color.r -= smoke;
+          color.g -= smoke;
+          color.b -= smoke;
         }
-        else if (this->drawSmoke) {
-          color.r = smoke;
-          color.g = smoke;
-          color.b = smoke;
 
-          if (this->scene_type == FluidSims::scene_type_t::paint)
+      }
+      else if (this->drawSmoke) {
+        color.r = smoke;
+        color.g = smoke;
+        color.b = smoke;
+
+        if (this->scene_type == FluidSims::scene_type_t::paint) {
+          if (dye)
+            color = dye_color;
+          else
             color = getSciColor(smoke, 0.0, 1.0);
         }
-        else {
-          color.r = 0.0f;
-          color.g = 0.0f;
-          color.b = 0.0f;
-        }
-
-
-        //if (solid < 0.9f)
-        //{
-        //  if (this->scene_type == FluidSims::scene_type_t::paint)
-        //  {
-        //    color.r = 0.6f;
-        //    color.g = 0.6f;
-        //    color.b = 0.6f;
-        //  }
-        //  else {
-        //    color.r = 0.6f;
-        //    color.g = 0.6f;
-        //    color.b = 0.6f;
-        //  }
-        //}
-
-
-        glm::vec3 location1;
-        glm::vec3 location2;
-        glm::vec3 location3;
-        glm::vec3 location4;
-        location1 = {
-          x * 1.0f + 0.0f,
-          y * 1.0f + 0.0f,
-          0.0f * 1.0f + 00.0f
-        };
-
-        location2 = {
-          x * 1.0f + 1.0f,
-          y * 1.0f + 0.0f,
-          0.0f * 1.0f + 00.0f
-        };
-
-        location3 = {
-          x * 1.0f + 0.0f,
-          y * 1.0f + 1.0f,
-          0.0f * 1.0f + 00.0f
-        };
-
-        location4 = {
-          x * 1.0f + 1.0f,
-          y * 1.0f + 1.0f,
-          0.0f * 1.0f + 00.0f
-        };
-
-        location1.x -= fluid->numX / 2.0f + 1;
-        location1.y -= fluid->numY / 2.0f + 10;
-        location2.x -= fluid->numX / 2.0f + 1;
-        location2.y -= fluid->numY / 2.0f + 10;
-        location3.x -= fluid->numX / 2.0f + 1;
-        location3.y -= fluid->numY / 2.0f + 10;
-        location4.x -= fluid->numX / 2.0f + 1;
-        location4.y -= fluid->numY / 2.0f + 10;
-
-
-        location1.x *= size_multiplier.x;
-        location1.y *= size_multiplier.x;
-        location2.x *= size_multiplier.x;
-        location2.y *= size_multiplier.x;
-        location3.x *= size_multiplier.x;
-        location3.y *= size_multiplier.x;
-        location4.x *= size_multiplier.x;
-        location4.y *= size_multiplier.x;
-
-        add_point_tri(location1, color);
-        add_point_tri(location2, color);
-        add_point_tri(location3, color);
-
-        add_point_tri(location2, color);
-        add_point_tri(location3, color);
-        add_point_tri(location4, color);
       }
-    }
-  }
-
-  void draw_streamlines_to_vector(const FluidSims::Fluid& fluid, std::vector<float>& lines, const float size_multiplier, const std::size_t num_segs, const float seg_length)
-  {
-    auto add_point_lines = [&lines, size_multiplier](const glm::vec3& location, const glm::vec3& color)
-    {
-      lines.push_back(location.x * size_multiplier);
-      lines.push_back(location.y * size_multiplier);
-      lines.push_back(location.z);
+      else {
+        color.r = 0.0f;
+        color.g = 0.0f;
+        color.b = 0.0f;
+      }
 
-      lines.push_back(color[0]);
-      lines.push_back(color[1]);
-      lines.push_back(color[2]);
+      return color;
     };
 
-    //const float segLength = 1.0f;
-
-    for (std::size_t i = 1; i < fluid.numX - 1; i += 5) {
-      for (std::size_t j = 1; j < fluid.numY - 1; j += 5) {
+    // Quads smaller than a pixel only multiply the triangles; draw from a coarser level.
+    if (this->fieldLod && size_multiplier.x * quad < 1.0f)
+    {
+      draw_field_lod(size_multiplier.x, k, values, color_of, add_quad);
+      return;
+    }
 
-        float x = (i + 0.5f);
-        float y = (j + 0.5f);
+    for (std::size_t x = 0; x < fluid->numX / 1; ++x)
+    {
+      for (std::size_t y = 0; y < fluid->numY / 1; ++y)
+      {
+        const std::size_t cell = x * fluid->numY + y;
+        const float value = values ? values[cell] : 0.0f;
+        const glm::vec3 dye_color = dye ? glm::vec3{ fluid->scalars[0][cell], fluid->scalars[1][cell], fluid->scalars[2][cell] } : glm::vec3{};
 
-        for (std::size_t n = 0; n < num_segs; ++n)
+        for (std::size_t a = 0; a < k; ++a)
         {
-          add_point_lines({ x - fluid.numX / 2 - 1, y - fluid.numY / 2 - 10, -65.0f }, { 0.1f, 0.1f, 0.1f });
-          const float h_v = fluid.sampleField(x * fluid.h, y * fluid.h, FluidSims::H_FIELD);
-          const float v_v = fluid.sampleField(x * fluid.h, y * fluid.h, FluidSims::V_FIELD);
-          //const float l = std::sqrt(h_v * h_v + v_v * v_v);
-           //x += h_v / l * segLength;
-           //y += v_v / l * segLength;
-          x += h_v * seg_length / fluid.h;
-          y += v_v * seg_length / fluid.h;
+          for (std::size_t b = 0; b < k; ++b)
+          {
+            float smoke = k > 1 ? fluid->fineSmoke[(x * k + a) * fine_n + y * k + b] : fluid->smoke[cell];
+
+            //if (fluid->solid[cell] < 0.9f)
+            //{
+            //  if (this->scene_type == FluidSims::scene_type_t::paint)
+            //  {
+            //    color.r = 0.6f;
+            //    color.g = 0.6f;
+            //    color.b = 0.6f;
+            //  }
+            //  else {
+            //    color.r = 0.6f;
+            //    color.g = 0.6f;
+            //    color.b = 0.6f;
+            //  }
+            //}
+
+            add_quad(x + a * quad, y + b * quad, x + (a + 1) * quad, y + (b + 1) * quad, color_of(smoke, value, dye_color));
+          }
+        }
+      }
+    }
+  }
 
+  // draw_field_to_vector() for grids finer than the window, a cell being cell_pixels wide:
+  // the drawn planes are averaged to the first level whose texels, 2^level cells wide,
+  // cover at least a pixel, and one quad is drawn per texel. The fine smoke is averaged to
+  // cells first.
+  template<typename ColorOf, typename AddQuad>
+  void draw_field_lod(const float cell_pixels, const std::size_t k, const float* values, ColorOf&& color_of, AddQuad&& add_quad)
+  {
+    FluidSims::ThreadPool* pool = fluid->pool.get();
+    const std::size_t numX = fluid->numX;
+    const std::size_t numY = fluid->numY;
+    const bool dye = this->scene_type == FluidSims::scene_type_t::paint && fluid->numScalars >= 3;
 
-          add_point_lines({ x - fluid.numX / 2 - 1, y - fluid.numY / 2 - 10, -65.0f }, { 0.1f, 0.1f, 0.1f });
+    std::size_t last = 0;
+    while (static_cast<float>(std::size_t{ 1 } << last) * cell_pixels < 1.0f)
+      last++;
 
-          if (x > fluid.numX)
-            break;
-        }
+    const float* smoke = fluid->smoke.data();
+    if (k > 1)
+    {
+      lod_smoke.resize(numX * numY);
+      FluidSims::FieldPyramid::reduce(fluid->fineSmoke.data(), fluid->fineSizeX(), fluid->fineSizeY(), k, lod_smoke.data(), pool);
+      smoke = lod_smoke.data();
+    }
 
+    const bool need_smoke = this->drawSmoke;
+    const bool need_dye = this->drawSmoke && !this->drawField && dye;
+    if (need_smoke)
+      smoke_pyramid.build(smoke, numX, numY, last, pool);
+    if (values)
+      field_pyramid.build(values, numX, numY, last, pool);
+    if (need_dye)
+      for (std::size_t c = 0; c < 3; c++)
+        dye_pyramids[c].build(fluid->scalars[c].data(), numX, numY, last, pool);
+
+    const std::size_t span = std::size_t{ 1 } << last;
+    const std::size_t width = (numX + span - 1) / span;
+    const std::size_t height = (numY + span - 1) / span;
+
+    for (std::size_t a = 0; a < width; ++a)
+    {
+      for (std::size_t b = 0; b < height; ++b)
+      {
+        const std::size_t texel = a * height + b;
+        const float texel_smoke = need_smoke ? smoke_pyramid.level(last).values[texel] : 0.0f;
+        const float value = values ? field_pyramid.level(last).values[texel] : 0.0f;
+        glm::vec3 dye_color{};
+        if (need_dye)
+          dye_color = { dye_pyramids[0].level(last).values[texel], dye_pyramids[1].level(last).values[texel], dye_pyramids[2].level(last).values[texel] };
+
+        const float x0 = static_cast<float>(a * span);
+        const float y0 = static_cast<float>(b * span);
+        const float x1 = static_cast<float>(std::min((a + 1) * span, numX));
+        const float y1 = static_cast<float>(std::min((b + 1) * span, numY));
+        add_quad(x0, y0, x1, y1, color_of(texel_smoke, value, dye_color));
       }
     }
   }
 
+  // One point per tracer, coloured by age.
+  void draw_tracers_to_vector(const FluidSims::TracerSystem& tracers, std::vector<float>& points, const float size_multiplier)
+  {
+    const float h1 = 1.0f / fluid->h;
+    const std::size_t count = tracers.tracers.size();
+    points.resize(count * 6);
+
+    for (std::size_t k = 0; k < count; k++)
+    {
+      const glm::vec3 color = getSciColor(tracers.tracers.age[k], 0.0f, 2.0f);
+      float* point = points.data() + k * 6;
+
+      point[0] = (tracers.tracers.x[k] * h1 - fluid->numX / 2.0f - 1) * size_multiplier;
+      point[1] = (tracers.tracers.y[k] * h1 - fluid->numY / 2.0f - 10) * size_multiplier;
+      point[2] = -60.0f;
+      point[3] = color[0];
+      point[4] = color[1];
+      point[5] = color[2];
+    }
+  }
+
 };
\ No newline at end of file
@@ -2,6 +2,20 @@
 
 #include "glm/glm.hpp"
 
+#include "fluid_arena.h"
+#include "fluid_spectral.h"
+#include "fluid_storage.h"
+#include "fluid_threads.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 #include <memory>
 
@@ -19,277 +33,1713 @@ namespace FluidSims
 
 	float overRelaxation = 1.9;
 
-	class Fluid;
+	// Integer hash for cheap, reproducible jitter (particle seeding, emitters).
+	inline std::uint32_t hashBits(std::uint32_t value)
+	{
+		value ^= value >> 16;
+		value *= 0x7feb352du;
+		value ^= value >> 15;
+		value *= 0x846ca68bu;
+		value ^= value >> 16;
+		return value;
+	}
+
+	// Uniform in [0, 1) from the top 24 bits of a hash.
+	inline float unitFloat(const std::uint32_t bits)
+	{
+		return (bits >> 8) * (1.0f / 16777216.0f);
+	}
+
+	template<typename Real>
+	class BasicIntegrator
+	{
+	public:
+		virtual void integrate(Real& value, Real dt, const Real gravity) = 0;
+
+	};
+
+	using Integrator = BasicIntegrator<float>;
+
+	// Outcome of the last pressure solve.
+	struct SolveStats
+	{
+		std::size_t iterations = 0;
+		float residual = 0.0f;	// max |div u| over fluid cells before the last update, 1/s; 0 when not measured
+		bool converged = false;
+		float omega = 0.0f;	// over-relaxation factor used; 0 for the direct solver
+	};
+
+	// Tuned over-relaxation factors by interior grid size, shared by the fluids that use it
+	// and, given a path, kept in a text file of "numX numY omega" lines that is rewritten
+	// whenever store() changes a value.
+	class OverRelaxationTable
+	{
+	public:
+		OverRelaxationTable() = default;
+
+		// Loads `path` if it exists.
+		explicit OverRelaxationTable(std::string path)
+			: m_path(std::move(path))
+		{
+			load(m_path.c_str());
+		}
+
+		bool lookup(const std::size_t numX, const std::size_t numY, float& omega) const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto entry = m_values.find({ numX, numY });
+			if (entry == m_values.end())
+				return false;
+			omega = entry->second;
+			return true;
+		}
+
+		void store(const std::size_t numX, const std::size_t numY, const float omega)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				const auto entry = m_values.emplace(std::make_pair(numX, numY), omega);
+				if (!entry.second && entry.first->second == omega)
+					return;
+				entry.first->second = omega;
+			}
+			if (!m_path.empty())
+				save(m_path.c_str());
+		}
+
+		// Returns false on I/O failure. The file's values replace those already held; it is
+		// read without the lock, so lookups are not held up by the disk.
+		bool load(const char* path)
+		{
+			std::FILE* file = std::fopen(path, "r");
+			if (file == nullptr)
+				return false;
+
+			std::map<std::pair<std::size_t, std::size_t>, float> values;
+			unsigned long long numX = 0;
+			unsigned long long numY = 0;
+			float omega = 0.0f;
+			while (std::fscanf(file, "%llu %llu %f", &numX, &numY, &omega) == 3)
+				values[{ static_cast<std::size_t>(numX), static_cast<std::size_t>(numY) }] = omega;
+			const bool ok = std::fclose(file) == 0;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			values.insert(m_values.begin(), m_values.end());
+			m_values.swap(values);
+			return ok;
+		}
+
+		bool save(const char* path) const
+		{
+			std::FILE* file = std::fopen(path, "w");
+			if (file == nullptr)
+				return false;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (const auto& entry : m_values)
+				std::fprintf(file, "%zu %zu %.6f\n", entry.first.first, entry.first.second, entry.second);
+
+			return std::fclose(file) == 0;
+		}
+
+	private:
+		std::string m_path;
+		std::map<std::pair<std::size_t, std::size_t>, float> m_values;
+		mutable std::mutex m_mutex;
+	};
 
-	class Integrator
+	// In-situ analysis hook. Called once per step right after the pressure solve, while
+	// `pressure` holds this step's solution and the velocities are divergence free.
+	template<typename FluidT>
+	class BasicStepObserver
 	{
 	public:
-		virtual void integrate(float& value, float dt, const float gravity) = 0;
+		virtual void observe(FluidT& fluid, float dt) = 0;
 
 	};
 
-	class Fluid {
+	// Real is the type of the velocities, the solid mask and all arithmetic: float, or double
+	// for reference runs. SmokeT and PressureT are the storage types of the smoke and
+	// pressure planes: Real or one of the 16-bit types of fluid_storage.h, converted to Real
+	// on load. NX and NY, when non-zero, pin the interior grid size (see FixedFluid); a fluid
+	// of another size fails an assert. The kernels do not specialize on them: with the sizes
+	// as constants the "fixed" bench measured 0.92x to 1.06x of the runtime-sized step, i.e.
+	// no gain, so strides and bounds are read from numX and numY either way. Fluid is the
+	// all-float, runtime-sized instantiation, and the only one the checkpoint, output,
+	// diagnostics, domain and tiled helpers accept.
+	template<typename Real = float, typename SmokeT = Real, typename PressureT = Real, std::size_t NX = 0, std::size_t NY = 0>
+	class BasicFluid {
 	public:
 		//Canvas canvas;
 
-		float h = 0;
+		Real h = 0;
 		std::size_t numX = 0;
 		std::size_t numY = 0;
 		std::size_t numCells = 0;
 
-		float density;
+		// Global index of column 0 when this fluid is a column strip of a larger grid (see
+		// DomainSolver), 0 otherwise. Advection, sampleField() and stencilAt() work in global
+		// positions, so a strip computes and rounds its coordinates like the whole grid would.
+		std::size_t columnOrigin = 0;
+
+		Real density;
+
+		// All planes live in one block owned by `arena`.
+		FieldPlane<Real> h_v;
+		FieldPlane<Real> newH_v;
+		FieldPlane<Real> v_v;
+		FieldPlane<Real> newV_v;
+		FieldPlane<PressureT> pressure;
+		FieldPlane<Real> solid;
+		FieldPlane<SmokeT> smoke;
+		FieldPlane<SmokeT> newSmoke;
+
+		// Extra scalar channels (RGB dye, temperature, density, ...), one plane each, stored
+		// like smoke and advected in the same pass; see setScalarChannels().
+		std::size_t numScalars = 0;
+		std::vector<FieldPlane<SmokeT>> scalars;
+		std::vector<FieldPlane<SmokeT>> newScalars;
+
+		// Smoke on a grid `smokeRefinement` times finer than the velocity grid along each axis
+		// (1: off), covering the same cells including the borders, so coarse cell (i, j) holds
+		// the fine cells (i * k + a, j * k + b) for a, b < k. It is advected with the velocities
+		// interpolated at the fine cell centres and `smoke` then holds its box average, for
+		// everything that reads smoke at the velocity resolution. See setSmokeRefinement().
+		std::size_t smokeRefinement = 1;
+		FieldPlane<SmokeT> fineSmoke;
+		FieldPlane<SmokeT> newFineSmoke;
+
+		std::shared_ptr<FieldArena> arena;
+
+		// Optional; kernels run serially without a pool.
+		std::shared_ptr<ThreadPool> pool;
+
+		BasicIntegrator<Real>* integrator = nullptr;
+
+		std::vector<BasicStepObserver<BasicFluid>*> observers;
+
+		// Selects simulateFused() in simulate(). Both paths give bit-identical results.
+		bool fused = false;
+
+		// Selects solvePressure() over solveIncompressibility(): the solver iterates on
+		// `pressure`, starting from the previous step's solution, and stops early once the
+		// residual is below `tolerance` (1/s; 0 runs every iteration).
+		bool warmStart = false;
+		Real tolerance = 0;
+
+		// Selects solveSpectral() over both iterative solvers whenever the solid mask is a box
+		// (see boxDomain()); other masks fall back to them.
+		bool spectral = false;
+
+		// Accumulates the pressure of the red-black sweeps in `pressure`. Off, the sweeps skip
+		// that store per cell and iteration and `pressure` reads zero after them; turn it on
+		// whenever something displays, records or integrates the pressure. The warm-started
+		// and spectral solvers solve for the pressure itself and always produce it, and so
+		// do the solves that tune overRelaxation.
+		bool trackPressure = true;
+
+		SolveStats solveStats;
+
+		static constexpr std::size_t noChannel = static_cast<std::size_t>(-1);
+
+		// Boussinesq buoyancy from the scalar channels, added to gravity on every vertical
+		// face: gravity + temperatureWeight * (T - ambientTemperature) - densityWeight * d,
+		// with T and d the channels averaged over the two cells the face separates. Either
+		// channel may be noChannel.
+		struct Buoyancy
+		{
+			std::size_t temperature = noChannel;
+			std::size_t density = noChannel;
+			Real temperatureWeight = 0;
+			Real densityWeight = 0;
+			Real ambientTemperature = 0;
+		};
 
-		std::vector<float> h_v;
-		std::vector<float> newH_v;
-		std::vector<float> v_v;
-		std::vector<float> newV_v;
-		std::vector<float> pressure;
-		std::vector<float> solid;
-		std::vector<float> smoke;
-		std::vector<float> newSmoke;
+		Buoyancy buoyancy;
 
-		Integrator* integrator = nullptr;
+		// Wind tunnel edges, applied by extrapolate() after every projection. The inlet is
+		// every face between a fluid cell of column 1 and a wall in column 0, and the outlet
+		// every face between a fluid cell of column numX - 2 and a wall in column numX - 1.
+		// Both keep the velocity the boundary sets, since the solvers treat walls as fixed.
+		//
+		// With `enabled`, the inlet faces get `speed` * (1 + pulse * sin(2 pi time / period)),
+		// uniform or with a parabolic profile over the inlet of the same mean.
+		struct Inflow
+		{
+			bool enabled = false;
+			bool parabolic = false;
+			Real speed = 0;
+			Real pulse = 0;
+			Real period = 1;
+			Real time = 0;	// seconds since the inflow started
+		};
 
-		Fluid(Integrator* integrator, const float density, const std::size_t numX, const std::size_t numY, const float h)
-			: integrator(integrator)
+		Inflow inflow;
+
+		// Convective outflow: the outlet faces follow du/dt + c du/dx = 0, c being
+		// `convectionSpeed` or, when that is 0, the mean outlet velocity, so eddies leave the
+		// domain instead of reflecting off its end. The outlet is then shifted so it carries
+		// exactly the inlet flux, which keeps the pressure problem of the closed mask solvable.
+		bool convectiveOutflow = false;
+		Real convectionSpeed = 0;
+
+		// Vorticity confinement strength (0: off). integrate() adds the force
+		// vorticityConfinement * h * (N x w) to every fluid face, w being the curl and N the
+		// unit gradient of |w|, which puts back the small-scale rotation that semi-Lagrangian
+		// advection damps on coarse grids.
+		Real vorticityConfinement = 0;
+
+		// SOR factor of the iterative solvers, initially the global default.
+		Real overRelaxation = static_cast<Real>(FluidSims::overRelaxation);
+
+		// Tunes overRelaxation over the first `tuningFrames` iterative solves from an estimate
+		// of the mask's Jacobi spectral radius (see tuneOverRelaxation()), unless
+		// `overRelaxationTable` already holds a value for this grid size; the result is stored
+		// there.
+		bool autoOverRelaxation = false;
+		std::size_t tuningFrames = 8;
+		std::size_t tuningSweeps = 32;
+		std::shared_ptr<OverRelaxationTable> overRelaxationTable;
+
+		BasicFluid(BasicIntegrator<Real>* integrator, const Real density, const std::size_t numX, const std::size_t numY, const Real h,
+			std::shared_ptr<FieldArena> arena = nullptr, std::shared_ptr<ThreadPool> pool = nullptr)
+			: arena(arena ? std::move(arena) : std::make_shared<FieldArena>()),
+			pool(std::move(pool)),
+			integrator(integrator)
 		{
 			this->density = density;
+			this->h = h;
+
+			resize(numX, numY);
+		}
+
+		BasicFluid(const BasicFluid&) = delete;
+		BasicFluid& operator=(const BasicFluid&) = delete;
+
+		// Full grid size including the border cells.
+		std::size_t sizeX() const { return numX; }
+		std::size_t sizeY() const { return numY; }
+
+		// Size of the fine smoke grid, including the border cells.
+		std::size_t fineSizeX() const { return sizeX() * smokeRefinement; }
+		std::size_t fineSizeY() const { return sizeY() * smokeRefinement; }
+
+		// Calls fn(begin, end) with the columns of [first, last) owned by each worker.
+		// Every kernel uses the same split of [0, numX), which is also the split the fields
+		// are first-touched with, so on NUMA machines each worker sweeps node-local memory.
+		template<typename Fn>
+		void forColumns(const std::size_t first, const std::size_t last, Fn&& fn)
+		{
+			if (!pool) {
+				fn(first, last);
+				return;
+			}
+
+			pool->parallelFor(this->numX, first, last, [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				fn(begin, end);
+			});
+		}
+
+		// Byte offsets of every plane inside the arena block.
+		struct Layout
+		{
+			std::size_t h_v, newH_v, v_v, newV_v, pressure, solid, smoke, newSmoke;
+			std::size_t scalars, newScalars;	// first channel plane; channel c is c * scalarStride further
+			std::size_t scalarStride;
+			std::size_t fineSmoke, newFineSmoke;	// empty planes without refinement
+			std::size_t bytes;
+		};
 
-			this->numX = numX + 2;
-			this->numY = numY + 2;
+		// The base planes come first and keep their offsets whatever follows them.
+		static Layout layoutFor(const std::size_t numCells, const std::size_t numScalars = 0, const std::size_t smokeRefinement = 1)
+		{
+			const std::size_t fineCells = smokeRefinement > 1 ? numCells * smokeRefinement * smokeRefinement : 0;
+
+			FieldLayout fields;
+			Layout layout;
+			layout.h_v = fields.add<Real>(numCells);
+			layout.newH_v = fields.add<Real>(numCells);
+			layout.v_v = fields.add<Real>(numCells);
+			layout.newV_v = fields.add<Real>(numCells);
+			layout.pressure = fields.add<PressureT>(numCells);
+			layout.solid = fields.add<Real>(numCells);
+			layout.smoke = fields.add<SmokeT>(numCells);
+			layout.newSmoke = fields.add<SmokeT>(numCells);
+			layout.scalarStride = layout.newSmoke - layout.smoke;
+			layout.scalars = fields.bytes();
+			for (std::size_t c = 0; c < numScalars; c++)
+				fields.add<SmokeT>(numCells);
+			layout.newScalars = fields.bytes();
+			for (std::size_t c = 0; c < numScalars; c++)
+				fields.add<SmokeT>(numCells);
+			layout.fineSmoke = fields.add<SmokeT>(fineCells);
+			layout.newFineSmoke = fields.add<SmokeT>(fineCells);
+			layout.bytes = fields.bytes();
+			return layout;
+		}
+
+		Layout layout() const
+		{
+			return layoutFor(numCells, numScalars, smokeRefinement);
+		}
+
+		// Points every plane at its slot in the current arena block without touching the data.
+		void carve()
+		{
+			const Layout layout = this->layout();
+
+			h_v = arena->plane<Real>(layout.h_v, numCells);
+			newH_v = arena->plane<Real>(layout.newH_v, numCells);
+			v_v = arena->plane<Real>(layout.v_v, numCells);
+			newV_v = arena->plane<Real>(layout.newV_v, numCells);
+			pressure = arena->plane<PressureT>(layout.pressure, numCells);
+			solid = arena->plane<Real>(layout.solid, numCells);
+			smoke = arena->plane<SmokeT>(layout.smoke, numCells);
+			newSmoke = arena->plane<SmokeT>(layout.newSmoke, numCells);
+
+			scalars.resize(numScalars);
+			newScalars.resize(numScalars);
+			for (std::size_t c = 0; c < numScalars; c++) {
+				scalars[c] = arena->plane<SmokeT>(layout.scalars + c * layout.scalarStride, numCells);
+				newScalars[c] = arena->plane<SmokeT>(layout.newScalars + c * layout.scalarStride, numCells);
+			}
+
+			const std::size_t fineCells = smokeRefinement > 1 ? fineSizeX() * fineSizeY() : 0;
+			fineSmoke = arena->plane<SmokeT>(layout.fineSmoke, fineCells);
+			newFineSmoke = arena->plane<SmokeT>(layout.newFineSmoke, fineCells);
+		}
+
+		// Sets the full grid size (including the border cells) without allocating.
+		void setGridSize(const std::size_t numX, const std::size_t numY)
+		{
+			assert((NX == 0 || numX == NX + 2) && (NY == 0 || numY == NY + 2) && "size differs from the compile-time grid");
+
+			this->numX = numX;
+			this->numY = numY;
 			numCells = this->numX * this->numY;
-			this->h = h;
+		}
+
+		// Re-carves the arena for a new interior size and resets every field.
+		void resize(const std::size_t numX, const std::size_t numY)
+		{
+			setGridSize(numX + 2, numY + 2);
+			retuneOverRelaxation();
+
+			arena->reserve(layout().bytes);
+			carve();
+
+			// First touch with the kernels' column split places each strip on its worker's node.
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				const std::size_t first = begin * this->numY;
+				const std::size_t last = end * this->numY;
+
+				std::fill(h_v.data() + first, h_v.data() + last, Real(0));
+				std::fill(newH_v.data() + first, newH_v.data() + last, Real(0));
+				std::fill(v_v.data() + first, v_v.data() + last, Real(0));
+				std::fill(newV_v.data() + first, newV_v.data() + last, Real(0));
+				std::fill(pressure.data() + first, pressure.data() + last, PressureT(0));
+				std::fill(solid.data() + first, solid.data() + last, Real(1));
+				std::fill(smoke.data() + first, smoke.data() + last, SmokeT(1));
+				std::fill(newSmoke.data() + first, newSmoke.data() + last, SmokeT(0));
+				for (std::size_t c = 0; c < numScalars; c++) {
+					std::fill(scalars[c].data() + first, scalars[c].data() + last, SmokeT(0));
+					std::fill(newScalars[c].data() + first, newScalars[c].data() + last, SmokeT(0));
+				}
 
-			h_v.resize(numCells);
-			newH_v.resize(numCells);
-			v_v.resize(numCells);
-			newV_v.resize(numCells);
-			pressure.resize(numCells, 0.0f);
-			solid.resize(numCells, 1.0f);
-			smoke.resize(numCells, 1.0f);
-			newSmoke.resize(numCells, 0.0f);
+				if (smokeRefinement > 1) {
+					const std::size_t fineColumn = smokeRefinement * fineSizeY();
+					std::fill(fineSmoke.data() + begin * fineColumn, fineSmoke.data() + end * fineColumn, SmokeT(1));
+					std::fill(newFineSmoke.data() + begin * fineColumn, newFineSmoke.data() + end * fineColumn, SmokeT(0));
+				}
+			});
+		}
+
+		// Sets the number of extra scalar channels. A different count re-lays out the arena
+		// and, like resize(), resets every field.
+		void setScalarChannels(const std::size_t count)
+		{
+			if (count == numScalars)
+				return;
+
+			numScalars = count;
+			resize(this->numX - 2, this->numY - 2);
+		}
+
+		// Sets the smoke refinement factor (1 turns the fine grid off). A different factor
+		// re-lays out the arena and, like resize(), resets every field.
+		void setSmokeRefinement(const std::size_t factor)
+		{
+			assert(factor >= 1 && "refinement factor must be at least 1");
+
+			if (factor == smokeRefinement)
+				return;
+
+			smokeRefinement = factor;
+			resize(this->numX - 2, this->numY - 2);
 		}
 
-		void integrate(float dt, const float gravity)
+		// Sets the smoke of cell (i, j) and, with refinement, of all its fine cells. Sources
+		// and obstacles should write smoke through this so the fine grid sees them.
+		void setSmoke(const std::size_t i, const std::size_t j, const Real value)
 		{
-			std::size_t n = numY;
-			for (std::size_t i = 1; i < numX; i++) {
-				for (std::size_t j = 1; j < numY - 1; j++) {
-					if (solid[i * n + j] != 0.0f && solid[i * n + j - 1] != 0.0f)
-						integrator->integrate(v_v[i * n + j], dt, gravity);
+			this->smoke[i * sizeY() + j] = SmokeT(value);
+
+			const std::size_t k = smokeRefinement;
+			if (k == 1)
+				return;
+
+			const std::size_t fn = fineSizeY();
+			for (std::size_t a = 0; a < k; a++) {
+				SmokeT* fine = this->fineSmoke.data() + (i * k + a) * fn + j * k;
+				std::fill(fine, fine + k, SmokeT(value));
+			}
+		}
+
+		// Sets every fine cell to the smoke of its coarse cell, after smoke was written
+		// directly (e.g. by a setup that predates the fine grid, or a restored checkpoint).
+		void refineSmoke()
+		{
+			if (smokeRefinement == 1)
+				return;
+
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					for (std::size_t j = 0; j < sizeY(); j++)
+						setSmoke(i, j, this->smoke[i * sizeY() + j]);
 				}
+			});
+		}
+
+		void integrate(Real dt, const Real gravity)
+		{
+			if (beginConfinement()) {
+				forColumns(0, numX, [&](const std::size_t begin, const std::size_t end) {
+					curlColumns(begin, end);
+				});
+			}
+
+			forColumns(1, numX, [&](const std::size_t begin, const std::size_t end) {
+				integrateColumns(dt, gravity, begin, end);
+			});
+		}
+
+		// Sizes the curl plane if vorticity confinement is on and frees it otherwise. Returns
+		// whether curlColumns() must run over every column before integrateColumns().
+		bool beginConfinement()
+		{
+			if (vorticityConfinement == Real(0)) {
+				m_curl = std::vector<Real>();
+				return false;
+			}
+
+			m_curl.resize(numCells);
+			return true;
+		}
+
+		// The kernels below work on a column range [begin, end), so callers other than
+		// simulate() (e.g. a tiled or out-of-core stepper) can choose their own traversal.
+		// Strides and bounds are hoisted out of the loops and every column is addressed
+		// through its own base pointer.
+		// With vorticity confinement on, the curl plane must hold every column (see
+		// beginConfinement()); the gradient of |w| and the force are evaluated here, per face,
+		// from that plane alone.
+		void integrateColumns(const Real dt, const Real gravity, const std::size_t begin, const std::size_t end)
+		{
+			const std::size_t n = sizeY();
+			const bool heat = buoyancy.temperature < numScalars;
+			const bool weight = buoyancy.density < numScalars;
+			const bool confine = vorticityConfinement != Real(0);
+			assert((!confine || m_curl.size() == numCells) && "curlColumns() must run before integrateColumns()");
+
+			for (std::size_t i = begin; i < end; i++) {
+				const Real* s = solid.data() + i * n;
+				const Real* sLeft = solid.data() + (i - 1) * n;
+				Real* u = h_v.data() + i * n;
+				Real* v = v_v.data() + i * n;
+				const SmokeT* temperature = heat ? scalars[buoyancy.temperature].data() + i * n : nullptr;
+				const SmokeT* mass = weight ? scalars[buoyancy.density].data() + i * n : nullptr;
+
+				// Force in cell (i, j - 1), carried down the column.
+				Real fxBelow = 0, fyBelow = 0;
+				if (confine)
+					confinementForce(i, 0, fxBelow, fyBelow);
+
+				for (std::size_t j = 1; j < n - 1; j++) {
+					Real fx = 0, fy = 0;
+					if (confine) {
+						confinementForce(i, j, fx, fy);
+
+						if (s[j] != Real(0) && sLeft[j] != Real(0)) {
+							Real fxLeft, fyLeft;
+							confinementForce(i - 1, j, fxLeft, fyLeft);
+							integrator->integrate(u[j], dt, (fxLeft + fx) * Real(0.5));
+						}
+					}
+
+					if (s[j] != Real(0) && s[j - 1] != Real(0)) {
+						Real acceleration = gravity;
+						if (heat)
+							acceleration += buoyancy.temperatureWeight * ((Real(temperature[j - 1]) + Real(temperature[j])) * Real(0.5) - buoyancy.ambientTemperature);
+						if (weight)
+							acceleration -= buoyancy.densityWeight * (Real(mass[j - 1]) + Real(mass[j])) * Real(0.5);
+						if (confine)
+							acceleration += (fyBelow + fy) * Real(0.5);
+						integrator->integrate(v[j], dt, acceleration);
+					}
+
+					fxBelow = fx;
+					fyBelow = fy;
+				}
+			}
+		}
+
+		// Writes the curl dv/dx - du/dy at the centres of the cells in columns [begin, end)
+		// to the curl plane; see curlColumn().
+		void curlColumns(const std::size_t begin, const std::size_t end)
+		{
+			for (std::size_t i = begin; i < end; i++)
+				curlColumn(i, m_curl.data() + i * sizeY());
+		}
+
+		// Writes the curl dv/dx - du/dy at the centres of the cells of column i to w[0, numY),
+		// from central differences of the cell-centred velocity. Zero on the border and in
+		// solid cells. The confinement force and the vorticity diagnostics all use this curl.
+		void curlColumn(const std::size_t i, Real* w) const
+		{
+			const std::size_t n = sizeY();
+			if (i == 0 || i == sizeX() - 1) {
+				std::fill(w, w + n, Real(0));
+				return;
+			}
+
+			// Each difference spans 2h and is taken between sums of two faces.
+			const Real scale = Real(0.25) / this->h;
+			const Real* s = solid.data() + i * n;
+			const Real* u = h_v.data() + i * n;
+			const Real* uRight = h_v.data() + (i + 1) * n;
+			const Real* vLeft = v_v.data() + (i - 1) * n;
+			const Real* vRight = v_v.data() + (i + 1) * n;
+
+			w[0] = w[n - 1] = Real(0);
+			for (std::size_t j = 1; j < n - 1; j++) {
+				const Real dv = (vRight[j] + vRight[j + 1]) - (vLeft[j] + vLeft[j + 1]);
+				const Real du = (u[j + 1] + uRight[j + 1]) - (u[j - 1] + uRight[j - 1]);
+				w[j] = s[j] != Real(0) ? (dv - du) * scale : Real(0);
 			}
 		}
 
-		void solveIncompressibility(const std::size_t numIters, const float dt) {
+		void solveIncompressibility(const std::size_t numIters, const Real dt) {
 
-			std::size_t n = this->numY;
-			float cp = this->density * this->h / dt;
+			Real cp = this->density * this->h / dt;
+			const bool tuning = beginTuning();
 
 			for (std::size_t iter = 0; iter < numIters; iter++) {
+				solveColour(0, cp);
+				solveColour(1, cp);
+			}
 
-				for (std::size_t i = 1; i < this->numX - 1; i++) {
-					for (std::size_t j = 1; j < this->numY - 1; j++) {
+			this->solveStats = SolveStats();
+			this->solveStats.iterations = numIters;
+			this->solveStats.omega = static_cast<float>(overRelaxation);
 
-						if (this->solid[i * n + j] == 0.0f)
-							continue;
+			if (tuning)
+				endTuning();
+		}
+
+		// One red-black half sweep over the cells with (i + j) % 2 == colour. Cells of one
+		// colour share no faces, so the sweep can be split across workers without races.
+		void solveColour(const std::size_t colour, const Real cp) {
+
+			forColumns(1, this->numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				solveColourColumns(colour, cp, begin, end);
+			});
+		}
+
+		// solveColour() restricted to the columns [begin, end) of [1, numX - 1).
+		void solveColourColumns(const std::size_t colour, const Real cp, const std::size_t begin, const std::size_t end) {
+
+			if (this->trackPressure || m_tuning)
+				relaxColumns<true>(colour, cp, begin, end);
+			else
+				relaxColumns<false>(colour, cp, begin, end);
+		}
+
+		template<bool accumulate>
+		void relaxColumns(const std::size_t colour, const Real cp, const std::size_t begin, const std::size_t end) {
+
+			const std::size_t n = sizeY();
+			const Real omega = overRelaxation;
+
+			for (std::size_t i = begin; i < end; i++) {
+				const Real* s = this->solid.data() + i * n;
+				const Real* sLeft = s - n;
+				const Real* sRight = s + n;
+				Real* u = this->h_v.data() + i * n;
+				Real* uRight = u + n;
+				Real* v = this->v_v.data() + i * n;
+				PressureT* p = this->pressure.data() + i * n;
+
+				for (std::size_t j = 1 + (i + 1 + colour) % 2; j < n - 1; j += 2) {
+
+					if (s[j] == Real(0))
+						continue;
+
+					const Real sx0 = sLeft[j];
+					const Real sx1 = sRight[j];
+					const Real sy0 = s[j - 1];
+					const Real sy1 = s[j + 1];
+					const Real solid = sx0 + sx1 + sy0 + sy1;
+					if (solid == Real(0))
+						continue;
+
+					const Real div = uRight[j] - u[j] + v[j + 1] - v[j];
+
+					Real pressure = -div / solid;
+					pressure *= omega;
+					if (accumulate)
+						p[j] = p[j] + cp * pressure;
+
+					u[j] -= sx0 * pressure;
+					uRight[j] += sx1 * pressure;
+					v[j] -= sy0 * pressure;
+					v[j + 1] += sy1 * pressure;
+				}
+			}
+		}
+
+		// Forgets the tuned factor so the next solves tune it again (when autoOverRelaxation
+		// is set), e.g. after the grid or the mask changed. With `useTable` a table entry for
+		// the grid size is taken instead of tuning.
+		void retuneOverRelaxation(const bool useTable = true) {
+			m_tuningFrame = 0;
+			m_tuned = false;
+			m_useTable = useTable;
+			m_probe.clear();
+		}
+
+		// Estimates the Jacobi spectral radius mu of the current mask and sets overRelaxation to
+		// the optimal red-black SOR factor 2 / (1 + sqrt(1 - mu^2)). mu is the largest
+		// eigenvalue of the (symmetrizable) Jacobi operator, so its Rayleigh quotient on a
+		// smooth probe field is a close lower bound: the error is quadratic in the probe's
+		// non-slowest part. The probe is seeded with the first solved pressure, which is
+		// mostly slow modes already, and smoothed by `tuningSweeps` red-black Gauss-Seidel
+		// sweeps of the homogeneous problem after each of the first `tuningFrames` solves, so
+		// the estimate rises towards mu from below and omega never overshoots the optimum,
+		// where convergence degrades much faster than below it. In closed domains the
+		// constant null mode is projected out first.
+		void tuneOverRelaxation() {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+
+			if (m_probe.empty()) {
+				m_probe.resize(this->numCells);
+				forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+					for (std::size_t i = begin; i < end; i++) {
+						const Real* s = this->solid.data() + i * n;
+						const PressureT* p = this->pressure.data() + i * n;
+						Real* e = m_probe.data() + i * n;
+
+						for (std::size_t j = 0; j < n; j++)
+							e[j] = i == 0 || i == lastX || j == 0 || j == n - 1 || s[j] == Real(0) ? Real(0) : static_cast<Real>(p[j]);
+					}
+				});
+
+				// Closed unless some fluid cell borders an open border cell.
+				m_closedDomain = true;
+				for (std::size_t j = 1; j < n - 1; j++) {
+					if ((this->solid[j] != Real(0) && this->solid[n + j] != Real(0)) ||
+						(this->solid[lastX * n + j] != Real(0) && this->solid[(lastX - 1) * n + j] != Real(0)))
+						m_closedDomain = false;
+				}
+				for (std::size_t i = 1; i < lastX; i++) {
+					if ((this->solid[i * n] != Real(0) && this->solid[i * n + 1] != Real(0)) ||
+						(this->solid[i * n + n - 1] != Real(0) && this->solid[i * n + n - 2] != Real(0)))
+						m_closedDomain = false;
+				}
+			}
+
+			for (std::size_t sweep = 0; sweep < this->tuningSweeps; sweep++)
+				probeSweep();
+
+			if (m_closedDomain) {
+				const ProbeSums sums = probeSums();
+				const Real mean = sums.weights > 0.0 ? static_cast<Real>(sums.weighted / sums.weights) : Real(0);
+				forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+					for (std::size_t i = begin; i < end; i++) {
+						const Real* s = this->solid.data() + i * n;
+						Real* e = m_probe.data() + i * n;
+						for (std::size_t j = 1; j < n - 1; j++) {
+							if (s[j] != Real(0))
+								e[j] -= mean;
+						}
+					}
+				});
+			}
+
+			// mu >= e.N e / e.D e, D holding each cell's neighbour count and N the neighbour sums.
+			const ProbeSums sums = probeSums();
+			const double neighbours = sums.neighbours;
+			const double diagonal = sums.diagonal;
+
+			if (!(diagonal > 0.0) || !(neighbours > 0.0)) {
+				m_probe.clear();	// nothing to measure (e.g. no flow yet); reseed next solve
+				return;
+			}
+
+			const double mu = std::min(neighbours / diagonal, 1.0 - 1e-6);
+			overRelaxation = static_cast<Real>(2.0 / (1.0 + std::sqrt(1.0 - mu * mu)));
+			m_tuningFrame++;
+
+			// Keeps the probe in range over many frames.
+			const Real scale = static_cast<Real>(1.0 / std::sqrt(diagonal));
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				for (Real* e = m_probe.data() + begin * n; e < m_probe.data() + end * n; e++)
+					*e *= scale;
+			});
+		}
+
+		// One red-black Gauss-Seidel sweep of sum_nb s_nb * (e - e_nb) = 0 on the probe.
+		void probeSweep() {
 
-						float solid = this->solid[i * n + j];
-						float sx0 = this->solid[(i - 1) * n + j];
-						float sx1 = this->solid[(i + 1) * n + j];
-						float sy0 = this->solid[i * n + j - 1];
-						float sy1 = this->solid[i * n + j + 1];
-						solid = sx0 + sx1 + sy0 + sy1;
-						if (solid == 0.0f)
+			const std::size_t n = sizeY();
+
+			for (std::size_t colour = 0; colour < 2; colour++) {
+				forColumns(1, this->numX - 1, [&](const std::size_t begin, const std::size_t end) {
+					for (std::size_t i = begin; i < end; i++) {
+						const Real* s = this->solid.data() + i * n;
+						const Real* sLeft = s - n;
+						const Real* sRight = s + n;
+						Real* e = m_probe.data() + i * n;
+						const Real* eLeft = e - n;
+						const Real* eRight = e + n;
+
+						for (std::size_t j = 1 + (i + 1 + colour) % 2; j < n - 1; j += 2) {
+							if (s[j] == Real(0))
+								continue;
+
+							const Real solid = sLeft[j] + sRight[j] + s[j - 1] + s[j + 1];
+							if (solid == Real(0))
+								continue;
+
+							e[j] = (sLeft[j] * eLeft[j] + sRight[j] * eRight[j] + s[j - 1] * e[j - 1] + s[j + 1] * e[j + 1]) / solid;
+						}
+					}
+				});
+			}
+		}
+
+		// Sums over the fluid cells of the probe, D being each cell's neighbour count and N
+		// the weighted sum of its neighbours.
+		struct ProbeSums
+		{
+			double weighted = 0.0;	// D e
+			double weights = 0.0;	// D
+			double neighbours = 0.0;	// e N e
+			double diagonal = 0.0;	// e D e
+		};
+
+		ProbeSums probeSums() {
+
+			const std::size_t n = sizeY();
+			ProbeSums total;
+			std::mutex mutex;
+
+			forColumns(1, this->numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				ProbeSums local;
+				for (std::size_t i = begin; i < end; i++) {
+					const Real* s = this->solid.data() + i * n;
+					const Real* sLeft = s - n;
+					const Real* sRight = s + n;
+					const Real* e = m_probe.data() + i * n;
+					const Real* eLeft = e - n;
+					const Real* eRight = e + n;
+
+					for (std::size_t j = 1; j < n - 1; j++) {
+						if (s[j] == Real(0))
 							continue;
 
-						const float u1 = this->h_v[(i + 1) * n + j];
-						const float u2 = this->h_v[i * n + j];
-						const float v1 = this->v_v[i * n + j + 1];
-						const float v2 = this->v_v[i * n + j];
+						const double solid = sLeft[j] + sRight[j] + s[j - 1] + s[j + 1];
+						const double sum = sLeft[j] * eLeft[j] + sRight[j] * eRight[j] + s[j - 1] * e[j - 1] + s[j + 1] * e[j + 1];
+						local.weighted += solid * e[j];
+						local.weights += solid;
+						local.neighbours += e[j] * sum;
+						local.diagonal += solid * e[j] * e[j];
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				total.weighted += local.weighted;
+				total.weights += local.weights;
+				total.neighbours += local.neighbours;
+				total.diagonal += local.diagonal;
+			});
+
+			return total;
+		}
 
-						const float div = u1 - u2 + v1 - v2;
+		// Called before an iterative solve; returns whether endTuning() should follow it.
+		bool beginTuning() {
 
-						float pressure = -div / solid;
-						pressure *= overRelaxation;
-						this->pressure[i * n + j] += cp * pressure;
+			if (!this->autoOverRelaxation || m_tuned)
+				return false;
 
-						this->h_v[i * n + j] -= sx0 * pressure;
-						this->h_v[(i + 1) * n + j] += sx1 * pressure;
-						this->v_v[i * n + j] -= sy0 * pressure;
-						this->v_v[i * n + j + 1] += sy1 * pressure;
+			float omega = 0.0f;
+			if (m_useTable && m_tuningFrame == 0 && m_probe.empty() && this->overRelaxationTable &&
+				this->overRelaxationTable->lookup(this->numX - 2, this->numY - 2, omega)) {
+				overRelaxation = static_cast<Real>(omega);
+				m_tuned = true;
+				return false;
+			}
+
+			m_tuning = true;
+			return true;
+		}
+
+		void endTuning() {
+
+			m_tuning = false;
+			tuneOverRelaxation();
+			if (m_tuningFrame < this->tuningFrames)
+				return;
+
+			m_tuned = true;
+			m_probe = std::vector<Real>();
+			if (this->overRelaxationTable)
+				this->overRelaxationTable->store(this->numX - 2, this->numY - 2, static_cast<float>(overRelaxation));
+		}
+
+		// Pressure form of the same projection. The corrected face velocity between cells a
+		// and b is u* + (p_a - p_b) / cp where both cells are fluid, so each fluid cell solves
+		// sum_nb s_nb * (p - p_nb) = -cp * div*, div* being the divergence of the velocities
+		// as they are now; these stay untouched until applyPressure() adds the gradient once.
+		// Red-black SOR with the same colouring and omega as solveIncompressibility(), which
+		// it matches iteration for iteration from a zero start; starting from the last step's
+		// pressure instead, steady flows need only a few iterations. Returns the number of
+		// iterations run.
+		std::size_t solvePressure(const std::size_t maxIters, const Real dt) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const Real cp = this->density * this->h / dt;
+			const bool tuning = beginTuning();
+			const Real omega = overRelaxation;
+
+			// Border and solid cells act as p = 0 (solid cells may hold a stale value from
+			// before the obstacle moved).
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const Real* s = this->solid.data() + i * n;
+					PressureT* p = this->pressure.data() + i * n;
+
+					if (i == 0 || i == lastX) {
+						std::fill(p, p + n, PressureT(0));
+						continue;
+					}
+
+					p[0] = PressureT(0);
+					p[n - 1] = PressureT(0);
+					for (std::size_t j = 1; j < n - 1; j++) {
+						if (s[j] == Real(0))
+							p[j] = PressureT(0);
 					}
 				}
+			});
+
+			std::size_t iter = 0;
+			Real residual = 0;
+			bool converged = false;
+			while (iter < maxIters && !converged) {
+				const Real red = solvePressureColour(0, cp, omega);
+				const Real black = solvePressureColour(1, cp, omega);
+				residual = std::max(red, black) / this->h;
+				iter++;
+				converged = this->tolerance > Real(0) && residual < this->tolerance;
+			}
+
+			applyPressure(cp);
+
+			this->solveStats.iterations = iter;
+			this->solveStats.residual = static_cast<float>(residual);
+			this->solveStats.converged = converged;
+			this->solveStats.omega = static_cast<float>(omega);
+
+			if (tuning)
+				endTuning();
+			return iter;
+		}
+
+		// One red-black half sweep of solvePressure(). Returns the largest |div u| (per cell,
+		// before the update) of the swept cells.
+		Real solvePressureColour(const std::size_t colour, const Real cp, const Real omega) {
+
+			Real residual = 0;
+			std::mutex mutex;
+
+			forColumns(1, this->numX - 1, [&](const std::size_t begin, const std::size_t end) {
+				const Real local = solvePressureColumns(colour, cp, omega, begin, end);
+				std::lock_guard<std::mutex> lock(mutex);
+				residual = std::max(residual, local);
+			});
+
+			return residual;
+		}
+
+		Real solvePressureColumns(const std::size_t colour, const Real cp, const Real omega, const std::size_t begin, const std::size_t end) {
+
+			const std::size_t n = sizeY();
+			const Real cp1 = Real(1) / cp;
+			Real residual = 0;
+
+			for (std::size_t i = begin; i < end; i++) {
+				const Real* s = this->solid.data() + i * n;
+				const Real* sLeft = s - n;
+				const Real* sRight = s + n;
+				const Real* u = this->h_v.data() + i * n;
+				const Real* uRight = u + n;
+				const Real* v = this->v_v.data() + i * n;
+				PressureT* p = this->pressure.data() + i * n;
+				const PressureT* pLeft = p - n;
+				const PressureT* pRight = p + n;
+
+				for (std::size_t j = 1 + (i + 1 + colour) % 2; j < n - 1; j += 2) {
+
+					if (s[j] == Real(0))
+						continue;
+
+					const Real sx0 = sLeft[j];
+					const Real sx1 = sRight[j];
+					const Real sy0 = s[j - 1];
+					const Real sy1 = s[j + 1];
+					const Real solid = sx0 + sx1 + sy0 + sy1;
+					if (solid == Real(0))
+						continue;
+
+					const Real centre = p[j];
+					const Real neighbours = sx0 * pLeft[j] + sx1 * pRight[j] + sy0 * p[j - 1] + sy1 * p[j + 1];
+					const Real div = uRight[j] - u[j] + v[j + 1] - v[j] + (solid * centre - neighbours) * cp1;
+
+					residual = std::max(residual, std::abs(div));
+					p[j] = centre - omega * cp * div / solid;
+				}
 			}
+
+			return residual;
 		}
 
-		void extrapolate() {
+		// Whether the solid mask is a box SpectralPoisson can solve: every interior cell fluid
+		// and each border side all solid or all fluid, bottom and top of the same kind. The
+		// corner cells are never read and may be anything.
+		bool boxDomain(BoxDomain& domain) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+
+			auto sideOf = [&](const Real* s, const std::size_t stride, const std::size_t count, box_side_t& side) {
+				const Real first = s[0];
+				if (first != Real(0) && first != Real(1))
+					return false;
+				for (std::size_t k = 1; k < count; k++) {
+					if (s[k * stride] != first)
+						return false;
+				}
+				side = first == Real(0) ? BOX_WALL : BOX_OPEN;
+				return true;
+			};
+
+			if (!sideOf(this->solid.data() + 1, 1, n - 2, domain.left) ||
+				!sideOf(this->solid.data() + lastX * n + 1, 1, n - 2, domain.right) ||
+				!sideOf(this->solid.data() + n, n, lastX - 1, domain.bottom) ||
+				!sideOf(this->solid.data() + n + n - 1, n, lastX - 1, domain.top) ||
+				!SpectralPoisson::supports(domain))
+				return false;
+
+			bool box = true;
+			std::mutex mutex;
+
+			forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+				bool local = true;
+				for (std::size_t i = begin; i < end && local; i++) {
+					const Real* s = this->solid.data() + i * n;
+					local = std::all_of(s + 1, s + n - 1, [](const Real value) { return value == Real(1); });
+				}
+
+				std::lock_guard<std::mutex> lock(mutex);
+				box = box && local;
+			});
+
+			return box;
+		}
 
-			std::size_t n = this->numY;
-			for (std::size_t i = 0; i < this->numX; i++) {
+		// Exact solution of the problem solvePressure() iterates on, for a box mask found by
+		// boxDomain(): one spectral solve in double precision replaces the sweeps. The plan is
+		// kept and rebuilt only when the grid size or the kind of a side changes.
+		void solveSpectral(const BoxDomain& domain, const Real dt) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const Real cp = this->density * this->h / dt;
+
+			if (!m_spectral || m_spectral->numX() != lastX - 1 || m_spectral->numY() != n - 2 || !(m_spectral->domain() == domain))
+				m_spectral = std::make_unique<SpectralPoisson>(lastX - 1, n - 2, domain);
+			SpectralPoisson& poisson = *m_spectral;
+
+			forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const Real* u = this->h_v.data() + i * n;
+					const Real* uRight = u + n;
+					const Real* v = this->v_v.data() + i * n;
+					double* rhs = poisson.data() + (i - 1) * (n - 2);
+
+					for (std::size_t j = 1; j < n - 1; j++)
+						rhs[j - 1] = -static_cast<double>(cp) * static_cast<double>(uRight[j] - u[j] + v[j + 1] - v[j]);
+				}
+			});
+
+			poisson.solve(this->pool.get());
+
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					PressureT* p = this->pressure.data() + i * n;
+
+					if (i == 0 || i == lastX) {
+						std::fill(p, p + n, PressureT(0));
+						continue;
+					}
+
+					const double* solution = poisson.data() + (i - 1) * (n - 2);
+					p[0] = PressureT(0);
+					p[n - 1] = PressureT(0);
+					for (std::size_t j = 1; j < n - 1; j++)
+						p[j] = PressureT(static_cast<Real>(solution[j - 1]));
+				}
+			});
+
+			applyPressure(cp);
+
+			this->solveStats = SolveStats();
+			this->solveStats.iterations = 1;
+			this->solveStats.converged = true;
+		}
+
+		// Adds the pressure gradient to every face between two fluid cells, or between a fluid
+		// cell and an open border cell.
+		void applyPressure(const Real cp) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const Real cp1 = Real(1) / cp;
+
+			forColumns(1, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				for (std::size_t i = begin; i < end; i++) {
+					const Real* s = this->solid.data() + i * n;
+					const Real* sLeft = s - n;
+					PressureT* p = this->pressure.data() + i * n;
+					const PressureT* pLeft = p - n;
+					Real* u = this->h_v.data() + i * n;
+					Real* v = this->v_v.data() + i * n;
+
+					for (std::size_t j = 1; j < n - 1; j++)
+						u[j] += (s[j] * pLeft[j] - sLeft[j] * p[j]) * cp1;
+
+					if (i < lastX) {
+						for (std::size_t j = 1; j < n; j++)
+							v[j] += (s[j] * p[j - 1] - s[j - 1] * p[j]) * cp1;
+					}
+				}
+			});
+		}
+
+		void extrapolate(const Real dt) {
+
+			if (this->inflow.enabled)
+				applyInflow(dt);
+			if (this->convectiveOutflow)
+				applyOutflow(dt);
+
+			const std::size_t n = sizeY();
+			const std::size_t last = sizeX() - 1;
+			for (std::size_t i = 0; i <= last; i++) {
 				this->h_v[i * n + 0] = this->h_v[i * n + 1];
-				this->h_v[i * n + this->numY - 1] = this->h_v[i * n + this->numY - 2];
+				this->h_v[i * n + n - 1] = this->h_v[i * n + n - 2];
 			}
-			for (std::size_t j = 0; j < this->numY; j++) {
+			for (std::size_t j = 0; j < n; j++) {
 				this->v_v[0 * n + j] = this->v_v[1 * n + j];
-				this->v_v[(this->numX - 1) * n + j] = this->v_v[(this->numX - 2) * n + j];
+				this->v_v[last * n + j] = this->v_v[(last - 1) * n + j];
+			}
+		}
+
+		// Advances the inflow clock by dt and sets the inlet faces (see Inflow).
+		void applyInflow(const Real dt) {
+
+			const std::size_t n = sizeY();
+			const Real* wall = this->solid.data();
+			const Real* s = this->solid.data() + n;
+			Real* u = this->h_v.data() + n;
+
+			this->inflow.time += dt;
+			const Real pi = std::acos(Real(-1));
+			const Real speed = this->inflow.speed * (Real(1) + this->inflow.pulse * std::sin(2 * pi * this->inflow.time / this->inflow.period));
+
+			std::size_t first = n, last = 0;
+			for (std::size_t j = 1; j < n - 1; j++) {
+				if (s[j] != Real(0) && wall[j] == Real(0)) {
+					first = std::min(first, j);
+					last = j;
+				}
+			}
+			if (first > last)
+				return;
+
+			// 4 y (1 - y) over the inlet span, normalised to a mean of 1 over its faces.
+			const Real span = static_cast<Real>(last + 1 - first);
+			auto profile = [&](const std::size_t j) {
+				if (!this->inflow.parabolic)
+					return Real(1);
+				const Real y = (static_cast<Real>(j - first) + Real(0.5)) / span;
+				return Real(4) * y * (Real(1) - y);
+			};
+
+			Real sum = 0;
+			std::size_t count = 0;
+			for (std::size_t j = first; j <= last; j++) {
+				if (s[j] != Real(0) && wall[j] == Real(0)) {
+					sum += profile(j);
+					count++;
+				}
+			}
+
+			const Real scale = speed * static_cast<Real>(count) / sum;
+			for (std::size_t j = first; j <= last; j++) {
+				if (s[j] != Real(0) && wall[j] == Real(0))
+					u[j] = scale * profile(j);
 			}
 		}
 
-		float sampleField(float x, float y, const FIELD_TYPE field) const {
-			std::size_t n = this->numY;
-			float h = this->h;
-			float h1 = 1.0f / h;
-			float h2 = 0.5f * h;
+		// One upwind step of the convective condition on the outlet faces, followed by the
+		// flux correction (see convectiveOutflow).
+		void applyOutflow(const Real dt) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const Real* inletWall = this->solid.data();
+			const Real* inletCells = this->solid.data() + n;
+			const Real* s = this->solid.data() + (lastX - 1) * n;
+			const Real* wall = this->solid.data() + lastX * n;
+			const Real* inlet = this->h_v.data() + n;
+			const Real* upstream = this->h_v.data() + (lastX - 1) * n;
+			Real* u = this->h_v.data() + lastX * n;
+
+			Real influx = 0, outflux = 0;
+			std::size_t count = 0;
+			for (std::size_t j = 1; j < n - 1; j++) {
+				if (inletCells[j] != Real(0) && inletWall[j] == Real(0))
+					influx += inlet[j];
+				if (s[j] != Real(0) && wall[j] == Real(0)) {
+					outflux += u[j];
+					count++;
+				}
+			}
+			if (count == 0)
+				return;
 
-			x = std::max(std::min(x, this->numX * h), h);
-			y = std::max(std::min(y, this->numY * h), h);
+			const Real c = this->convectionSpeed > Real(0) ? this->convectionSpeed : std::max(Real(0), outflux / static_cast<Real>(count));
+			const Real r = std::min(Real(1), c * dt / this->h);
 
-			float dx = 0.0f;
-			float dy = 0.0f;
+			outflux = 0;
+			for (std::size_t j = 1; j < n - 1; j++) {
+				if (s[j] != Real(0) && wall[j] == Real(0)) {
+					u[j] -= r * (u[j] - upstream[j]);
+					outflux += u[j];
+				}
+			}
 
-			const std::vector<float>* f = nullptr;
+			const Real shift = (influx - outflux) / static_cast<Real>(count);
+			for (std::size_t j = 1; j < n - 1; j++) {
+				if (s[j] != Real(0) && wall[j] == Real(0))
+					u[j] += shift;
+			}
+		}
+
+		Real sampleField(Real x, Real y, const FIELD_TYPE field) const {
+			Real h2 = Real(0.5) * this->h;
 
 			switch (field) {
-			case H_FIELD: { f = &this->h_v; dy = h2; break; }
-			case V_FIELD: { f = &this->v_v; dx = h2; break; }
-			case S_FIELD: { f = &this->smoke; dx = h2; dy = h2; break; }
+			case H_FIELD: return samplePlane(this->h_v, x, y, Real(0), h2);
+			case V_FIELD: return samplePlane(this->v_v, x, y, h2, Real(0));
+			case S_FIELD: return samplePlane(this->smoke, x, y, h2, h2);
 
 			}
 
-			float x0 = std::min(std::floor((x - dx) * h1), static_cast<float>(this->numX - 1));
-			float tx = ((x - dx) - x0 * h) * h1;
-			float x1 = std::min(x0 + 1, static_cast<float>(this->numX - 1));
+			return Real(0);
+		}
 
-			float y0 = std::min(std::floor((y - dy) * h1), static_cast<float>(this->numY - 1));
-			float ty = ((y - dy) - y0 * h) * h1;
-			float y1 = std::min(y0 + 1, static_cast<float>(this->numY - 1));
+		// Bilinear interpolation of a plane whose samples sit at (i * h + dx, j * h + dy).
+		template<typename T>
+		Real samplePlane(const FieldPlane<T>& f, const Real x, const Real y, const Real dx, const Real dy) const {
+			return interpolate(f, stencilAt(x, y, dx, dy));
+		}
 
-			float sx = 1.0f - tx;
-			float sy = 1.0f - ty;
+		// The four samples around a point and their bilinear weights, so that planes sampled
+		// at the same positions (smoke and the scalar channels) share one lookup.
+		struct Stencil
+		{
+			std::size_t k00, k10, k11, k01;
+			Real w00, w10, w11, w01;
+		};
+
+		Stencil stencilAt(const Real x, const Real y, const Real dx, const Real dy) const {
+			return stencilOn(x, y, dx, dy, this->h, sizeX(), sizeY(), columnOrigin);
+		}
 
-			float val = sx * sy * (*f)[x0 * n + y0] +
-				tx * sy * (*f)[x1 * n + y0] +
-				tx * ty * (*f)[x1 * n + y1] +
-				sx * ty * (*f)[x0 * n + y1];
+		// stencilAt() on a grid of spacing h and size sizeX x sizeY, such as the fine smoke grid,
+		// whose column 0 is column originX of the grid `x` is measured on.
+		static Stencil stencilOn(Real x, Real y, const Real dx, const Real dy, const Real h, const std::size_t sizeX, const std::size_t sizeY,
+			const std::size_t originX = 0) {
+			const std::size_t n = sizeY;
+			const Real firstX = static_cast<Real>(originX);
+			const Real lastX = static_cast<Real>(originX + sizeX - 1);
+			const Real lastY = static_cast<Real>(n - 1);
+			Real h1 = Real(1) / h;
+
+			x = std::max(std::min(x, (originX + sizeX) * h), (originX + 1) * h);
+			y = std::max(std::min(y, n * h), h);
+
+			Real x0 = std::min(std::floor((x - dx) * h1), lastX);
+			Real tx = ((x - dx) - x0 * h) * h1;
+			Real x1 = std::min(x0 + 1, lastX);
+
+			Real y0 = std::min(std::floor((y - dy) * h1), lastY);
+			Real ty = ((y - dy) - y0 * h) * h1;
+			Real y1 = std::min(y0 + 1, lastY);
+
+			Real sx = Real(1) - tx;
+			Real sy = Real(1) - ty;
+
+			Stencil stencil;
+			stencil.k00 = static_cast<std::size_t>(x0 - firstX) * n + static_cast<std::size_t>(y0);
+			stencil.k10 = static_cast<std::size_t>(x1 - firstX) * n + static_cast<std::size_t>(y0);
+			stencil.k11 = static_cast<std::size_t>(x1 - firstX) * n + static_cast<std::size_t>(y1);
+			stencil.k01 = static_cast<std::size_t>(x0 - firstX) * n + static_cast<std::size_t>(y1);
+			stencil.w00 = sx * sy;
+			stencil.w10 = tx * sy;
+			stencil.w11 = tx * ty;
+			stencil.w01 = sx * ty;
+			return stencil;
+		}
 
-			return val;
+		template<typename T>
+		static Real interpolate(const FieldPlane<T>& f, const Stencil& stencil) {
+			return stencil.w00 * f[stencil.k00] +
+				stencil.w10 * f[stencil.k10] +
+				stencil.w11 * f[stencil.k11] +
+				stencil.w01 * f[stencil.k01];
 		}
 
-		float avgH(const std::size_t i, const std::size_t j) {
-			std::size_t n = this->numY;
-			float h_v = (this->h_v[i * n + j - 1] + this->h_v[i * n + j] +
-				this->h_v[(i + 1) * n + j - 1] + this->h_v[(i + 1) * n + j]) * 0.25f;
+		Real avgH(const std::size_t i, const std::size_t j) {
+			const std::size_t n = sizeY();
+			Real h_v = (this->h_v[i * n + j - 1] + this->h_v[i * n + j] +
+				this->h_v[(i + 1) * n + j - 1] + this->h_v[(i + 1) * n + j]) * Real(0.25);
 			return h_v;
 
 		}
 
-		float avgV(const std::size_t i, const std::size_t j) {
-			std::size_t n = this->numY;
-			float v_v = (this->v_v[(i - 1) * n + j] + this->v_v[i * n + j] +
-				this->v_v[(i - 1) * n + j + 1] + this->v_v[i * n + j + 1]) * 0.25f;
+		Real avgV(const std::size_t i, const std::size_t j) {
+			const std::size_t n = sizeY();
+			Real v_v = (this->v_v[(i - 1) * n + j] + this->v_v[i * n + j] +
+				this->v_v[(i - 1) * n + j + 1] + this->v_v[i * n + j + 1]) * Real(0.25);
 			return v_v;
 		}
 
-		void advectVel(const float dt) {
+		void advectVel(const Real dt) {
 
-			this->newH_v = this->h_v;
-			this->newV_v = this->v_v;
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				advectVelColumns(dt, begin, end);
+			});
 
-			std::size_t n = this->numY;
-			float h = this->h;
-			float h2 = 0.5f * h;
+			std::swap(this->h_v, this->newH_v);
+			std::swap(this->v_v, this->newV_v);
+		}
+
+		// Writes newH_v and newV_v for the columns [begin, end); h_v and v_v are only read,
+		// so column ranges may be processed in any order before the swap.
+		void advectVelColumns(const Real dt, const std::size_t begin, const std::size_t end) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const std::size_t origin = columnOrigin;
+			Real h = this->h;
+			Real h2 = Real(0.5) * h;
 
-			std::size_t cnt = 0;
+			std::copy(this->h_v.data() + begin * n, this->h_v.data() + end * n, this->newH_v.data() + begin * n);
+			std::copy(this->v_v.data() + begin * n, this->v_v.data() + end * n, this->newV_v.data() + begin * n);
 
-			for (std::size_t i = 1; i < this->numX; i++) {
-				for (std::size_t j = 1; j < this->numY; j++) {
+			for (std::size_t i = std::max<std::size_t>(begin, 1); i < end; i++) {
+				const Real* s = this->solid.data() + i * n;
+				const Real* sLeft = s - n;
+				const Real* u = this->h_v.data() + i * n;
+				const Real* v = this->v_v.data() + i * n;
+				Real* newU = this->newH_v.data() + i * n;
+				Real* newV = this->newV_v.data() + i * n;
+				const bool vColumn = i < lastX;
 
-					cnt++;
+				for (std::size_t j = 1; j < n; j++) {
 
 					// h_v component
-					if (this->solid[i * n + j] != 0.0f && this->solid[(i - 1) * n + j] != 0.0f && j < this->numY - 1) {
-						float x = i * h;
-						float y = j * h + h2;
-						float h_v = this->h_v[i * n + j];
-						float v_v = this->avgV(i, j);
+					if (s[j] != Real(0) && sLeft[j] != Real(0) && j < n - 1) {
+						Real x = (i + origin) * h;
+						Real y = j * h + h2;
+						Real h_v = u[j];
+						Real v_v = this->avgV(i, j);
 						x = x - dt * h_v;
 						y = y - dt * v_v;
 						h_v = this->sampleField(x, y, H_FIELD);
-						this->newH_v[i * n + j] = h_v;
+						newU[j] = h_v;
 					}
 					// v_v component
-					if (this->solid[i * n + j] != 0.0f && this->solid[i * n + j - 1] != 0.0f && i < this->numX - 1) {
-						float x = i * h + h2;
-						float y = j * h;
-						float h_v = this->avgH(i, j);
-						float v_v = this->v_v[i * n + j];
+					if (s[j] != Real(0) && s[j - 1] != Real(0) && vColumn) {
+						Real x = (i + origin) * h + h2;
+						Real y = j * h;
+						Real h_v = this->avgH(i, j);
+						Real v_v = v[j];
 						x = x - dt * h_v;
 						y = y - dt * v_v;
 						v_v = this->sampleField(x, y, V_FIELD);
-						this->newV_v[i * n + j] = v_v;
+						newV[j] = v_v;
 					}
 				}
 			}
+		}
+
+		void advectSmoke(const Real dt)
+		{
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				advectSmokeColumns(dt, begin, end);
+			});
+			swapScalars();
+		}
+
+		// Swaps smoke, the fine smoke grid and every scalar channel with its advected copy.
+		void swapScalars()
+		{
+			std::swap(this->smoke, this->newSmoke);
+			std::swap(this->fineSmoke, this->newFineSmoke);
+			for (std::size_t c = 0; c < numScalars; c++)
+				std::swap(this->scalars[c], this->newScalars[c]);
+		}
 
-			this->h_v = this->newH_v;
-			this->v_v = this->newV_v;
+		// Writes newSmoke and every new scalar channel for the columns [begin, end). Each
+		// cell is traced back once and all channels are interpolated from the same stencil,
+		// so a channel costs its loads and stores rather than another advection pass.
+		void advectSmokeColumns(const Real dt, const std::size_t begin, const std::size_t end)
+		{
+			advectSmokeColumns(dt, begin, end, this->h_v, this->v_v);
 		}
 
-		void advectSmoke(const float dt)
+		// advectSmokeColumns() with the velocities taken from `uPlane` and `vPlane`, which
+		// may be the not yet swapped output of advectVelColumns().
+		void advectSmokeColumns(const Real dt, const std::size_t begin, const std::size_t end,
+			const FieldPlane<Real>& uPlane, const FieldPlane<Real>& vPlane)
 		{
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const std::size_t origin = columnOrigin;
+			Real h = this->h;
+			Real h2 = Real(0.5) * h;
+
+			const std::size_t channels = numScalars;
+			const bool coarseSmoke = smokeRefinement == 1;
+
+			if (coarseSmoke)
+				std::copy(this->smoke.data() + begin * n, this->smoke.data() + end * n, this->newSmoke.data() + begin * n);
+			for (std::size_t c = 0; c < channels; c++)
+				std::copy(this->scalars[c].data() + begin * n, this->scalars[c].data() + end * n, this->newScalars[c].data() + begin * n);
+
+			for (std::size_t i = std::max<std::size_t>(begin, 1); i < std::min(end, lastX) && (coarseSmoke || channels > 0); i++) {
+				const Real* s = this->solid.data() + i * n;
+				const Real* u = uPlane.data() + i * n;
+				const Real* uRight = u + n;
+				const Real* v = vPlane.data() + i * n;
+				SmokeT* newS = this->newSmoke.data() + i * n;
+
+				for (std::size_t j = 1; j < n - 1; j++) {
+
+					if (s[j] != Real(0)) {
+						Real h_v = (u[j] + uRight[j]) * Real(0.5);
+						Real v_v = (v[j] + v[j + 1]) * Real(0.5);
+						Real x = (i + origin) * h + h2 - dt * h_v;
+						Real y = j * h + h2 - dt * v_v;
+
+						const Stencil stencil = stencilAt(x, y, h2, h2);
+						if (coarseSmoke)
+							newS[j] = interpolate(this->smoke, stencil);
+						for (std::size_t c = 0; c < channels; c++)
+							this->newScalars[c][i * n + j] = interpolate(this->scalars[c], stencil);
+					}
+				}
+			}
 
-			this->newSmoke = this->smoke;
+			if (!coarseSmoke)
+				advectFineSmokeColumns(dt, begin, end, uPlane, vPlane);
+		}
+
+		// Advects the fine smoke cells of the coarse columns [begin, end) and writes their box
+		// averages to newSmoke. Each fine cell is traced back with the velocity bilinearly
+		// interpolated at its centre, as sampleField() does, so it reads u of columns i and
+		// i + 1 and v of columns i - 1 to i + 1.
+		void advectFineSmokeColumns(const Real dt, const std::size_t begin, const std::size_t end,
+			const FieldPlane<Real>& uPlane, const FieldPlane<Real>& vPlane)
+		{
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const std::size_t k = smokeRefinement;
+			const std::size_t fineX = fineSizeX();
+			const std::size_t fn = fineSizeY();
+			Real h2 = Real(0.5) * this->h;
+			Real fineH = this->h / static_cast<Real>(k);
+			Real fineH2 = Real(0.5) * fineH;
+
+			std::copy(this->fineSmoke.data() + begin * k * fn, this->fineSmoke.data() + end * k * fn, this->newFineSmoke.data() + begin * k * fn);
+
+			for (std::size_t i = std::max<std::size_t>(begin, 1); i < std::min(end, lastX); i++) {
+				const Real* s = this->solid.data() + i * n;
+
+				for (std::size_t a = 0; a < k; a++) {
+					const std::size_t fi = i * k + a;
+					const Real x = (fi + columnOrigin * k) * fineH + fineH2;
+					SmokeT* newS = this->newFineSmoke.data() + fi * fn;
+
+					for (std::size_t j = 1; j < n - 1; j++) {
+						if (s[j] == Real(0))
+							continue;
 
-			std::size_t n = this->numY;
-			float h = this->h;
-			float h2 = 0.5f * h;
+						for (std::size_t fj = j * k; fj < (j + 1) * k; fj++) {
+							const Real y = fj * fineH + fineH2;
+							const Real h_v = samplePlane(uPlane, x, y, Real(0), h2);
+							const Real v_v = samplePlane(vPlane, x, y, h2, Real(0));
 
-			for (std::size_t i = 1; i < this->numX - 1; i++) {
-				for (std::size_t j = 1; j < this->numY - 1; j++) {
+							const Stencil stencil = stencilOn(x - dt * h_v, y - dt * v_v, fineH2, fineH2, fineH, fineX, fn, columnOrigin * k);
+							newS[fj] = interpolate(this->fineSmoke, stencil);
+						}
+					}
+				}
+			}
 
-					if (this->solid[i * n + j] != 0.0f) {
-						float h_v = (this->h_v[i * n + j] + this->h_v[(i + 1) * n + j]) * 0.5f;
-						float v_v = (this->v_v[i * n + j] + this->v_v[i * n + j + 1]) * 0.5f;
-						float x = i * h + h2 - dt * h_v;
-						float y = j * h + h2 - dt * v_v;
+			const Real average = Real(1) / static_cast<Real>(k * k);
+			for (std::size_t i = begin; i < end; i++) {
+				SmokeT* coarse = this->newSmoke.data() + i * n;
 
-						this->newSmoke[i * n + j] = this->sampleField(x, y, S_FIELD);
+				for (std::size_t j = 0; j < n; j++) {
+					Real sum = 0;
+					for (std::size_t a = 0; a < k; a++) {
+						const SmokeT* fine = this->newFineSmoke.data() + (i * k + a) * fn + j * k;
+						for (std::size_t b = 0; b < k; b++)
+							sum += fine[b];
 					}
+					coarse[j] = sum * average;
 				}
 			}
-			this->smoke = this->newSmoke;
 		}
 
-		void simulate(const float dt, const float gravity, const std::size_t numIters) {
+		void simulate(const Real dt, const Real gravity, const std::size_t numIters) {
+
+			if (this->fused) {
+				this->simulateFused(dt, gravity, numIters);
+				return;
+			}
 
 			this->integrate(dt, gravity);
+			this->project(numIters, dt);
 
-			pressure.resize(this->numCells, 0.0f);
-			for (float& pressure : pressure)
-			{
-				pressure = 0.0f;
-			}
-			this->solveIncompressibility(numIters, dt);
+			for (BasicStepObserver<BasicFluid>* observer : this->observers)
+				observer->observe(*this, dt);
 
-			this->extrapolate();
+			this->extrapolate(dt);
 			this->advectVel(dt);
 			this->advectSmoke(dt);
 		}
 
+		// Makes the velocities divergence free with the solver the flags above select, so
+		// steppers other than simulate() (e.g. FlipSolver) project the same way.
+		void project(const std::size_t numIters, const Real dt) {
+
+			BoxDomain box;
+			if (this->spectral && this->boxDomain(box)) {
+				this->solveSpectral(box, dt);
+			}
+			else if (this->warmStart) {
+				this->solvePressure(numIters, dt);
+			}
+			else {
+				forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+					std::fill(this->pressure.data() + begin * this->numY, this->pressure.data() + end * this->numY, PressureT(0));
+				});
+				this->solveIncompressibility(numIters, dt);
+			}
+		}
+
+		// The same step as simulate() in fewer passes over memory. Without confinement,
+		// gravity and the pressure reset are applied column by column inside the solver's
+		// first half sweep; extrapolate() only touches the boundary rows; and velocity and
+		// smoke advection share one chunked sweep in which smoke trails one column behind,
+		// reading the new velocities while they are still cached.
+		void simulateFused(const Real dt, const Real gravity, const std::size_t numIters) {
+
+			const std::size_t n = sizeY();
+			const std::size_t lastX = sizeX() - 1;
+			const Real cp = this->density * this->h / dt;
+
+			BoxDomain box;
+			if (this->spectral && this->boxDomain(box)) {
+				this->integrate(dt, gravity);
+				this->solveSpectral(box, dt);
+			}
+			else if (this->warmStart) {
+				this->integrate(dt, gravity);
+				this->solvePressure(numIters, dt);
+			}
+			else if (numIters == 0) {
+				this->integrate(dt, gravity);
+				this->pressure.fill(PressureT(0));
+			}
+			else if (this->vorticityConfinement != Real(0)) {
+				// The force on a face needs the curl two columns away, which the sweep below
+				// may already be relaxing on another worker: integrate in its own pass.
+				this->integrate(dt, gravity);
+				this->project(numIters, dt);
+			}
+			else {
+				const bool tuning = beginTuning();
+
+				// Column by column: integrate, reset the pressure, relax the colour-0 cells. The
+				// relaxation of column i writes h_v of columns i and i + 1, but only in rows of
+				// its own colour, which no other colour-0 cell touches, and reads v_v of column i
+				// alone. Without confinement integration writes only v_v of its own column and
+				// reads no h_v, so every column is integrated before its relaxation reads it and
+				// no neighbour's integration or relaxation changes what either reads. This equals
+				// integrate() followed by a whole half sweep for any split among the workers.
+				forColumns(1, lastX, [&](const std::size_t begin, const std::size_t end) {
+					for (std::size_t i = begin; i < end; i++) {
+						integrateColumns(dt, gravity, i, i + 1);
+						std::fill(this->pressure.data() + i * n, this->pressure.data() + (i + 1) * n, PressureT(0));
+						solveColourColumns(0, cp, i, i + 1);
+					}
+				});
+				integrateColumns(dt, gravity, lastX, lastX + 1);
+				std::fill(this->pressure.data(), this->pressure.data() + n, PressureT(0));
+				std::fill(this->pressure.data() + lastX * n, this->pressure.data() + (lastX + 1) * n, PressureT(0));
+
+				solveColour(1, cp);
+				for (std::size_t iter = 1; iter < numIters; iter++) {
+					solveColour(0, cp);
+					solveColour(1, cp);
+				}
+
+				this->solveStats = SolveStats();
+				this->solveStats.iterations = numIters;
+				this->solveStats.omega = static_cast<float>(overRelaxation);
+
+				if (tuning)
+					endTuning();
+			}
+
+			for (BasicStepObserver<BasicFluid>* observer : this->observers)
+				observer->observe(*this, dt);
+
+			this->extrapolate(dt);
+			this->advectFused(dt);
+		}
+
+		// advectVel() and advectSmoke() in one sweep. Smoke in column i needs the new velocity
+		// of column i + 1, so each worker leaves the last column of its strip for a second,
+		// one-column pass after all strips are done. Fine smoke also reads column i - 1, so
+		// with refinement the first column of every strip waits for that pass as well.
+		void advectFused(const Real dt) {
+
+			const std::size_t chunk = std::max<std::size_t>(1, (64 * 1024) / (sizeY() * sizeof(Real)));
+			const std::size_t lead = smokeRefinement > 1 ? 1 : 0;
+
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				std::size_t smokeBegin = std::min(begin + lead, end);
+				for (std::size_t first = begin; first < end; first += chunk) {
+					const std::size_t last = std::min(first + chunk, end);
+					advectVelColumns(dt, first, last);
+					if (smokeBegin < last - 1) {
+						advectSmokeColumns(dt, smokeBegin, last - 1, this->newH_v, this->newV_v);
+						smokeBegin = last - 1;
+					}
+				}
+			});
+
+			forColumns(0, this->numX, [&](const std::size_t begin, const std::size_t end) {
+				if (lead && begin + 1 < end)
+					advectSmokeColumns(dt, begin, begin + 1, this->newH_v, this->newV_v);
+				if (begin < end)
+					advectSmokeColumns(dt, end - 1, end, this->newH_v, this->newV_v);
+			});
+
+			std::swap(this->h_v, this->newH_v);
+			std::swap(this->v_v, this->newV_v);
+			swapScalars();
+		}
+
+	private:
+		// Confinement force in cell (i, j) from the curl plane; zero on the border. The
+		// 1 / 2h of the central differences cancels in the normalisation of N.
+		void confinementForce(const std::size_t i, const std::size_t j, Real& fx, Real& fy) const
+		{
+			fx = fy = Real(0);
+			if (i == 0 || j == 0 || i >= sizeX() - 1 || j >= sizeY() - 1)
+				return;
+
+			const std::size_t n = sizeY();
+			const Real* w = m_curl.data() + i * n;
+			const Real* wLeft = w - n;
+			const Real* wRight = w + n;
+			const Real gx = std::abs(wRight[j]) - std::abs(wLeft[j]);
+			const Real gy = std::abs(w[j + 1]) - std::abs(w[j - 1]);
+			const Real length = std::sqrt(gx * gx + gy * gy);
+			if (length == Real(0))
+				return;
+
+			const Real scale = vorticityConfinement * this->h * w[j] / length;
+			fx = scale * gy;
+			fy = -scale * gx;
+		}
+
+		std::unique_ptr<SpectralPoisson> m_spectral;
+
+		std::vector<Real> m_probe;
+		std::vector<Real> m_curl;
+		std::size_t m_tuningFrame = 0;
+		bool m_tuned = false;
+		bool m_useTable = true;
+		bool m_closedDomain = false;
+		bool m_tuning = false;
 	};
 
+	using Fluid = BasicFluid<>;
+	using StepObserver = BasicStepObserver<Fluid>;
+
+	// Fluid whose interior size is checked against NX x NY, e.g. FixedFluid<256, 128>. It
+	// runs the same code as Fluid.
+	template<std::size_t NX, std::size_t NY, typename Real = float>
+	using FixedFluid = BasicFluid<Real, Real, Real, NX, NY>;
 
-	class IntegratorEuler : public Integrator
+
+	template<typename Real>
+	class BasicIntegratorEuler : public BasicIntegrator<Real>
 	{
 	public:
 
-		void integrate(float& value, float dt, const float gravity) override
+		void integrate(Real& value, Real dt, const Real gravity) override
 		{
 			value += gravity * dt;
 		}
 	};
 
+	using IntegratorEuler = BasicIntegratorEuler<float>;
+
 
 	struct RigidBody
 	{
@@ -298,7 +1748,8 @@ namespace FluidSims
 			none,
 			circle,
 			square,
-			triangle
+			triangle,
+			shape	// an ObstacleShape loaded from a file
 		};
 
 		type_t type;
@@ -0,0 +1,434 @@
+#pragma once
+
+#include "fluid_threads.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Complex DFT of a fixed length, X_k = sum_n x_n e^(-2 pi i k n / L). Powers of two use an
+	// iterative radix-2 transform; other lengths go through Bluestein's chirp-z algorithm on
+	// a power-of-two transform of at least 2L - 1 points, so every length is O(L log L).
+	class Fft
+	{
+	public:
+		using Complex = std::complex<double>;
+
+		explicit Fft(const std::size_t length = 1)
+			: m_length(std::max<std::size_t>(1, length))
+		{
+			if (isPowerOfTwo(m_length)) {
+				m_size = m_length;
+				m_twiddles = twiddlesFor(m_size);
+				return;
+			}
+
+			m_size = 1;
+			while (m_size < 2 * m_length - 1)
+				m_size *= 2;
+			m_twiddles = twiddlesFor(m_size);
+
+			// w_n = e^(-i pi n^2 / L); n^2 is reduced mod 2L so large n keep their precision.
+			const double pi = std::acos(-1.0);
+			m_chirp.resize(m_length);
+			for (std::size_t k = 0; k < m_length; k++) {
+				const std::size_t square = (k * k) % (2 * m_length);
+				m_chirp[k] = std::polar(1.0, -pi * static_cast<double>(square) / static_cast<double>(m_length));
+			}
+
+			m_kernel.assign(m_size, Complex(0.0, 0.0));
+			m_kernel[0] = std::conj(m_chirp[0]);
+			for (std::size_t k = 1; k < m_length; k++) {
+				m_kernel[k] = std::conj(m_chirp[k]);
+				m_kernel[m_size - k] = std::conj(m_chirp[k]);
+			}
+			radix2(m_kernel.data(), false);
+		}
+
+		std::size_t length() const { return m_length; }
+
+		// Complex elements of scratch transform() needs.
+		std::size_t scratchSize() const { return m_chirp.empty() ? 0 : m_size; }
+
+		// In place; `scratch` may be null for power-of-two lengths.
+		void transform(Complex* data, Complex* scratch) const
+		{
+			if (m_chirp.empty()) {
+				radix2(data, false);
+				return;
+			}
+
+			for (std::size_t k = 0; k < m_length; k++)
+				scratch[k] = data[k] * m_chirp[k];
+			std::fill(scratch + m_length, scratch + m_size, Complex(0.0, 0.0));
+
+			radix2(scratch, false);
+			for (std::size_t k = 0; k < m_size; k++)
+				scratch[k] *= m_kernel[k];
+			radix2(scratch, true);
+
+			const double scale = 1.0 / static_cast<double>(m_size);
+			for (std::size_t k = 0; k < m_length; k++)
+				data[k] = scratch[k] * m_chirp[k] * scale;
+		}
+
+	private:
+		static bool isPowerOfTwo(const std::size_t n) { return (n & (n - 1)) == 0; }
+
+		static std::vector<Complex> twiddlesFor(const std::size_t size)
+		{
+			const double pi = std::acos(-1.0);
+			std::vector<Complex> twiddles(size / 2);
+			for (std::size_t k = 0; k < twiddles.size(); k++)
+				twiddles[k] = std::polar(1.0, -2.0 * pi * static_cast<double>(k) / static_cast<double>(size));
+			return twiddles;
+		}
+
+		// Unnormalized transform of m_size points; `inverse` flips the sign of the exponent.
+		void radix2(Complex* data, const bool inverse) const
+		{
+			const std::size_t n = m_size;
+
+			for (std::size_t i = 1, j = 0; i < n; i++) {
+				std::size_t bit = n >> 1;
+				for (; j & bit; bit >>= 1)
+					j ^= bit;
+				j ^= bit;
+				if (i < j)
+					std::swap(data[i], data[j]);
+			}
+
+			for (std::size_t half = 1; half < n; half *= 2) {
+				const std::size_t stride = n / (2 * half);
+				for (std::size_t block = 0; block < n; block += 2 * half) {
+					for (std::size_t k = 0; k < half; k++) {
+						const Complex w = inverse ? std::conj(m_twiddles[k * stride]) : m_twiddles[k * stride];
+						const Complex odd = data[block + k + half] * w;
+						data[block + k + half] = data[block + k] - odd;
+						data[block + k] += odd;
+					}
+				}
+			}
+		}
+
+		std::size_t m_length = 1;
+		std::size_t m_size = 1;
+		std::vector<Complex> m_twiddles;
+		std::vector<Complex> m_chirp;
+		std::vector<Complex> m_kernel;
+	};
+
+	enum box_side_t
+	{
+		BOX_WALL = 0,	// solid border cells: zero normal velocity, dp/dn = 0
+		BOX_OPEN = 1	// fluid border cells: p = 0
+	};
+
+	struct BoxDomain
+	{
+		box_side_t left = BOX_WALL;
+		box_side_t right = BOX_WALL;
+		box_side_t bottom = BOX_WALL;
+		box_side_t top = BOX_WALL;
+
+		bool operator==(const BoxDomain& other) const
+		{
+			return left == other.left && right == other.right && bottom == other.bottom && top == other.top;
+		}
+	};
+
+	// Direct solver for the 5-point pressure Poisson problem on a rectangle of fluid cells,
+	// sum_nb s_nb * (p - p_nb) = rhs, with each side a wall or open (see BoxDomain). The
+	// operator separates: along y (the contiguous axis) it is diagonalized by a DCT-II when
+	// both ends are walls and by a DST-I when both are open, each computed from one complex
+	// FFT per pair of columns; every y mode then leaves a tridiagonal system along x, which
+	// takes either kind of end. Domains whose bottom and top differ are not supported.
+	//
+	// Transforms run in parallel over columns, the tridiagonal solves over modes. The
+	// all-wall problem is singular; its constant mode is projected out and the solution
+	// returned with zero mean.
+	class SpectralPoisson
+	{
+	public:
+		using Complex = Fft::Complex;
+
+		// numX and numY are the number of fluid cells.
+		SpectralPoisson(const std::size_t numX, const std::size_t numY, const BoxDomain& domain)
+			: m_numX(numX), m_numY(numY), m_domain(domain),
+			m_fft(transformLength(numY, domain)),
+			m_values(numX * numY), m_gains(numX * numY), m_eigenvalues(numY)
+		{
+			assert(supports(domain) && "bottom and top of the box must be of the same kind");
+
+			const double pi = std::acos(-1.0);
+			const std::size_t n = numY;
+
+			if (domain.bottom == BOX_WALL) {
+				m_shifts.resize(n);
+				for (std::size_t k = 0; k < n; k++) {
+					m_eigenvalues[k] = 2.0 - 2.0 * std::cos(pi * static_cast<double>(k) / static_cast<double>(n));
+					m_shifts[k] = std::polar(1.0, 0.5 * pi * static_cast<double>(k) / static_cast<double>(n));
+				}
+			}
+			else {
+				for (std::size_t k = 0; k < n; k++)
+					m_eigenvalues[k] = 2.0 - 2.0 * std::cos(pi * static_cast<double>(k + 1) / static_cast<double>(n + 1));
+			}
+		}
+
+		static bool supports(const BoxDomain& domain)
+		{
+			return domain.bottom == domain.top;
+		}
+
+		std::size_t numX() const { return m_numX; }
+		std::size_t numY() const { return m_numY; }
+		const BoxDomain& domain() const { return m_domain; }
+
+		// Right-hand side before solve(), solution after; column i starts at data() + i * numY().
+		double* data() { return m_values.data(); }
+
+		void solve(ThreadPool* pool)
+		{
+			const std::size_t pairs = (m_numX + 1) / 2;
+
+			forRange(pool, pairs, [&](const std::size_t begin, const std::size_t end) {
+				std::vector<Complex> line(m_fft.length());
+				std::vector<Complex> scratch(m_fft.scratchSize());
+				for (std::size_t pair = begin; pair < end; pair++)
+					forwardPair(2 * pair, line.data(), scratch.data());
+			});
+
+			forRange(pool, m_numY, [&](const std::size_t begin, const std::size_t end) {
+				solveModes(begin, end);
+			});
+
+			forRange(pool, pairs, [&](const std::size_t begin, const std::size_t end) {
+				std::vector<Complex> line(m_fft.length());
+				std::vector<Complex> scratch(m_fft.scratchSize());
+				for (std::size_t pair = begin; pair < end; pair++)
+					inversePair(2 * pair, line.data(), scratch.data());
+			});
+		}
+
+	private:
+		// Length of the symmetric (DCT-II) or antisymmetric (DST-I) extension of a column.
+		static std::size_t transformLength(const std::size_t numY, const BoxDomain& domain)
+		{
+			return domain.bottom == BOX_WALL ? 2 * numY : 2 * (numY + 1);
+		}
+
+		template<typename Fn>
+		static void forRange(ThreadPool* pool, const std::size_t count, Fn&& fn)
+		{
+			if (!pool) {
+				fn(0, count);
+				return;
+			}
+
+			pool->parallelFor(count, 0, count, [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				fn(begin, end);
+			});
+		}
+
+		// Columns `first` and first + 1 (if any) go through one complex FFT as the real and
+		// imaginary parts; both extensions are real, so the two spectra separate by symmetry.
+		void forwardPair(const std::size_t first, Complex* line, Complex* scratch)
+		{
+			const std::size_t n = m_numY;
+			const std::size_t length = m_fft.length();
+			double* a = m_values.data() + first * n;
+			double* b = first + 1 < m_numX ? a + n : nullptr;
+
+			extend(a, b, line);
+			m_fft.transform(line, scratch);
+
+			for (std::size_t k = 0; k < n; k++) {
+				// DCT-II modes are k = 0..n-1, DST-I modes k = 1..n.
+				const std::size_t mode = m_shifts.empty() ? k + 1 : k;
+				const Complex z = line[mode];
+				const Complex mirror = std::conj(line[(length - mode) % length]);
+				const Complex spectrumA = 0.5 * (z + mirror);
+				const Complex spectrumB = Complex(0.0, -0.5) * (z - mirror);
+
+				if (m_shifts.empty()) {
+					a[k] = -0.5 * spectrumA.imag();
+					if (b)
+						b[k] = -0.5 * spectrumB.imag();
+				}
+				else {
+					const Complex shift = std::conj(m_shifts[k]);
+					a[k] = 0.5 * (spectrumA * shift).real();
+					if (b)
+						b[k] = 0.5 * (spectrumB * shift).real();
+				}
+			}
+		}
+
+		void inversePair(const std::size_t first, Complex* line, Complex* scratch)
+		{
+			const std::size_t n = m_numY;
+			const std::size_t length = m_fft.length();
+			double* a = m_values.data() + first * n;
+			double* b = first + 1 < m_numX ? a + n : nullptr;
+
+			if (m_shifts.empty()) {
+				// DST-I is its own inverse up to a factor 2 / (n + 1).
+				extend(a, b, line);
+				m_fft.transform(line, scratch);
+
+				const double scale = -1.0 / static_cast<double>(n + 1);
+				for (std::size_t j = 0; j < n; j++) {
+					const Complex z = line[j + 1];
+					const Complex mirror = std::conj(line[length - j - 1]);
+					a[j] = scale * (0.5 * (z + mirror)).imag();
+					if (b)
+						b[j] = scale * (Complex(0.0, -0.5) * (z - mirror)).imag();
+				}
+				return;
+			}
+
+			// DCT-III as the conjugate FFT of a Hermitian spectrum per column; the two
+			// spectra combine as A + iB, so the real and imaginary parts of the result are
+			// the two columns.
+			const double scale = 1.0 / static_cast<double>(n);
+			line[n] = Complex(0.0, 0.0);
+			for (std::size_t k = 0; k < n; k++) {
+				const Complex zA = a[k] * scale * m_shifts[k];
+				const Complex zB = b ? b[k] * scale * m_shifts[k] : Complex(0.0, 0.0);
+				line[k] = std::conj(zA + Complex(0.0, 1.0) * zB);
+				if (k > 0)
+					line[length - k] = std::conj(std::conj(zA) + Complex(0.0, 1.0) * std::conj(zB));
+			}
+
+			m_fft.transform(line, scratch);
+
+			for (std::size_t j = 0; j < n; j++) {
+				const Complex z = std::conj(line[j]);
+				a[j] = z.real();
+				if (b)
+					b[j] = z.imag();
+			}
+		}
+
+		// Writes the extension of columns a (real part) and b (imaginary part) to `line`.
+		void extend(const double* a, const double* b, Complex* line) const
+		{
+			const std::size_t n = m_numY;
+			const std::size_t length = m_fft.length();
+
+			if (m_shifts.empty()) {
+				line[0] = Complex(0.0, 0.0);
+				line[n + 1] = Complex(0.0, 0.0);
+				for (std::size_t j = 0; j < n; j++) {
+					const Complex value(a[j], b ? b[j] : 0.0);
+					line[j + 1] = value;
+					line[length - j - 1] = -value;
+				}
+				return;
+			}
+
+			for (std::size_t j = 0; j < n; j++) {
+				const Complex value(a[j], b ? b[j] : 0.0);
+				line[j] = value;
+				line[length - j - 1] = value;
+			}
+		}
+
+		// Thomas algorithm along x for the modes [begin, end), all modes advancing together
+		// so every step reads one contiguous run of each column.
+		void solveModes(const std::size_t begin, const std::size_t end)
+		{
+			const std::size_t n = m_numY;
+			const std::size_t last = m_numX - 1;
+			const double leftWall = m_domain.left == BOX_WALL ? 1.0 : 0.0;
+			const double rightWall = m_domain.right == BOX_WALL ? 1.0 : 0.0;
+
+			std::size_t first = begin;
+			if (begin == 0 && m_domain.bottom == BOX_WALL && m_domain.left == BOX_WALL && m_domain.right == BOX_WALL) {
+				solveConstantMode();
+				first = 1;
+			}
+
+			for (std::size_t i = 0; i <= last; i++) {
+				double* d = m_values.data() + i * n;
+				double* g = m_gains.data() + i * n;
+				const double* dPrev = d - n;
+				const double* gPrev = g - n;
+
+				for (std::size_t k = first; k < end; k++) {
+					double diagonal = 2.0 + m_eigenvalues[k];
+					if (i == 0)
+						diagonal -= leftWall;
+					if (i == last)
+						diagonal -= rightWall;
+
+					if (i > 0) {
+						diagonal -= gPrev[k];
+						d[k] += dPrev[k];
+					}
+
+					g[k] = 1.0 / diagonal;
+					d[k] *= g[k];
+				}
+			}
+
+			for (std::size_t i = last; i-- > 0;) {
+				double* d = m_values.data() + i * n;
+				const double* g = m_gains.data() + i * n;
+				const double* dNext = d + n;
+
+				for (std::size_t k = first; k < end; k++)
+					d[k] += g[k] * dNext[k];
+			}
+		}
+
+		// Mode 0 of the all-wall box: the x operator alone, which is singular. The mean of the
+		// right-hand side is removed (it is zero when the boundary flux balances), the first
+		// value pinned and the rest follow row by row.
+		void solveConstantMode()
+		{
+			const std::size_t n = m_numY;
+			double* d = m_values.data();
+
+			double mean = 0.0;
+			for (std::size_t i = 0; i < m_numX; i++)
+				mean += d[i * n];
+			mean /= static_cast<double>(m_numX);
+
+			double previous = 0.0;
+			double current = 0.0;
+			double sum = 0.0;
+			for (std::size_t i = 0; i < m_numX; i++) {
+				const double rhs = d[i * n] - mean;
+				d[i * n] = current;
+				sum += current;
+
+				const double next = (i == 0 ? 1.0 : 2.0) * current - (i == 0 ? 0.0 : previous) - rhs;
+				previous = current;
+				current = next;
+			}
+
+			sum /= static_cast<double>(m_numX);
+			for (std::size_t i = 0; i < m_numX; i++)
+				d[i * n] -= sum;
+		}
+
+		std::size_t m_numX = 0;
+		std::size_t m_numY = 0;
+		BoxDomain m_domain;
+		Fft m_fft;
+		std::vector<double> m_values;
+		std::vector<double> m_gains;
+		std::vector<double> m_eigenvalues;
+		std::vector<Complex> m_shifts;	// e^(i pi k / 2n), DCT-II only
+	};
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "fluid_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace FluidSims
+{
+
+	// 16-bit storage types for field planes. They convert implicitly to and from float, so
+	// kernels load, compute in float registers and store back; only the planes shrink.
+
+	// IEEE 754 binary16: ~3 significant digits, range +-65504. Uses F16C where the compiler
+	// targets it (-mf16c or -march=native on x86) and the portable Codec routines elsewhere.
+	struct Half
+	{
+		std::uint16_t bits = 0;
+
+		Half() = default;
+		Half(const float value) : bits(fromFloat(value)) {}
+
+		operator float() const { return toFloat(bits); }
+
+		static std::uint16_t fromFloat(const float value)
+		{
+#if defined(__F16C__)
+			return static_cast<std::uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+			return Codec::floatToHalf(value);
+#endif
+		}
+
+		static float toFloat(const std::uint16_t bits)
+		{
+#if defined(__F16C__)
+			return _cvtsh_ss(bits);
+#else
+			return Codec::halfToFloat(bits);
+#endif
+		}
+	};
+
+	// The upper half of a float: float's range with ~2 significant digits. Rounds to nearest even.
+	struct BFloat16
+	{
+		std::uint16_t bits = 0;
+
+		BFloat16() = default;
+		BFloat16(const float value) : bits(fromFloat(value)) {}
+
+		operator float() const { return toFloat(bits); }
+
+		static std::uint16_t fromFloat(const float value)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+
+			if (std::isnan(value))
+				return static_cast<std::uint16_t>((bits >> 16) | 0x40u);
+
+			bits += 0x7fffu + ((bits >> 16) & 1u);
+			return static_cast<std::uint16_t>(bits >> 16);
+		}
+
+		static float toFloat(const std::uint16_t bits)
+		{
+			const std::uint32_t wide = static_cast<std::uint32_t>(bits) << 16;
+			float value;
+			std::memcpy(&value, &wide, sizeof(value));
+			return value;
+		}
+	};
+
+	// Fixed point in [0, 1] with a uniform step of 1 / 65535, for bounded fields such as
+	// smoke. Values outside the range are clamped, NaN to 0.
+	struct UNorm16
+	{
+		std::uint16_t bits = 0;
+
+		UNorm16() = default;
+		UNorm16(const float value) : bits(fromFloat(value)) {}
+
+		operator float() const { return toFloat(bits); }
+
+		static std::uint16_t fromFloat(const float value)
+		{
+			if (!(value > 0.0f))
+				return 0;
+			return static_cast<std::uint16_t>(std::min(value, 1.0f) * 65535.0f + 0.5f);
+		}
+
+		static float toFloat(const std::uint16_t bits)
+		{
+			return bits * (1.0f / 65535.0f);
+		}
+	};
+
+}
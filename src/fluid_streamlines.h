@@ -0,0 +1,178 @@
+#pragma once
+
+#include "fluid_tracers.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Streamlines of a Fluid's current velocity from a fixed set of seeds, for drawing. Every
+	// line is `numSegments` RK4 steps of `segmentTime` seconds. All seeds advance together,
+	// one segment at a time, in batches of VelocitySampler::batchSize sampled per batch, and
+	// the batches are split among the pool's workers.
+	//
+	// trace() writes GL_LINES vertices of 6 floats (position, colour) into a buffer of fixed
+	// size, numSeeds() * numSegments * 2 vertices: segment s of seed k starts at vertex
+	// 2 * (k * numSegments + s). A line that leaves the fluid repeats its last point, so its
+	// remaining segments have zero length and draw nothing.
+	class StreamlineTracer
+	{
+	public:
+		// Maps (x, y), in the units of Fluid::sampleField(), to the vertex
+		// (x * scale + offsetX, y * scale + offsetY, z).
+		struct LineStyle
+		{
+			float scale = 1.0f;
+			float offsetX = 0.0f;
+			float offsetY = 0.0f;
+			float z = 0.0f;
+			float colour[3] = { 0.0f, 0.0f, 0.0f };
+		};
+
+		std::size_t numSegments = 5;
+		float segmentTime = 0.02f;
+
+		// Seeds at the centre of every `seedStride`-th interior cell along both axes.
+		std::size_t seedStride = 5;
+
+		std::vector<float> seedX, seedY;
+
+		explicit StreamlineTracer(const Fluid& fluid)
+			: m_fluid(fluid),
+			m_sampler(fluid)
+		{
+		}
+
+		std::size_t numSeeds() const { return seedX.size(); }
+
+		// Rebuilds the seeds; trace() calls it when the grid or the stride changed.
+		void seedGrid()
+		{
+			const Fluid& fluid = m_fluid;
+			const std::size_t stride = std::max<std::size_t>(seedStride, 1);
+
+			seedX.clear();
+			seedY.clear();
+			for (std::size_t i = 1; i < fluid.numX - 1; i += stride) {
+				for (std::size_t j = 1; j < fluid.numY - 1; j += stride) {
+					seedX.push_back((i + 0.5f) * fluid.h);
+					seedY.push_back((j + 0.5f) * fluid.h);
+				}
+			}
+
+			m_seededX = fluid.numX;
+			m_seededY = fluid.numY;
+			m_seededStride = seedStride;
+		}
+
+		void trace(const LineStyle& style, std::vector<float>& lines)
+		{
+			const Fluid& fluid = m_fluid;
+			if (m_seededX != fluid.numX || m_seededY != fluid.numY || m_seededStride != seedStride)
+				seedGrid();
+
+			const std::size_t count = numSeeds();
+			const std::size_t lineFloats = numSegments * 2 * vertexFloats;
+			lines.resize(count * lineFloats);
+
+			if (!fluid.pool) {
+				traceSeeds(style, lines.data(), 0, count);
+				return;
+			}
+
+			fluid.pool->parallelFor(count, 0, count, [&](std::size_t, const std::size_t begin, const std::size_t end) {
+				traceSeeds(style, lines.data(), begin, end);
+			});
+		}
+
+	private:
+		static constexpr std::size_t vertexFloats = 6;
+		static constexpr std::size_t batchSize = VelocitySampler::batchSize;
+
+		void traceSeeds(const LineStyle& style, float* lines, const std::size_t begin, const std::size_t end) const
+		{
+			const Fluid& fluid = m_fluid;
+			const float dt = segmentTime;
+			const float minX = fluid.h, minY = fluid.h;
+			const float maxX = (fluid.numX - 1) * fluid.h;
+			const float maxY = (fluid.numY - 1) * fluid.h;
+
+			float x[batchSize], y[batchSize], px[batchSize], py[batchSize];
+			float u[batchSize], v[batchSize], su[batchSize], sv[batchSize];
+			bool inside[batchSize];
+
+			for (std::size_t first = begin; first < end; first += batchSize) {
+				const std::size_t size = std::min(batchSize, end - first);
+				std::copy(seedX.begin() + first, seedX.begin() + first + size, x);
+				std::copy(seedY.begin() + first, seedY.begin() + first + size, y);
+				std::fill(inside, inside + size, true);
+
+				for (std::size_t segment = 0; segment < numSegments; segment++) {
+
+					// Classic RK4: su, sv accumulate k1 + 2 k2 + 2 k3 + k4.
+					m_sampler.sample(x, y, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						su[k] = u[k];
+						sv[k] = v[k];
+						px[k] = x[k] + 0.5f * dt * u[k];
+						py[k] = y[k] + 0.5f * dt * v[k];
+					}
+
+					m_sampler.sample(px, py, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						su[k] += 2.0f * u[k];
+						sv[k] += 2.0f * v[k];
+						px[k] = x[k] + 0.5f * dt * u[k];
+						py[k] = y[k] + 0.5f * dt * v[k];
+					}
+
+					m_sampler.sample(px, py, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						su[k] += 2.0f * u[k];
+						sv[k] += 2.0f * v[k];
+						px[k] = x[k] + dt * u[k];
+						py[k] = y[k] + dt * v[k];
+					}
+
+					m_sampler.sample(px, py, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						float* vertex = lines + ((first + k) * numSegments + segment) * 2 * vertexFloats;
+						writeVertex(style, vertex, x[k], y[k]);
+
+						if (inside[k]) {
+							px[k] = x[k] + dt / 6.0f * (su[k] + u[k]);
+							py[k] = y[k] + dt / 6.0f * (sv[k] + v[k]);
+							inside[k] = px[k] >= minX && px[k] <= maxX && py[k] >= minY && py[k] <= maxY;
+							if (inside[k]) {
+								x[k] = px[k];
+								y[k] = py[k];
+							}
+						}
+
+						writeVertex(style, vertex + vertexFloats, x[k], y[k]);
+					}
+				}
+			}
+		}
+
+		static void writeVertex(const LineStyle& style, float* vertex, const float x, const float y)
+		{
+			vertex[0] = x * style.scale + style.offsetX;
+			vertex[1] = y * style.scale + style.offsetY;
+			vertex[2] = style.z;
+			vertex[3] = style.colour[0];
+			vertex[4] = style.colour[1];
+			vertex[5] = style.colour[2];
+		}
+
+		const Fluid& m_fluid;
+		VelocitySampler m_sampler;
+
+		std::size_t m_seededX = 0;
+		std::size_t m_seededY = 0;
+		std::size_t m_seededStride = 0;
+	};
+
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace FluidSims
+{
+
+	// CPUs grouped by NUMA node. Machines without NUMA information report one node.
+	struct CpuTopology
+	{
+		std::vector<std::vector<int>> nodes;
+
+		std::size_t numCpus() const
+		{
+			std::size_t count = 0;
+			for (const std::vector<int>& cpus : nodes)
+				count += cpus.size();
+			return count;
+		}
+
+		static CpuTopology detect()
+		{
+			CpuTopology topology;
+
+#if defined(__linux__)
+			for (int node = 0;; node++) {
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (!file)
+					break;
+
+				std::string list;
+				std::getline(file, list);
+				topology.nodes.push_back(parseCpuList(list));
+			}
+#endif
+
+			if (topology.nodes.empty()) {
+				std::vector<int> cpus;
+				for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+					cpus.push_back(static_cast<int>(cpu));
+				topology.nodes.push_back(std::move(cpus));
+			}
+
+			return topology;
+		}
+
+		// Parses the kernel's "0-3,8-11" cpu list format.
+		static std::vector<int> parseCpuList(const std::string& list)
+		{
+			std::vector<int> cpus;
+			std::stringstream stream(list);
+			std::string range;
+
+			while (std::getline(stream, range, ',')) {
+				if (range.empty())
+					continue;
+
+				const std::size_t dash = range.find('-');
+				const int first = std::stoi(range.substr(0, dash));
+				const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+
+			return cpus;
+		}
+	};
+
+	inline bool pinCurrentThread(const int cpu)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		(void)cpu;
+		return false;
+#endif
+	}
+
+	// Static column-strip split of [0, count) for `worker` out of `numWorkers`.
+	inline std::pair<std::size_t, std::size_t> stripOf(const std::size_t count, const std::size_t worker, const std::size_t numWorkers)
+	{
+		const std::size_t base = count / numWorkers;
+		const std::size_t extra = count % numWorkers;
+		const std::size_t begin = worker * base + std::min(worker, extra);
+		return { begin, begin + base + (worker < extra ? 1 : 0) };
+	}
+
+	// Fixed set of workers that always receive the same strip of a range, so the memory a
+	// worker first-touches is the memory it keeps working on every sweep.
+	// The calling thread acts as worker 0. With `pin` it is pinned too, for the pool's
+	// lifetime: the destructor restores its previous affinity, so the pool should be
+	// destroyed on the thread that built it. A pool built on a thread that also drives a UI
+	// or a GL context should not pin.
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(std::size_t numThreads = 0, const bool pin = true)
+			: m_topology(CpuTopology::detect())
+		{
+			if (numThreads == 0)
+				numThreads = std::max<std::size_t>(1, m_topology.numCpus());
+
+			// Workers fill node 0 first, then node 1, ... so neighbouring strips share a socket.
+			std::vector<std::pair<int, int>> slots;
+			for (std::size_t node = 0; node < m_topology.nodes.size(); node++)
+				for (int cpu : m_topology.nodes[node])
+					slots.emplace_back(cpu, static_cast<int>(node));
+
+			for (std::size_t worker = 0; worker < numThreads; worker++) {
+				const std::pair<int, int>& slot = slots[worker % slots.size()];
+				m_cpus.push_back(pin ? slot.first : -1);
+				m_nodes.push_back(slot.second);
+			}
+
+			if (pin)
+				m_pinnedCaller = saveCallerAffinity() && pinCurrentThread(m_cpus[0]);
+
+			for (std::size_t worker = 1; worker < numThreads; worker++)
+				m_threads.emplace_back(&ThreadPool::workerLoop, this, worker);
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+
+			for (std::thread& thread : m_threads)
+				thread.join();
+
+			if (m_pinnedCaller)
+				restoreCallerAffinity();
+		}
+
+		std::size_t size() const { return m_cpus.size(); }
+		std::size_t numNodes() const { return m_topology.nodes.size(); }
+		int nodeOf(const std::size_t worker) const { return m_nodes[worker]; }
+		const CpuTopology& topology() const { return m_topology; }
+
+		// Runs job(worker) once on every worker and waits for all of them.
+		void run(const std::function<void(std::size_t)>& job)
+		{
+			if (m_threads.empty()) {
+				job(0);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_job = &job;
+				m_pending = m_threads.size();
+				m_generation++;
+			}
+			m_wake.notify_all();
+
+			job(0);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [this] { return m_pending == 0; });
+			m_job = nullptr;
+		}
+
+		// Splits [0, count) into one strip per worker and calls fn(worker, begin, end) with the
+		// part of the strip that falls inside [first, last).
+		template<typename Fn>
+		void parallelFor(const std::size_t count, const std::size_t first, const std::size_t last, Fn&& fn)
+		{
+			const std::size_t numWorkers = size();
+			run([&](const std::size_t worker) {
+				std::pair<std::size_t, std::size_t> strip = stripOf(count, worker, numWorkers);
+				strip.first = std::max(strip.first, first);
+				strip.second = std::min(strip.second, last);
+				if (strip.first < strip.second)
+					fn(worker, strip.first, strip.second);
+			});
+		}
+
+	private:
+		bool saveCallerAffinity()
+		{
+#if defined(__linux__)
+			m_caller = pthread_self();
+			return pthread_getaffinity_np(m_caller, sizeof(m_callerAffinity), &m_callerAffinity) == 0;
+#else
+			return false;
+#endif
+		}
+
+		void restoreCallerAffinity()
+		{
+#if defined(__linux__)
+			pthread_setaffinity_np(m_caller, sizeof(m_callerAffinity), &m_callerAffinity);
+#endif
+		}
+
+		void workerLoop(const std::size_t worker)
+		{
+			if (m_cpus[worker] >= 0)
+				pinCurrentThread(m_cpus[worker]);
+
+			std::size_t seen = 0;
+
+			for (;;) {
+				const std::function<void(std::size_t)>* job = nullptr;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+					if (m_stop)
+						return;
+					seen = m_generation;
+					job = m_job;
+				}
+
+				(*job)(worker);
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_pending == 0)
+					m_done.notify_one();
+			}
+		}
+
+		CpuTopology m_topology;
+		std::vector<int> m_cpus;
+		std::vector<int> m_nodes;
+		std::vector<std::thread> m_threads;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		const std::function<void(std::size_t)>* m_job = nullptr;
+		std::size_t m_pending = 0;
+		std::size_t m_generation = 0;
+		bool m_stop = false;
+
+		bool m_pinnedCaller = false;
+#if defined(__linux__)
+		pthread_t m_caller;
+		cpu_set_t m_callerAffinity;
+#endif
+	};
+
+}
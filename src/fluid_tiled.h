@@ -0,0 +1,216 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+
+namespace FluidSims
+{
+
+	// Steps a Fluid tile by tile, a tile being `tileColumns` full columns (columns are
+	// contiguous in every plane). Meant for fluids on a file-backed FieldArena that do not fit
+	// in memory: every phase streams through the tiles in order, prefetching the next
+	// `lookahead` tiles and evicting the ones behind the window, so about lookahead + 2 tiles
+	// of each plane are resident at a time. The tile before the current one stays resident
+	// because its last columns are the current tile's halo.
+	//
+	// The pressure solve runs up to tileColumns half sweeps per pass over the tiles, so each
+	// tile is read 2 * numIters / tileColumns times per solve instead of 2 * numIters times.
+	// Only the plain red-black solver is tiled: warm starts, the spectral solver and
+	// over-relaxation tuning each need the whole grid per pass and are asserted off. With
+	// them off, results are bit identical to Fluid::simulate.
+	class TiledStepper
+	{
+	public:
+		std::size_t tileColumns = 0;
+		std::size_t lookahead = 1;
+
+		// Picks the widest tile for which the window fits in `residentBytes`.
+		explicit TiledStepper(Fluid& fluid, const std::size_t residentBytes = std::size_t{ 1 } << 30)
+			: m_fluid(fluid)
+		{
+			tileColumns = columnsFor(fluid, residentBytes, lookahead);
+		}
+
+		static std::size_t columnsFor(const Fluid& fluid, const std::size_t residentBytes, const std::size_t lookahead)
+		{
+			const std::size_t k = fluid.smokeRefinement;
+			const std::size_t finePlanes = k > 1 ? 2 * k * k : 0;
+			const std::size_t columnBytes = (numPlanes + 2 * fluid.numScalars + finePlanes) * fluid.numY * sizeof(float);
+			return std::max<std::size_t>(1, residentBytes / (columnBytes * (lookahead + 2)));
+		}
+
+		std::size_t numTiles() const
+		{
+			return (m_fluid.numX + tileColumns - 1) / tileColumns;
+		}
+
+		void simulate(const float dt, const float gravity, const std::size_t numIters)
+		{
+			Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+
+			// The residual check and the tuning probe sweep the whole grid between iterations.
+			assert(!fluid.warmStart && fluid.tolerance == 0.0f && "warm starts are not tiled");
+			assert(!fluid.spectral && "the spectral solver is not tiled");
+			assert(!fluid.autoOverRelaxation && "over-relaxation tuning is not tiled");
+
+			// The confinement force on a face reads the curl of the next column, so the curl
+			// gets a pass of its own. The curl plane is not arena-backed and stays resident.
+			if (fluid.beginConfinement()) {
+				forTiles([&](const std::size_t begin, const std::size_t end) {
+					forSplit(begin, end, [&](const std::size_t first, const std::size_t last) {
+						fluid.curlColumns(first, last);
+					});
+				});
+			}
+
+			forTiles([&](const std::size_t begin, const std::size_t end) {
+				forSplit(begin, end, [&](const std::size_t first, const std::size_t last) {
+					fluid.integrateColumns(dt, gravity, std::max<std::size_t>(first, 1), last);
+					std::fill(fluid.pressure.data() + first * n, fluid.pressure.data() + last * n, 0.0f);
+				});
+			});
+
+			// Time-skewed red-black: one pass over the tiles runs `sweeps` half sweeps, sweep s
+			// of a pass lagging s columns behind the tile. Every sweep then only reads columns
+			// the previous sweep has finished and the next one has not reached yet, so the
+			// result equals sweeping the whole grid 2 * numIters times.
+			const float cp = fluid.density * fluid.h / dt;
+			const std::size_t totalSweeps = 2 * numIters;
+			const std::size_t sweeps = std::max<std::size_t>(1, std::min(totalSweeps, tileColumns));
+			for (std::size_t sweep = 0; sweep < totalSweeps; sweep += sweeps) {
+				const std::size_t count = std::min(sweeps, totalSweeps - sweep);
+
+				forTiles([&](const std::size_t begin, const std::size_t end) {
+					for (std::size_t s = 0; s < count; s++) {
+						const std::size_t first = begin == 0 ? 1 : begin - s;
+						const std::size_t last = end == fluid.numX ? fluid.numX - 1 : end - s;
+						forSplit(first, last, [&](const std::size_t from, const std::size_t to) {
+							fluid.solveColourColumns((sweep + s) % 2, cp, from, to);
+						});
+					}
+				});
+			}
+
+			// What the observers read, as Fluid::solveIncompressibility reports it.
+			fluid.solveStats = SolveStats();
+			fluid.solveStats.iterations = numIters;
+			fluid.solveStats.omega = fluid.overRelaxation;
+
+			for (StepObserver* observer : fluid.observers)
+				observer->observe(fluid, dt);
+
+			// Touches two cells per column and the two outermost column pairs; not worth tiling.
+			fluid.extrapolate(dt);
+
+			forTiles([&](const std::size_t begin, const std::size_t end) {
+				forSplit(begin, end, [&](const std::size_t first, const std::size_t last) {
+					fluid.advectVelColumns(dt, first, last);
+				});
+			});
+			std::swap(fluid.h_v, fluid.newH_v);
+			std::swap(fluid.v_v, fluid.newV_v);
+
+			forTiles([&](const std::size_t begin, const std::size_t end) {
+				forSplit(begin, end, [&](const std::size_t first, const std::size_t last) {
+					fluid.advectSmokeColumns(dt, first, last);
+				});
+			});
+			fluid.swapScalars();
+		}
+
+	private:
+		static constexpr std::size_t numPlanes = 8;
+
+		// Calls fn(begin, end) with the columns of every tile, in order.
+		template<typename Fn>
+		void forTiles(Fn&& fn)
+		{
+			for (std::size_t tile = 0; tile < numTiles(); tile++) {
+				enter(tile);
+
+				const std::size_t begin = tile * tileColumns;
+				fn(begin, std::min(begin + tileColumns, m_fluid.numX));
+			}
+		}
+
+		// Divides the columns [begin, end) of one tile among the pool's workers.
+		template<typename Fn>
+		void forSplit(const std::size_t begin, const std::size_t end, Fn&& fn)
+		{
+			if (begin >= end)
+				return;
+
+			if (!m_fluid.pool) {
+				fn(begin, end);
+				return;
+			}
+
+			m_fluid.pool->parallelFor(end - begin, 0, end - begin, [&](std::size_t, const std::size_t first, const std::size_t last) {
+				fn(begin + first, begin + last);
+			});
+		}
+
+		// Prefetches the tiles ahead of `tile` and evicts the one two tiles behind it.
+		// The last tiles of a phase are evicted when the next phase enters tile 0.
+		void enter(const std::size_t tile)
+		{
+			const std::size_t count = numTiles();
+
+			if (tile == 0) {
+				for (std::size_t k = 1; k <= std::min<std::size_t>(2, count - 1); k++)
+					advise(count - k, false);
+			}
+
+			for (std::size_t k = 1; k <= lookahead && tile + k < count; k++)
+				advise(tile + k, true);
+
+			if (tile >= 2)
+				advise(tile - 2, false);
+		}
+
+		void advise(const std::size_t tile, const bool resident)
+		{
+			Fluid& fluid = m_fluid;
+			if (!fluid.arena->fileBacked())
+				return;
+
+			const std::size_t begin = tile * tileColumns * fluid.numY;
+			const std::size_t end = std::min((tile + 1) * tileColumns, fluid.numX) * fluid.numY;
+			const std::size_t bytes = (end - begin) * sizeof(float);
+
+			auto apply = [&](FieldPlane<float>& plane) {
+				if (resident)
+					fluid.arena->prefetch(plane.data() + begin, bytes);
+				else
+					fluid.arena->evict(plane.data() + begin, bytes);
+			};
+
+			for (FieldPlane<float>* plane : { &fluid.h_v, &fluid.newH_v, &fluid.v_v, &fluid.newV_v,
+				&fluid.pressure, &fluid.solid, &fluid.smoke, &fluid.newSmoke })
+				apply(*plane);
+			for (std::size_t c = 0; c < fluid.numScalars; c++) {
+				apply(fluid.scalars[c]);
+				apply(fluid.newScalars[c]);
+			}
+
+			// A coarse column holds k fine columns of k times the height.
+			const std::size_t k = fluid.smokeRefinement;
+			if (k > 1) {
+				for (FieldPlane<float>* plane : { &fluid.fineSmoke, &fluid.newFineSmoke }) {
+					if (resident)
+						fluid.arena->prefetch(plane->data() + begin * k * k, bytes * k * k);
+					else
+						fluid.arena->evict(plane->data() + begin * k * k, bytes * k * k);
+				}
+			}
+		}
+
+		Fluid& m_fluid;
+	};
+
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "fluid_sims.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace FluidSims
+{
+
+	// Velocity samples for batches of up to batchSize points, equal to sampleField(x, y,
+	// H_FIELD) and sampleField(x, y, V_FIELD) per point. Per component, the sample
+	// coordinates, cell indices and weights of the whole batch are computed in one plain
+	// loop, which the compiler vectorizes, before the gathers.
+	class VelocitySampler
+	{
+	public:
+		static constexpr std::size_t batchSize = 64;
+
+		explicit VelocitySampler(const Fluid& fluid)
+			: m_fluid(fluid)
+		{
+		}
+
+		void sample(const float* x, const float* y, const std::size_t count, float* u, float* v) const
+		{
+			assert(m_fluid.numCells <= UINT32_MAX && "batched sampling uses 32-bit cell indices");
+
+			const float h2 = 0.5f * m_fluid.h;
+			samplePlane(m_fluid.h_v, x, y, count, 0.0f, h2, u);
+			samplePlane(m_fluid.v_v, x, y, count, h2, 0.0f, v);
+		}
+
+	private:
+		// Fluid::stencilOn() and interpolate() over a batch, with the same arithmetic.
+		void samplePlane(const FieldPlane<float>& f, const float* xs, const float* ys, const std::size_t count,
+			const float dx, const float dy, float* out) const
+		{
+			const Fluid& fluid = m_fluid;
+			const std::size_t n = fluid.numY;
+			const float h = fluid.h;
+			const float h1 = 1.0f / h;
+			const float lastX = static_cast<float>(fluid.numX - 1);
+			const float lastY = static_cast<float>(n - 1);
+			const float maxX = fluid.numX * h;
+			const float maxY = n * h;
+
+			std::uint32_t k00[batchSize], k10[batchSize], k01[batchSize], k11[batchSize];
+			float tx[batchSize], ty[batchSize];
+
+			for (std::size_t k = 0; k < count; k++) {
+				const float x = std::max(std::min(xs[k], maxX), h) - dx;
+				const float y = std::max(std::min(ys[k], maxY), h) - dy;
+
+				// x and y are at least h / 2 after the clamp, so truncation is floor() and, unlike
+				// floor() without SSE4.1, vectorizes.
+				const float x0 = std::min(static_cast<float>(static_cast<std::int32_t>(x * h1)), lastX);
+				const float y0 = std::min(static_cast<float>(static_cast<std::int32_t>(y * h1)), lastY);
+				const float x1 = std::min(x0 + 1.0f, lastX);
+				const float y1 = std::min(y0 + 1.0f, lastY);
+				tx[k] = (x - x0 * h) * h1;
+				ty[k] = (y - y0 * h) * h1;
+
+				const std::uint32_t i0 = static_cast<std::uint32_t>(x0) * static_cast<std::uint32_t>(n);
+				const std::uint32_t i1 = static_cast<std::uint32_t>(x1) * static_cast<std::uint32_t>(n);
+				k00[k] = i0 + static_cast<std::uint32_t>(y0);
+				k10[k] = i1 + static_cast<std::uint32_t>(y0);
+				k01[k] = i0 + static_cast<std::uint32_t>(y1);
+				k11[k] = i1 + static_cast<std::uint32_t>(y1);
+			}
+
+			const float* data = f.data();
+			for (std::size_t k = 0; k < count; k++) {
+				const float sx = 1.0f - tx[k];
+				const float sy = 1.0f - ty[k];
+				out[k] = sx * sy * data[k00[k]] +
+					tx[k] * sy * data[k10[k]] +
+					tx[k] * ty[k] * data[k11[k]] +
+					sx * ty[k] * data[k01[k]];
+			}
+		}
+
+		const Fluid& m_fluid;
+	};
+
+	// Massless tracer particles carried by a Fluid's velocity, for pathlines. Positions are
+	// in the units of Fluid::sampleField(). Every step emits from the emitters, moves every
+	// tracer by the midpoint rule and drops the ones that left the interior, entered a solid
+	// cell or outlived maxAge. Advection runs in blocks of `batchSize` tracers, each sampled
+	// by a VelocitySampler; the result equals sampleField() per tracer.
+	class TracerSystem
+	{
+	public:
+		static constexpr std::size_t batchSize = 64;
+
+		// Structure of arrays, compacted after every step (emission order is kept).
+		struct Tracers
+		{
+			std::vector<float> x, y, age;
+
+			std::size_t size() const { return x.size(); }
+
+			void resize(const std::size_t count)
+			{
+				x.resize(count);
+				y.resize(count);
+				age.resize(count);
+			}
+		};
+
+		// Emits `rate` tracers per second spread evenly over the segment (x0, y0)-(x1, y1),
+		// jittered along it.
+		struct Emitter
+		{
+			float x0 = 0.0f, y0 = 0.0f;
+			float x1 = 0.0f, y1 = 0.0f;
+			float rate = 0.0f;
+			float pending = 0.0f;	// fraction of a tracer carried over to the next step
+		};
+
+		Tracers tracers;
+		std::vector<Emitter> emitters;
+
+		// Seconds a tracer lives; 0 keeps it until it leaves the fluid.
+		float maxAge = 0.0f;
+
+		// Emission stops while this many tracers are alive.
+		std::size_t capacity = std::size_t{ 1 } << 22;
+
+		explicit TracerSystem(const Fluid& fluid)
+			: m_fluid(fluid),
+			m_sampler(fluid)
+		{
+		}
+
+		void clear()
+		{
+			tracers.resize(0);
+			for (Emitter& emitter : emitters)
+				emitter.pending = 0.0f;
+		}
+
+		void step(const float dt)
+		{
+			emit(dt);
+			advect(dt);
+		}
+
+		void emit(const float dt)
+		{
+			for (Emitter& emitter : emitters) {
+				emitter.pending += emitter.rate * dt;
+				const std::size_t count = std::min(static_cast<std::size_t>(emitter.pending), capacity - std::min(capacity, tracers.size()));
+				emitter.pending -= static_cast<float>(count);
+
+				const std::size_t first = tracers.size();
+				tracers.resize(first + count);
+
+				for (std::size_t k = 0; k < count; k++) {
+					m_seed = hashBits(m_seed + 1);
+					const float t = (k + unitFloat(m_seed)) / count;
+					tracers.x[first + k] = emitter.x0 + t * (emitter.x1 - emitter.x0);
+					tracers.y[first + k] = emitter.y0 + t * (emitter.y1 - emitter.y0);
+					tracers.age[first + k] = 0.0f;
+				}
+			}
+		}
+
+		// Moves every tracer by one midpoint step through the current velocity and compacts
+		// the survivors. Each worker advects and compacts its own strip, then copies it to its
+		// offset in the output, so no step is serial.
+		void advect(const float dt)
+		{
+			const Fluid& fluid = m_fluid;
+			m_h1 = 1.0f / fluid.h;
+			const std::size_t count = tracers.size();
+			const std::size_t workers = fluid.pool ? fluid.pool->size() : 1;
+
+			m_kept.assign(workers, 0);
+
+			forStrips(count, [&](const std::size_t worker, const std::size_t begin, const std::size_t end) {
+				float u[batchSize], v[batchSize], xMid[batchSize], yMid[batchSize];
+				std::size_t kept = begin;
+
+				for (std::size_t first = begin; first < end; first += batchSize) {
+					const std::size_t size = std::min(batchSize, end - first);
+					float* x = tracers.x.data() + first;
+					float* y = tracers.y.data() + first;
+					float* age = tracers.age.data() + first;
+
+					sampleVelocity(x, y, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						xMid[k] = x[k] + 0.5f * dt * u[k];
+						yMid[k] = y[k] + 0.5f * dt * v[k];
+					}
+
+					sampleVelocity(xMid, yMid, size, u, v);
+					for (std::size_t k = 0; k < size; k++) {
+						x[k] += dt * u[k];
+						y[k] += dt * v[k];
+						age[k] += dt;
+					}
+
+					for (std::size_t k = 0; k < size; k++) {
+						if (!alive(x[k], y[k], age[k]))
+							continue;
+
+						tracers.x[kept] = x[k];
+						tracers.y[kept] = y[k];
+						tracers.age[kept] = age[k];
+						kept++;
+					}
+				}
+
+				m_kept[worker] = kept - begin;
+			});
+
+			std::size_t total = 0;
+			m_offset.resize(workers);
+			for (std::size_t worker = 0; worker < workers; worker++) {
+				m_offset[worker] = total;
+				total += m_kept[worker];
+			}
+
+			m_next.resize(total);
+			forStrips(count, [&](const std::size_t worker, const std::size_t begin, std::size_t) {
+				const std::size_t kept = m_kept[worker];
+				const std::size_t to = m_offset[worker];
+				std::copy(tracers.x.begin() + begin, tracers.x.begin() + begin + kept, m_next.x.begin() + to);
+				std::copy(tracers.y.begin() + begin, tracers.y.begin() + begin + kept, m_next.y.begin() + to);
+				std::copy(tracers.age.begin() + begin, tracers.age.begin() + begin + kept, m_next.age.begin() + to);
+			});
+
+			std::swap(tracers, m_next);
+		}
+
+		// The velocity at `count` (at most batchSize) points, as sampleField(x, y, H_FIELD)
+		// and sampleField(x, y, V_FIELD) give it.
+		void sampleVelocity(const float* x, const float* y, const std::size_t count, float* u, float* v) const
+		{
+			m_sampler.sample(x, y, count, u, v);
+		}
+
+	private:
+		bool alive(const float x, const float y, const float age) const
+		{
+			const Fluid& fluid = m_fluid;
+			const float gx = x * m_h1;
+			const float gy = y * m_h1;
+			if (!(gx >= 1.0f && gy >= 1.0f) || (maxAge > 0.0f && age > maxAge))
+				return false;
+
+			const std::size_t i = static_cast<std::size_t>(gx);
+			const std::size_t j = static_cast<std::size_t>(gy);
+			return i < fluid.numX - 1 && j < fluid.numY - 1 && fluid.solid[i * fluid.numY + j] != 0.0f;
+		}
+
+		// Calls fn(worker, begin, end) with every worker's strip of [0, count), the same split
+		// on every call.
+		template<typename Fn>
+		void forStrips(const std::size_t count, Fn&& fn)
+		{
+			if (!m_fluid.pool) {
+				fn(0, 0, count);
+				return;
+			}
+
+			m_fluid.pool->parallelFor(count, 0, count, fn);
+		}
+
+		const Fluid& m_fluid;
+		VelocitySampler m_sampler;
+		std::uint32_t m_seed = 0;
+		float m_h1 = 0.0f;
+
+		std::vector<std::size_t> m_kept;
+		std::vector<std::size_t> m_offset;
+		Tracers m_next;
+	};
+
+}
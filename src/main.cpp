@@ -4,10 +4,12 @@
 #include "core/Application.h"
 
 #include "fluid_scene.h"
+#include "fluid_bench.h"
 
 #include <chrono>
 #include <iostream>
 #include <functional>
+#include <string>
 
 #include <vector>
 #include <iterator>
@@ -136,6 +138,10 @@ public:
 //kernel32.lib;user32.lib;gdi32.lib;winspool.lib;comdlg32.lib;advapi32.lib;shell32.lib;ole32.lib;oleaut32.lib;uuid.lib;odbc32.lib;odbccp32.lib;%(AdditionalDependencies)
 int main(int argc, const char** argv)
 {
+  // Headless benchmarks, see FluidSims::BenchOptions for the flags.
+  if (argc > 1 && std::string(argv[1]) == "--bench")
+    return FluidSims::runBenchmarks(argc - 1, argv + 1);
+
   if (ge::WindowManager::get().init_subsystem() != 0) {
     std::cout << "Something happened while initializing window subsystem\n";
     return -1;